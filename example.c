@@ -72,8 +72,9 @@ void* render_cpu(void *arg) {
         // render the RGB data to the active BCM buffers.
         scene->bcm_mapper(scene, NULL);
 
-        // calcualte_fps will delay execution to achieve the desired frames per second
-        calculate_fps(scene->fps, scene->show_fps);
+        // hub_frame_sync will delay execution to achieve the desired frames per second
+        // and with -v wait for the panel to show the frame
+        hub_frame_sync(scene, scene->fps);
     }
 }
 
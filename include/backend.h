@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_BACKEND_H
+#define _HUB75_BACKEND_H 1
+
+// shared memory name of the preview image, see hub_preview_open()
+#ifndef HUB_PREVIEW_NAME
+#define HUB_PREVIEW_NAME "/rpihub75_preview"
+#endif
+
+#define HUB_PREVIEW_MAGIC   0x57455650
+#define HUB_PREVIEW_VERSION 1
+
+// refreshes per second of the preview backend
+#ifndef PREVIEW_HZ
+#define PREVIEW_HZ 60
+#endif
+
+/**
+ * @brief where render_forever sends the bcm buffers. every backend has its own scan out loop:
+ * shifting a row, latching it and presenting a finished refresh (vsync) are inlined into scan,
+ * an indirect call per pixel would cost more than the GPIO store it replaces.
+ *
+ * render_forever calls init, scan until scene->do_render is false, stats if scene->show_fps
+ * is set, then close.
+ */
+typedef struct hub_backend {
+    const char *name;
+    /** @brief the Pi whose bcm encoding scan expects, 4 for SET / CLR pairs, 5 for pin masks. 0 for either */
+    uint8_t pi_model;
+    /** @brief map or open the output, die() if that fails. returns the state passed to the other calls */
+    void *(*init)(scene_info *scene);
+    /** @brief the scan out loop, returns when scene->do_render is false */
+    void  (*scan)(scene_info *scene, void *state);
+    /** @brief print what the backend measured, NULL if nothing */
+    void  (*stats)(FILE *out, const scene_info *scene, const void *state);
+    /** @brief release what init set up */
+    void  (*close)(scene_info *scene, void *state);
+} hub_backend;
+
+/** @brief Pi5 RIO registers */
+extern const hub_backend hub_backend_pi5;
+/** @brief Pi3/4 GPSET0 / GPCLR0 */
+extern const hub_backend hub_backend_pi4;
+/** @brief the Pi5 or Pi3/4 loop storing to memory instead of GPIO, to benchmark the loops anywhere */
+extern const hub_backend hub_backend_memory;
+/** @brief records every store to scene->gpio_trace, see trace.h */
+extern const hub_backend hub_backend_trace;
+/** @brief renders what the panel would show to shared memory HUB_PREVIEW_NAME, see hub_preview */
+extern const hub_backend hub_backend_preview;
+
+/**
+ * @brief find a backend by name: pi5, pi4, memory, trace, preview
+ * @return const hub_backend* NULL if there is none by that name
+ */
+const hub_backend *hub_backend_find(const char *name);
+
+/**
+ * @brief the backend render_forever uses: scene->backend, else trace if scene->gpio_trace is set,
+ * else the GPIO of this Pi. die()s on anything that is not a Pi3, 4 or 5
+ */
+const hub_backend *hub_backend_select(const scene_info *scene);
+
+
+/**
+ * @brief the image the panel would show, mapped at HUB_PREVIEW_NAME in /dev/shm by the preview backend.
+ * rgb is in the scene image layout (3 bytes per pixel), the LED duty cycle of every color.
+ *
+ * seq is a seqlock: the backend makes it odd, writes rgb, then makes it even again. a reader loads
+ * seq (acquire), retries while it is odd, copies rgb, and keeps the copy only if seq is unchanged
+ * after an acquire fence. hub_preview_read() does this, tools/hub_preview.c saves a frame as PPM.
+ * the name is unlinked when the backend closes
+ */
+typedef struct {
+    /** @brief HUB_PREVIEW_MAGIC and HUB_PREVIEW_VERSION, checked by hub_preview_open() */
+    uint32_t magic;
+    uint32_t version;
+    uint16_t width;
+    uint16_t height;
+    /** @brief odd while rgb is being written, incremented again when the frame is done */
+    atomic_uint seq;
+    uint8_t  rgb[];
+} hub_preview;
+
+/**
+ * @brief map the preview image of a running preview backend (in this or another process), read only
+ *
+ * @param name shared memory name, HUB_PREVIEW_NAME by default
+ * @return const hub_preview* the preview, or NULL if not found or the wrong version
+ */
+const hub_preview *hub_preview_open(const char *name);
+
+/**
+ * @brief copy a consistent frame out of the preview
+ *
+ * @param preview from hub_preview_open()
+ * @param rgb width * height * 3 bytes
+ * @return uint32_t the frame's sequence number
+ */
+uint32_t hub_preview_read(const hub_preview *preview, uint8_t *rgb);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rpihub75.h"
+#include "trace.h"
+
+#ifndef _HUB75_DECODE_H
+#define _HUB75_DECODE_H 1
+
+/**
+ * @brief HUB75 protocol replay of a GPIO trace: the panel's shift register, output latch,
+ * row address and OE, driven by the recorded register stores.
+ *
+ * each latched row is stored in planes as the color pins of every column. it belongs to the
+ * row selected when the next row is latched (the scan out keeps the latched row selected while
+ * the next one is shifted in), and to the next bit plane of that row. intensity integrates the
+ * time each LED is actually lit, at whatever row is selected while OE is low.
+ *
+ * rows and widths are the scan layout (scene->geometry), intensity is mapped back to the image
+ * with the scene's scan pattern, see scan.h
+ */
+typedef struct {
+    /** @brief clocks per row and address rows, scene->geometry width and half_height */
+    uint16_t width;
+    uint16_t half_height;
+    uint8_t  bit_depth;
+    uint8_t  num_ports;
+    /** @brief every color pin of the ports, the pins kept in shift, latched and planes */
+    uint32_t color_pins;
+    /** @brief address lines that select each row */
+    uint32_t row_address[32];
+    /** @brief image pixel of each scan layout pixel, NULL for a straight scan. see scene->scan_gather */
+    uint32_t *gather;
+
+    /** @brief replayed pin state and the time of the last store */
+    uint32_t pins;
+    uint64_t ticks;
+    uint64_t first_ticks;
+
+    /** @brief color pins clocked in since the last latch, and how many clocks that was */
+    uint32_t *shift;
+    uint32_t  shifted;
+    /** @brief the output latch, valid once the first row is latched */
+    uint32_t *latched;
+    uint32_t  latched_width;
+    bool      latch_valid;
+    /** @brief lit ticks of the latched row at each row address since it was latched */
+    uint64_t *lit_rows;
+    /** @brief bit planes seen so far for each row */
+    uint32_t *row_planes;
+
+    uint64_t stores;
+    uint64_t clocks;
+    uint64_t latches;
+    /** @brief latches where the number of clocks since the last latch was not width */
+    uint64_t bad_rows;
+    /** @brief ticks with OE low and a row latched */
+    uint64_t lit_ticks;
+
+    /** @brief color pins of [bit_depth][half_height][width], the latest latch of each row and plane */
+    uint32_t *planes;
+    /** @brief RGB lit ticks of [num_ports * panel_height][width][3], same layout as the scene image.
+     * fractions of the traced time after hub_decode_finish() */
+    double   *intensity;
+    bool      finished;
+} hub_decode;
+
+
+/**
+ * @brief create a decoder for the scene's panel layout
+ *
+ * @param scene geometry, scan pattern, bit_depth and num_ports are used
+ * @return hub_decode*
+ */
+hub_decode *hub_decode_create(const scene_info *scene);
+
+/**
+ * @brief replay one register store
+ */
+void hub_decode_store(hub_decode *decode, const gpio_trace_record *record);
+
+/**
+ * @brief replay every record of a trace in order, oldest first.
+ * the per row plane count assumes the trace starts at the start of a refresh
+ */
+void hub_decode_trace(hub_decode *decode, const hub_trace *trace);
+
+/**
+ * @brief close the last latched row and turn intensity into the fraction of the traced time
+ * each LED was lit
+ */
+void hub_decode_finish(hub_decode *decode);
+
+/**
+ * @brief print stores, clocks and timing per pixel, per row and the lit duty cycle
+ *
+ * @param out
+ * @param decode
+ * @param tick_hz ticks per second of the trace timestamps
+ */
+void hub_decode_print(FILE *out, const hub_decode *decode, const uint64_t tick_hz);
+
+void hub_decode_free(hub_decode *decode);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_DELAY_H
+#define _HUB75_DELAY_H 1
+
+// spin iterations timed for each calibration sample
+#define CALIBRATE_SPINS   10000
+// samples per calibration, the median is used so one preempted or boosted sample does not skew it
+#define CALIBRATE_SAMPLES 7
+// how often the cpufreq watcher checks the cpu frequency
+#ifndef CPUFREQ_CHECK_MS
+#define CPUFREQ_CHECK_MS  1000
+#endif
+
+/**
+ * @brief busy wait count iterations. the loop the calibration measures, so use nothing else
+ * for GPIO timing
+ */
+__attribute__((always_inline))
+static inline void spin(const uint32_t count) {
+    for (volatile uint32_t s=0; s<count; s++) {
+        asm volatile ("" : : : "memory");
+    }
+}
+
+/**
+ * @brief current frequency from a cpufreq file (kHz, like scaling_cur_freq)
+ *
+ * @param filename
+ * @return uint32_t the frequency in kHz, 0 if the file can not be read
+ */
+uint32_t cpufreq_khz(const char *filename);
+
+/**
+ * @brief measure spin() against CLOCK_MONOTONIC_RAW and convert the GPIO_*_NS delays to spin counts.
+ * must run on the scan out cpu
+ *
+ * @param delays the delays to fill
+ * @param cpufreq_file the frequency file to watch, NULL for the calling cpu's scaling_cur_freq
+ */
+void gpio_delays_init(gpio_delays *delays, const char *cpufreq_file);
+
+/**
+ * @brief start the cpufreq watcher: a SCHED_OTHER thread off the scan out cpu that reads the
+ * cpufreq file every CPUFREQ_CHECK_MS and, when the frequency changed, publishes the calibrated
+ * spin counts rescaled to it. call after gpio_delays_init()
+ *
+ * @param scene the scene information, for the thread placement
+ * @param delays from gpio_delays_init()
+ */
+void gpio_delays_watch(const scene_info *scene, gpio_delays *delays);
+
+/**
+ * @brief stop and join the cpufreq watcher, if it is running
+ *
+ * @param delays
+ */
+void gpio_delays_unwatch(gpio_delays *delays);
+
+/**
+ * @brief take the spin counts the cpufreq watcher published, if they changed. a single relaxed
+ * load and no syscall, so the scan out loops call it between refreshes
+ *
+ * @param delays
+ * @return true if the delays changed
+ */
+bool gpio_delays_update(gpio_delays *delays);
+
+/**
+ * @brief set up the pacer for refresh_hz. the first REFRESH_WARMUP refreshes are only timed
+ *
+ * @param pacer
+ * @param refresh_hz refreshes per second, 0 to refresh as fast as possible
+ */
+void refresh_pacer_init(refresh_pacer *pacer, const uint16_t refresh_hz);
+
+/**
+ * @brief time one warm up refresh ending at now. after the last one die() if the slowest left
+ * less than REFRESH_MIN_HEADROOM percent of the period, else the next refresh ends at now + period
+ *
+ * @param pacer
+ * @param now hub_cycles() at the end of the refresh
+ */
+void refresh_pacer_warmup(refresh_pacer *pacer, const uint64_t now);
+
+#endif
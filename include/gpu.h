@@ -1,13 +1,75 @@
+#include "rpihub75.h"
+
+#ifndef _HUB75_GPU_H
+#define _HUB75_GPU_H 1
+
+// pixel buffer objects render_shader reads back through. frame N renders while frame
+// N - (GPU_READBACK_RING - 1) is mapped and encoded, 2 overlaps one frame of GPU and CPU work
+#ifndef GPU_READBACK_RING
+#define GPU_READBACK_RING 2
+#endif
+
+// DRM device render_shader creates its GBM device on. when it can not be opened (or there is no
+// GBM) rendering falls back to surfaceless EGL, which any Mesa driver (llvmpipe without a GPU) supports
+#ifndef GPU_DRM_DEVICE
+#define GPU_DRM_DEVICE "/dev/dri/card0"
+#endif
+
+// render scale range of scene->gpu_adaptive_scale in percent of the scene size, and the step it moves in
+#ifndef GPU_SCALE_MIN
+#define GPU_SCALE_MIN 25
+#endif
+#ifndef GPU_SCALE_MAX
+#define GPU_SCALE_MAX 200
+#endif
+#ifndef GPU_SCALE_STEP
+#define GPU_SCALE_STEP 5
+#endif
+
+// percent of the frame time (1 / scene->fps) the GPU may spend on a frame before the render scale drops
+#ifndef GPU_SCALE_BUDGET
+#define GPU_SCALE_BUDGET 85
+#endif
+
+// frames the GPU time is averaged over between render scale changes
+#ifndef GPU_SCALE_FRAMES
+#define GPU_SCALE_FRAMES 30
+#endif
+
+// time frames with EXT_disjoint_timer_query when the driver has it. 0 estimates the GPU time from the frame fences
+#ifndef GPU_TIMER_QUERY
+#define GPU_TIMER_QUERY 1
+#endif
+
+// longest render_shader waits on a frame fence before checking scene->do_render again
+#ifndef GPU_FENCE_TIMEOUT_NS
+#define GPU_FENCE_TIMEOUT_NS 100000000
+#endif
+
 /**
- * @brief render the shadertoy compatible shader source code in the 
+ * @brief render the shadertoy compatible shader source code in the
  * file pointed to by scene->shader_file
- * 
+ *
  * exits if shader is unable to be loaded, compiled or rendered
- * 
+ *
  * loop exits and memory is freed if/when scene->do_render becomes false
- * 
+ *
  * frame delay is adaptive and updates to current scene->fps on each frame update
- * 
+ *
+ * frames are drawn to an offscreen framebuffer and read back through a ring of GPU_READBACK_RING
+ * pixel buffer objects, so the GPU renders the next frame while the CPU encodes this one.
+ * with scene->show_fps the time of each stage is printed every TELEMETRY_REPORT_S seconds
+ *
+ * a .passes file next to the shader adds shadertoy buffer passes (A-D), rendered before the
+ * shader each frame into their own textures, at their own resolution. passes read each other,
+ * or their own last frame, as channels. see shader_passes_load() for the format
+ *
+ * the GPU time of every frame is measured (timer queries, else fence timing). with
+ * scene->gpu_adaptive_scale the shader renders at GPU_SCALE_MIN - GPU_SCALE_MAX percent of the
+ * scene size to keep it under GPU_SCALE_BUDGET percent of the frame time, published in scene->render_scale
+ *
  * @param arg pointer to the current scene_info object
  */
-void *render_shader(void *arg);
\ No newline at end of file
+void *render_shader(void *arg);
+
+#endif
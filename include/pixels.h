@@ -29,52 +29,33 @@
 
 
 /**
- * @brief function definition to function that maps RGB image data
- * to BCM data for shifting out to GPIO
+ * @brief the specialized scalar row encoder for the scene bit depth, pixel order, port count and stride
+ * 
+ * @param scene 
+ * @return func_bcm_encoder_t 
  */
-typedef void (*update_bcm_signal_fn)(
-    const scene_info *scene,
-    const void *bits,  // Use void* to handle both uint32_t* and uint64_t*
-    uint32_t *bcm_signal,
-    const uint8_t *image);
-    // XXX FIX
-    //const uint8_t *image);
+func_bcm_encoder_t bcm_scalar_encoder(const scene_info *scene);
 
 /**
- * @brief update_bcm_signal_fn implementation for up to 64 bit BCM data
+ * @brief set scene->bcm_encoder. the SIMD encoder if USE_SIMD_ENCODER and the cpu supports it,
+ * else bcm_scalar_encoder(). must be called again if bit depth, pixel order, ports or stride change
  * 
- * @param scene  pointer to current scene info
- * @param void_bits RGB to BCM index data. Red 0-255, Green 256-511, Blue 512 - 768
- * @param bcm_signal the ouput buffer to write BCM data to
- * @param image the input RGB or RGBA image to render
- * @param offset offset into the bcm buffer
+ * @param scene 
  */
-void update_bcm_signal_64(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ images);
-    // XXX fix
-    //const uint8_t *__restrict__ image,
-    //const uint32_t offset);
+void bcm_select_encoder(scene_info *scene);
+
 
 
 /**
- * @brief update_bcm_signal_fn implementation for up to 32 bit BCM data
+ * @brief map a normalized intensity to a binary weighted bcm value for BCM_MODE_BINARY.
+ * bit k of the result is displayed for 2^k time units so num_bits planes give 2^num_bits levels.
  * 
- * @param scene 
- * @param void_bits 
- * @param bcm_signal 
- * @param image 
- * @param offset 
+ * @param input intensity 0-1
+ * @param num_bits number of bit planes (1-16)
+ * @return uint32_t the plane bit mask
  */
-void update_bcm_signal_32(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image);
-
-
+__attribute__((pure))
+uint32_t normal_to_bcm_binary(const Normal input, const uint8_t num_bits);
 
 /**
  * @brief this function takes the image data and maps it to the bcm signal.
@@ -86,6 +67,17 @@ void update_bcm_signal_32(
  */
 void map_byte_image_to_bcm(scene_info *scene, uint8_t *image);
 
+/**
+ * @brief the tone mapped rgb to bcm lookup table map_byte_image_to_bcm() encodes with.
+ * built by tone_map_rgb_bits() and rebuilt when scene->tone_mapper, bcm_mode or bit_depth changes,
+ * or the brightness when it is part of the table (binary BCM, or PWM without jitter_brightness)
+ * 
+ * @param scene the scene information
+ * @param generation if not NULL set to a counter that changes every time the table is rebuilt
+ * @return const void* 0-255 red, 256-511 green, 512-767 blue. uint32_t for <= 32 bits, uint64_t above
+ */
+const void *bcm_tone_lut(const scene_info *scene, uint32_t *generation);
+
 /**
  * @brief convert linear RGB to normalized CIE1931 XYZ color space
  * https://en.wikipedia.org/wiki/CIE_1931_color_space
@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef _HUB75_POOL_H
+#define _HUB75_POOL_H 1
+
+// maximum number of encode threads, including the thread calling encode_pool_run()
+#define MAX_ENCODE_THREADS 8
+
+/**
+ * @brief a slice of work for one worker: rows [first_row, last_row)
+ *
+ * @param arg the job argument passed to encode_pool_run()
+ * @param scratch this worker's scratch space, scratch_size bytes, 64 byte aligned
+ * @param first_row first row of the slice
+ * @param last_row one past the last row of the slice
+ */
+typedef void (*pool_job_fn)(void *arg, void *scratch, const uint16_t first_row, const uint16_t last_row);
+
+typedef struct encode_pool encode_pool;
+
+/**
+ * @brief start num_threads - 1 persistent worker threads. the thread calling encode_pool_run()
+ * is always worker 0. workers are pinned one per cpu, never on avoid_cpu.
+ * will die() if the threads can not be created
+ *
+ * @param num_threads total number of threads to split work over (1 - MAX_ENCODE_THREADS)
+ * @param scratch_size bytes of scratch space for each worker
+ * @param avoid_cpu the scan out cpu, see scene->scanout_cpu
+ * @return encode_pool*
+ */
+encode_pool *encode_pool_create(const uint8_t num_threads, const size_t scratch_size, const uint8_t avoid_cpu);
+
+/**
+ * @brief split num_rows rows over all workers and run job on each slice.
+ * returns once every slice is done, so the result can be published right away
+ *
+ * @param pool
+ * @param job
+ * @param arg passed to every job call
+ * @param num_rows
+ */
+void encode_pool_run(encode_pool *pool, pool_job_fn job, void *arg, const uint16_t num_rows);
+
+/**
+ * @brief number of threads (including the caller) work is split over
+ */
+uint8_t encode_pool_size(const encode_pool *pool);
+
+/**
+ * @brief stop and join the worker threads and free the pool
+ */
+void encode_pool_destroy(encode_pool *pool);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_REALTIME_H
+#define _HUB75_REALTIME_H 1
+
+/**
+ * @brief what a thread does, decides where realtime_place_thread() puts it
+ */
+enum thread_role_e {
+    // render_forever, pinned alone to scene->scanout_cpu at scene->scanout_priority
+    THREAD_SCANOUT,
+    // the frame source (shader, video, cpu renderer), may float over every cpu except scene->scanout_cpu
+    THREAD_SOURCE
+};
+
+/**
+ * @brief true if cpu is in a kernel cpu list like "1-3,5" (/sys/devices/system/cpu/isolated format)
+ *
+ * @param list the cpu list, may be empty
+ * @param cpu
+ * @return true if cpu is in the list
+ */
+bool cpu_list_contains(const char *list, const int cpu);
+
+/**
+ * @brief the nth online cpu that is not avoid_cpu. wraps around when there are fewer cpus than index
+ *
+ * @param index
+ * @param avoid_cpu
+ * @return int the cpu, or -1 if avoid_cpu is the only cpu
+ */
+int realtime_spare_cpu(const uint8_t index, const uint8_t avoid_cpu);
+
+/**
+ * @brief set the affinity of a thread for its role. encode workers are placed by the pool, see pool.c.
+ * only warns on failure, placement is a hint for everything but the scan out thread
+ *
+ * @param scene the scene information
+ * @param thread the thread to place
+ * @param role what the thread does
+ */
+void realtime_place_thread(const scene_info *scene, const pthread_t thread, const enum thread_role_e role);
+
+/**
+ * @brief warn if cpu is not isolated from the scheduler (isolcpus=) or still takes the
+ * scheduler tick (nohz_full=). both add jitter to the scan out
+ *
+ * @param cpu the scan out cpu
+ */
+void realtime_check_isolation(const uint8_t cpu);
+
+/**
+ * @brief move every interrupt that allows it (and the default for new ones) off cpu.
+ * per cpu and kernel managed interrupts refuse and are left alone. requires root
+ *
+ * @param cpu the cpu to clear
+ * @return int number of interrupts moved
+ */
+int realtime_move_irqs(const uint8_t cpu);
+
+/**
+ * @brief prepare the calling thread for scan out: pin it to scene->scanout_cpu (die() on failure),
+ * warn about missing cpu isolation, move interrupts if scene->move_irqs, mlockall() if
+ * scene->lock_memory and switch to SCHED_FIFO if scene->scanout_priority > 0. both are opt in.
+ * called by render_forever()
+ *
+ * @param scene the scene information
+ */
+void realtime_setup_scanout(const scene_info *scene);
+
+#endif
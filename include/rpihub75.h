@@ -74,13 +74,54 @@
 
 #define SERVER_PORT 22222
 
-// global OE jitter mask, should be a prime >1031 and <=4093
-// we don't want to make this too large, as it will consume memory
-// and decrease L1-L3 cache locality of other data
+// length of the OE mask returned by create_jitter_mask()
 #define JITTER_SIZE 32771 
 
-#define JITTER_MAX_RUN_LEN 4
-#define JITTER_PASSES 3
+// OE brightness sequence: 2^32 / golden ratio. the fractional parts of i / golden ratio are the
+// most evenly spread sequence there is, OE on clocks never bunch up or leave long gaps
+#define OE_SEQUENCE_STEP 0x9E3779B9U
+
+// binary coded modulation: display time of the least significant bit plane in nanoseconds.
+// bit plane k is displayed for BCM_LSB_NS << k
+#ifndef BCM_LSB_NS
+    #define BCM_LSB_NS 130
+#endif
+// maximum number of bit planes for BCM_MODE_BINARY (65536 levels per channel)
+#define MAX_BINARY_BITS 16
+
+// default scene->scanout_cpu. render_forever is pinned to this cpu, encode threads are kept off it
+#ifndef SCANOUT_CPU
+#define SCANOUT_CPU 3
+#endif
+
+// default SCHED_FIFO priority of render_forever, 0 to leave it SCHED_OTHER. the scan out loop never
+// yields, only raise it (-r) when scanout_cpu is isolated or the rest of the system can be starved
+#ifndef SCANOUT_PRIORITY
+#define SCANOUT_PRIORITY 0
+#endif
+
+// encode bcm data with NEON / SSE2 / AVX2 when the cpu has it. 0 to always use the specialized scalar encoders
+#ifndef USE_SIMD_ENCODER
+#define USE_SIMD_ENCODER 1
+#endif
+
+// fixed scene->refresh_hz: refreshes timed unpadded before the rate is checked and padding starts
+#ifndef REFRESH_WARMUP
+#define REFRESH_WARMUP 64
+#endif
+// fixed scene->refresh_hz: percent of the refresh period the slowest warm up refresh must leave free
+#ifndef REFRESH_MIN_HEADROOM
+#define REFRESH_MIN_HEADROOM 5
+#endif
+
+// hub_wait_vsync() gives up after this long without a panel refresh
+#ifndef VSYNC_TIMEOUT_MS
+#define VSYNC_TIMEOUT_MS 100
+#endif
+
+// scene->bcm_ready: low bits are the buffer index, BCM_FRAME_NEW is set while the frame is unseen
+#define BCM_FRAME_INDEX 0x3
+#define BCM_FRAME_NEW   0x4
 
 //////////////////////////////////////////////////////////
 
@@ -132,8 +173,23 @@
 /** @brief  CLEAR GPIO pins in bit mask (dont touch pins not in mask) */
 #define rioCLR ((rioregs *)(RIOBase + 0x3000 / 4))
 
-#define SLOW for (volatile int s=0;s<40;s++) { asm volatile ("" : : : "memory"); asm(""); }
-#define SLOW2 for (volatile int s=0;s<8;s++) { asm volatile ("" : : : "memory"); asm(""); }
+// GPIO settle times in ns, converted to calibrated spin counts by gpio_delays_init(). see delay.h
+// between the data stores of one pixel, and after the row address lines change
+#ifndef GPIO_SETTLE_NS
+#define GPIO_SETTLE_NS 60
+#endif
+// data setup before the clock rising edge, and the clock high time
+#ifndef GPIO_CLOCK_NS
+#define GPIO_CLOCK_NS 100
+#endif
+// latch pulse width
+#ifndef GPIO_LATCH_NS
+#define GPIO_LATCH_NS 25
+#endif
+// after the latch falls, before OE turns the latched row on
+#ifndef GPIO_OE_NS
+#define GPIO_OE_NS 60
+#endif
 
 // helpers for timing things...
 #define PRE_TIME struct timeval start, end; gettimeofday(&start, NULL);
@@ -314,6 +370,94 @@ enum pixel_order_e {
     PIXEL_ORDER_BGR
 };
 
+/**
+ * @brief how the bit planes are weighted in time
+ * BCM_MODE_PWM     - bit_depth equal weight planes, N of them set for intensity N. (bit_depth + 1 levels)
+ * BCM_MODE_BINARY  - plane k is displayed for BCM_LSB_NS << k. (2^bit_depth levels)
+ */
+enum bcm_mode_e {
+    BCM_MODE_PWM,
+    BCM_MODE_BINARY
+};
+
+/**
+ * @brief size of the bcm buffers, shared by the encoders and render_forever.
+ * the buffers are plane major, each (plane, row) is a contiguous run of row_words:
+ * bcm_signal[(plane * plane_words) + (y * row_words) + x]
+ *
+ * with scene->set_clr_pairs (Pi3/4) every row starts with the address line SET and CLR words,
+ * followed by a CLR, SET register pair for each pixel:
+ * bcm_signal[(plane * plane_words) + (y * row_words) + pixel_offset + (x * pixel_words)]
+ */
+typedef struct {
+    /** @brief pixels shifted out per row, scene->width * rows_per_address */
+    uint16_t width;
+    /** @brief rows per bit plane: address rows of the panel, scene->panel_height / 2 unless scene->scan_rows is set */
+    uint16_t half_height;
+    /** @brief panel rows of each half driven by one address, 1 for a straight scan. see scan.h */
+    uint8_t  rows_per_address;
+    /** @brief number of bit planes */
+    uint8_t  bit_depth;
+    /** @brief words per pixel, 2 for set / clr pairs */
+    uint8_t  pixel_words;
+    /** @brief words before the first pixel of each row, 2 for set / clr pairs */
+    uint8_t  pixel_offset;
+    /** @brief words between the start of 2 rows in the same plane */
+    uint32_t row_words;
+    /** @brief words between the same row in 2 planes */
+    uint32_t plane_words;
+    /** @brief words in each bcm buffer */
+    uint32_t frame_words;
+    /** @brief address lines while row y is shifted in: the row before y, which is being displayed */
+    uint32_t address[32];
+} bcm_geometry;
+
+/**
+ * @brief GPIO settle delays as spin() iteration counts for the current cpu frequency.
+ * the counts are owned by the scan out thread, the cpufreq watcher only writes published. see delay.h
+ */
+typedef struct {
+    /** @brief GPIO_SETTLE_NS in spins */
+    uint32_t settle;
+    /** @brief GPIO_CLOCK_NS in spins */
+    uint32_t clock;
+    /** @brief GPIO_LATCH_NS in spins */
+    uint32_t latch;
+    /** @brief GPIO_OE_NS in spins */
+    uint32_t oe;
+    /** @brief measured cost of one spin iteration in picoseconds, at calibration */
+    uint32_t ps_per_spin;
+    /** @brief cpu frequency in kHz at calibration, 0 if unknown */
+    uint32_t cpu_khz;
+    /** @brief settle, clock, latch and oe for the current frequency, 16 bits each. written by the watcher */
+    atomic_uint_fast64_t published;
+    /** @brief the published value settle, clock, latch and oe were last unpacked from */
+    uint64_t current;
+    /** @brief the cpufreq watcher thread, NULL if not running */
+    struct delay_watcher *watcher;
+    /** @brief cpufreq file the frequency is read from */
+    char cpufreq_file[128];
+} gpio_delays;
+
+/**
+ * @brief pads every refresh to 1 / scene->refresh_hz seconds of hub_cycles() ticks (the arm generic
+ * timer). owned by the scan out thread, see refresh_pacer_init() in delay.h
+ */
+typedef struct {
+    /** @brief ticks per refresh, 0 to refresh as fast as possible */
+    uint64_t period;
+    /** @brief end of the current refresh. while warming up, the start of the refresh being timed */
+    uint64_t deadline;
+    /** @brief unpadded refreshes left to time before padding starts */
+    uint32_t warmup;
+    /** @brief the slowest warm up refresh in ticks */
+    uint64_t busy_max;
+    /** @brief least padding added to a refresh in ticks, the headroom left at this rate */
+    atomic_uint_fast64_t headroom_min;
+    /** @brief refreshes that ran past their deadline, each skips to the next period */
+    atomic_uint_fast64_t missed;
+} refresh_pacer;
+
 // self referencing function pointers need this defined first
 struct scene_info;
 
@@ -323,6 +467,21 @@ typedef void (*func_tone_mapper_t)(const RGBF *in, RGBF *out, const float level)
 typedef uint8_t *(*func_image_mapper_t)( uint8_t *image_in, uint8_t *image_out, const struct scene_info *scene);
 typedef uint8_t *(image_mapper_t)(uint8_t *image_in, uint8_t *image_out, const struct scene_info *scene);
 
+// see telemetry.h
+struct hub_stats;
+// see trace.h
+struct hub_trace;
+// see scan.h
+struct scan_pattern;
+// see backend.h
+struct hub_backend;
+// see simd.h
+struct bcm_pin_table;
+struct bcm_encode_scratch;
+// encode one row of the image to every bit plane. see bcm_select_encoder()
+typedef void (*func_bcm_encoder_t)(const struct scene_info *scene, const struct bcm_pin_table *table,
+    const void *bits, uint32_t *bcm_signal, const uint8_t *image, struct bcm_encode_scratch *scratch);
+
 
 /**
  * @brief everything to define the scene and panel configuration 
@@ -351,8 +510,14 @@ typedef struct scene_info {
     /** @brief number of bits per color channel (8-64) */
     uint8_t bit_depth;
 
-    /** @brief brightness level (0-255) */
+    /** @brief brightness level (0-255). change it while rendering with hub_set_brightness() */
     uint8_t brightness;
+
+    /**
+     * @brief the PWM scan out turns OE on for the clocks where the OE sequence is below this,
+     * oe_threshold(brightness). set by hub_set_brightness() and render_forever
+     */
+    atomic_uint oe_threshold;
     /** @brief dithering strength. (0-10) 0 is off, improves simulated color in dark areas but reduces image sharpness */
     float dither;
 
@@ -363,25 +528,109 @@ typedef struct scene_info {
     uint8_t num_chains;
 
     /**
-     * @brief points to active buffer
-     * in update code use this to select the pwm buffer to render to: 
-     * (scene->buffer_ptr == 1)? scene->bcm_signalA : scene->bcm_signalB; 
+     * @brief triple buffered bcm data. bcm_mapper writes to bcm_back_buffer() and hands the
+     * frame to render_forever with bcm_publish(). render_forever picks up the newest frame
+     * with bcm_front_buffer(). the producer never blocks and never writes to the buffer on the wire.
      */
-    uint8_t buffer_ptr;
+    uint32_t *restrict bcm_signal[3];
+
+    /** @brief layout of the bcm_signal buffers, see bcm_geometry_init() */
+    bcm_geometry geometry;
+
+    /** @brief index of the buffer the producer is writing to. only touched by the producer */
+    uint8_t bcm_back;
+
+    /** @brief index of the newest complete frame. BCM_FRAME_NEW is set until render_forever picks it up */
+    atomic_uint_fast8_t bcm_ready;
+
+    /** @brief index of the buffer being shifted out. only written by render_forever */
+    atomic_uint_fast8_t bcm_front;
+
+    /** @brief index of the last frame bcm_publish() handed over. only touched by the producer */
+    uint8_t bcm_last;
+
+    /** @brief if true bcm_mapper only encodes rows whose image data changed and skips unchanged frames. -U clears it */
+    bool skip_unchanged;
+
+    /** @brief hash of the image rows each bcm buffer holds, one per half_height row. 0 = unknown */
+    uint64_t *row_hash[3];
+
+    /** @brief hash of the image rows of the frame being encoded */
+    uint64_t *image_hash;
+
+    /** @brief frames bcm_mapper did not publish because they matched the last published frame */
+    atomic_uint_fast32_t frames_unchanged;
+
+    /** @brief frames replaced by a newer frame before render_forever displayed them */
+    atomic_uint_fast32_t frames_dropped;
+
+    /** @brief percent of the scene size render_shader draws at, 0 if no shader is rendering. see scene->gpu_adaptive_scale */
+    atomic_uint_fast32_t render_scale;
+
+    /**
+     * @brief incremented by render_forever after every full set of bit planes. 32 bits so
+     * producers can futex wait on it, see hub_wait_vsync()
+     */
+    atomic_uint vsync_seq;
+
+    /** @brief number of threads blocked in hub_wait_vsync(). render_forever only calls FUTEX_WAKE if > 0 */
+    atomic_uint vsync_waiters;
+
+    /** @brief CLOCK_MONOTONIC time in ns of the last vsync_seq increment */
+    atomic_uint_fast64_t vsync_ns;
+
+    /** @brief threads bcm_mapper splits the frame over. 0 for one per cpu except scanout_cpu */
+    uint8_t encode_threads;
+
+    /** @brief cpu render_forever is pinned to. encode and source threads are kept off it, see realtime.h */
+    uint8_t scanout_cpu;
 
-    /** * @brief see buffer_ptr for usage */
-    uint32_t *restrict bcm_signalA __attribute__((aligned(16)));
-    uint32_t *restrict bcm_signalB __attribute__((aligned(16)));
+    /** @brief SCHED_FIFO priority of render_forever (1-99), 0 leaves it SCHED_OTHER */
+    uint8_t scanout_priority;
 
-    atomic_bool bcm_ptr;
+    /** @brief mlockall() before scan out so it never waits on a page fault. off by default, -M sets it */
+    bool lock_memory;
 
-    /** * @brief see buffer_ptr for usage */
+    /** @brief move every interrupt that allows it off scanout_cpu. changes system wide irq affinity */
+    bool move_irqs;
+
+    /** @brief encode worker threads, created on the first bcm_mapper call. see pool.h */
+    struct encode_pool *encode_pool;
+
+    /** @brief row encoder for this bit depth, pixel order, port count and stride. set by check_scene() */
+    func_bcm_encoder_t bcm_encoder;
+
+    /** @brief bit depth class, pixel order, ports and stride bcm_encoder was selected for */
+    uint16_t bcm_encoder_config;
+
+    /** @brief if true hub_frame_sync() holds producers until their last frame was shown on the panel */
+    bool vsync;
+
+    /** @brief RGB image the bcm_mapper reads from */
     //uint8_t *image __attribute__((aligned(16)));
     uint8_t *image;
 
     /** @brief a shader file to render on the GPU */
     char *shader_file;
 
+    /**
+     * @brief render_shader draws into GBM buffer objects and copies them out of the mapping once,
+     * no glReadPixels copy. falls back to the pixel buffer read back without GBM. see gpu.h
+     */
+    bool gpu_zero_copy;
+
+    /**
+     * @brief render_shader encodes the bit planes on the GPU with a GLES 3.1 compute shader and the
+     * CPU only copies them to the back buffer. needs the plain pwm layout, see gpu.h
+     */
+    bool gpu_encode;
+
+    /**
+     * @brief render_shader scales the resolution it draws at (GPU_SCALE_MIN - GPU_SCALE_MAX) to keep
+     * the GPU time of each frame inside scene->fps, and resamples to the scene size. see gpu.h
+     */
+    bool gpu_adaptive_scale;
+
     /** 
      * @brief the pwm mapping function to use
      * @see map_byte_image_to_pwm
@@ -437,6 +686,77 @@ typedef struct scene_info {
      * set to true to show the FPS on the screen
      */
     bool show_fps;
+
+    /** @brief publish scan out timing histograms to shared memory HUB_STATS_NAME, see telemetry.h */
+    bool telemetry;
+
+    /**
+     * @brief when set render_forever records every GPIO register store here instead of driving
+     * the pins, and needs no Pi. replay it with a hub_decode. see trace.h
+     */
+    struct hub_trace *gpio_trace;
+
+    /** @brief where render_forever sends the bcm buffers, NULL for the GPIO of this Pi (or gpio_trace). see backend.h */
+    const struct hub_backend *backend;
+
+    /**
+     * @brief encode GPIO SET / CLR register pairs for the Pi3/4 scan out instead of plain pin masks.
+     * the bcm_mapper does the pin transition math once per frame, the pi4 backend only stores.
+     * set by default_scene() on Pi3/4, required by the pi4 backend. see bcm_geometry
+     */
+    bool set_clr_pairs;
+
+    /** @brief cpufreq file to watch for frequency changes, NULL for the scan out cpu's scaling_cur_freq */
+    const char *cpufreq_file;
+
+    /** @brief calibrated GPIO delays, set up and kept current by render_forever. see delay.h */
+    gpio_delays delays;
+
+    /**
+     * @brief fixed panel refresh rate (a multiple of the camera shutter or mains frequency), every
+     * refresh is padded to 1 / refresh_hz with the panel blanked. 0 to refresh as fast as possible
+     */
+    uint16_t refresh_hz;
+
+    /** @brief refresh_hz deadlines and headroom, set up by render_forever */
+    refresh_pacer pacer;
+
+    /**
+     * @brief when true bcm_mapper bakes the row address lines and the OE brightness sequence into
+     * every GPIO word. render_forever then streams the words with no per-pixel arithmetic.
+     * the buffer is bit plane major: [bit plane][row][column]. Pi5 only.
+     * @see render_stream_planes
+     */
+    bool prebaked_stream;
+
+    /**
+     * @brief PWM (equal weight) or binary weighted bit planes. A/B the two with -B
+     * in BCM_MODE_BINARY bit_depth is the number of planes (1-16) and brightness is applied to the bcm data
+     */
+    enum bcm_mode_e bcm_mode;
+
+    /** @brief display time of the least significant plane in BCM_MODE_BINARY, nanoseconds */
+    uint16_t bcm_lsb_ns;
+
+    /**
+     * @brief BCM_MODE_BINARY: keep showing the latched plane while the next one is shifted in, the
+     * display is only blanked to latch and select the row. planes shorter than a shift are still
+     * finished before the shift so their weight stays exact. (the PWM scan out always overlaps,
+     * OE comes from the brightness sequence in every shifted word)
+     */
+    bool overlap_shift;
+
+    /** @brief pixel order and row addressing of multiplexed panels, NULL for straight. see scan.h */
+    const struct scan_pattern *scan_pattern;
+
+    /** @brief address rows of the panel (8 for a 1/8 scan 32 row panel), 0 for panel_height / 2 */
+    uint8_t scan_rows;
+
+    /** @brief image pixel of every scan layout pixel, set by bcm_geometry_init. NULL for a straight scan */
+    uint32_t *scan_gather;
+
+    /** @brief the image in scan layout, what the encoders read when scan_gather is set */
+    uint8_t *scan_image;
     
 } scene_info;
 
@@ -500,22 +820,138 @@ void *render_shader(void *arg);
 void dither_image(uint8_t *image, int width, int height);
 void apply_noise_dithering(uint8_t *image, int width, int height);
 
+/**
+ * @brief the Raspberry Pi model from /proc/cpuinfo, read once
+ * @return int 3, 4 or 5. 0 if not a supported Pi
+ */
+int hub_pi_model(void);
+
 /**
  * @brief verify that the scene configuration is valid
- * will die() if invalid configuration is found
+ * will die() if invalid configuration is found. selects the bcm encoder for the configuration
+ * @param scene 
+ */
+void check_scene(scene_info *scene);
+
+/**
+ * @brief compute scene->geometry from the scene width, panel height, scan pattern and bit depth.
+ * builds the scan gather table for multiplexed panels.
+ * must be called before the bcm buffers are allocated (default_scene does this)
  * @param scene 
  */
-void check_scene(const scene_info *scene);
+void bcm_geometry_init(scene_info *scene);
 
 
 uint8_t *u_mapper_impl(uint8_t *image_in, uint8_t *image_out, const struct scene_info *scene);
 uint8_t *flip_mapper_impl(const uint8_t *image_in, uint8_t *image_out, const struct scene_info *scene);
 
+/**
+ * @brief calculate an address line pin mask for row y
+ * 
+ * @param y the panel row number to calculate the mask for
+ * @param half_height number of addressable rows on the panel (panel_height / 2)
+ * @return uint32_t the bitmask for the address lines at row y
+ */
+uint32_t row_to_address(const int y, uint8_t half_height);
+
+/**
+ * @brief shift one complete set of bit planes from a pre-baked GPIO word stream.
+ * each word already contains the color pins, address lines and OE, so the inner loop
+ * is a single load and two stores per clock.
+ * 
+ * out, set and clr are normally &rio->Out, &rioSET->Out and &rioCLR->Out. Pass pointers
+ * to ordinary memory to run (and benchmark) the loop on any machine without GPIO.
+ * 
+ * @param scene scene configuration, width, panel_height and bit_depth are used
+ * @param stream bcm buffer created by map_byte_image_to_bcm with scene->prebaked_stream set
+ * @param out register that receives the full pin state for each clock
+ * @param set register that sets the pins in the written mask
+ * @param clr register that clears the pins in the written mask
+ * @param stats row and plane timing is recorded here if not NULL, see telemetry.h
+ */
+void render_stream_planes(const scene_info *scene, const uint32_t *restrict stream,
+    volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr, struct hub_stats *stats);
+
+/**
+ * @brief return the bcm buffer the producer should write the next frame to.
+ * only call from the thread that calls bcm_publish()
+ * 
+ * @param scene 
+ * @return uint32_t* buffer that is not on the wire and not waiting to be displayed
+ */
+uint32_t *bcm_back_buffer(scene_info *scene);
+
+/**
+ * @brief hand the frame in bcm_back_buffer() to render_forever. never blocks.
+ * if the previous frame was never displayed it is dropped and counted in scene->frames_dropped
+ * 
+ * @param scene 
+ */
+void bcm_publish(scene_info *scene);
+
+/**
+ * @brief return the bcm buffer render_forever should shift out. picks up the newest
+ * published frame if there is one. only call from the scan out thread
+ * 
+ * @param scene 
+ * @return uint32_t* the buffer on the wire
+ */
+uint32_t *bcm_front_buffer(scene_info *scene);
+
+/**
+ * @brief block until render_forever completes a full set of bit planes after last_seq.
+ * returns immediately if a refresh already happened. gives up after VSYNC_TIMEOUT_MS
+ * so a stopped render_forever can not hang the caller.
+ * 
+ * @param scene 
+ * @param last_seq the sequence number returned by the previous call, or scene->vsync_seq
+ * @param timestamp_ns if not NULL, set to the CLOCK_MONOTONIC time of the refresh in ns
+ * @return uint32_t the current refresh sequence number
+ */
+uint32_t hub_wait_vsync(scene_info *scene, const uint32_t last_seq, uint64_t *timestamp_ns);
+
+/**
+ * @brief end of a full refresh: wake hub_wait_vsync() waiters. for backends with their own
+ * scan out loop, see backend.h. only call from the scan out thread
+ *
+ * @param scene
+ */
+void hub_vsync_signal(scene_info *scene);
+
+/**
+ * @brief OE sequence threshold for a brightness: brightness / 255 of all clocks are below it.
+ * see OE_SEQUENCE_STEP
+ *
+ * @param brightness 0 - 255
+ * @return uint32_t
+ */
+uint32_t oe_threshold(const uint8_t brightness);
+
+/**
+ * @brief change the brightness, safe while render_forever is running. with jitter_brightness the
+ * PWM scan out uses the new OE duty cycle from its next row. binary BCM and PWM without jitter
+ * scale the bcm data instead, bcm_mapper rebuilds its LUT and the next encoded frame has it
+ *
+ * @param scene
+ * @param brightness 0 - 255
+ */
+void hub_set_brightness(scene_info *scene, const uint8_t brightness);
+
+/**
+ * @brief call after publishing each frame instead of calculate_fps(). limits the producer
+ * to target_fps and if scene->vsync is set, waits until render_forever has shifted the
+ * published frame out once. no frames are dropped and the next frame starts on a refresh boundary.
+ * 
+ * @param scene 
+ * @param target_fps 
+ */
+void hub_frame_sync(scene_info *scene, const uint16_t target_fps);
+
 /**
  * @brief render the PWM signal to the GPIO pins forever...
  * 
  * @param scene 
  */
-void render_forever(const scene_info *scene);
+void render_forever(scene_info *scene);
 
 #endif
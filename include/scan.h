@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_SCAN_H
+#define _HUB75_SCAN_H 1
+
+/**
+ * @brief how the address lines select a row
+ */
+enum scan_address_e {
+    /** @brief A-E are the binary row number */
+    SCAN_ADDRESS_BINARY,
+    /** @brief one line per row, A selects row 0, B row 1 ... (up to 5 rows) */
+    SCAN_ADDRESS_DIRECT
+};
+
+/**
+ * @brief panel multiplexing. a panel with scene->scan_rows address rows (1/8 scan: 8) drives
+ * k = (panel_height / 2) / scan_rows rows of each half per address, so each shift is k panel
+ * rows long. the pattern says in what order their pixels are shifted: stripe pixels of one
+ * row, then stripe pixels of the next row (scan_rows further down), and so on.
+ *
+ * with k = 1 (the default scan_rows) every pattern is a straight scan.
+ */
+typedef struct scan_pattern {
+    const char *name;
+    /** @brief pixels of one row shifted before the next row, 0 for the whole panel row */
+    uint8_t stripe;
+    /** @brief rows in reverse order, the lowest row is shifted first */
+    bool reverse;
+    enum scan_address_e address;
+} scan_pattern;
+
+/**
+ * @brief find a built in pattern by name: straight, stripe, zstripe8, zstripe8r, zstripe4, direct
+ *
+ * @param name
+ * @return const scan_pattern* the pattern, NULL if there is none by that name
+ */
+const scan_pattern *scan_pattern_find(const char *name);
+
+/**
+ * @brief the address lines selecting panel row (address) row
+ */
+uint32_t scan_row_address(const scan_pattern *pattern, const uint8_t row);
+
+/**
+ * @brief image pixel index for every pixel of the scan layout, the image the encoders read:
+ * geometry.width pixels per row, geometry.half_height rows per half panel, ports stacked
+ * vertically like the scene image
+ *
+ * @param scene the scene, bcm_geometry_init must have set scene->geometry
+ * @return uint32_t* the table, NULL if the scan layout is the image layout
+ */
+uint32_t *scan_gather_create(const scene_info *scene);
+
+/**
+ * @brief copy the image into scan layout with scene->scan_gather
+ *
+ * @param scene
+ * @param image the scene image (scene->stride bytes per pixel)
+ * @param out scan layout image, the same size
+ */
+void scan_gather_image(const scene_info *scene, const uint8_t *restrict image, uint8_t *restrict out);
+
+#endif
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_SIMD_H
+#define _HUB75_SIMD_H 1
+
+// pixels encoded per group by the SIMD row encoders. scene->width is always a multiple of 16
+#define BCM_SIMD_GROUP 16
+
+// 3 ports * 2 pixels (top, bottom) * 3 bytes (r, g, b)
+#define BCM_MAX_INPUTS 18
+
+/**
+ * @brief where each image byte of a pixel group comes from and which GPIO pin it drives.
+ * built for the current pixel order and port count by bcm_pin_table_init()
+ */
+typedef struct bcm_pin_table {
+    /** @brief byte offset from the port 0 top pixel to this input */
+    uint32_t offset[BCM_MAX_INPUTS];
+    /** @brief GPIO pin the input is shifted to (ADDRESS_Px_xx) */
+    uint8_t  pin[BCM_MAX_INPUTS];
+    /** @brief tone map table for the input: 0 red, 1 green, 2 blue */
+    uint8_t  lut[BCM_MAX_INPUTS];
+    /** @brief number of inputs used, 6 per port */
+    uint8_t  count;
+} bcm_pin_table;
+
+/**
+ * @brief tone mapped words for one pixel group. 64 bit tables are split in lo (planes 0-31)
+ * and hi (planes 32-63) halves. each encode thread has its own, see encode_pool
+ */
+typedef struct bcm_encode_scratch {
+    uint32_t lo[BCM_MAX_INPUTS][BCM_SIMD_GROUP] __attribute__((aligned(32)));
+    uint32_t hi[BCM_MAX_INPUTS][BCM_SIMD_GROUP] __attribute__((aligned(32)));
+} bcm_encode_scratch;
+
+/**
+ * @brief encode one row (scene->width pixels for each port) of the image to all bit planes.
+ * same signature as the scalar encoders so either can be stored in scene->bcm_encoder
+ *
+ * @param scene the scene information
+ * @param table pin table from bcm_pin_table_init()
+ * @param bits the tone mapped rgb to bcm lookup table (uint32_t for <= 32 bits, uint64_t above)
+ * @param bcm_signal plane 0 word of the first pixel in the row
+ * @param image port 0 top pixel of the first pixel in the row
+ * @param scratch the calling thread's scratch space
+ */
+typedef func_bcm_encoder_t bcm_row_encoder_fn;
+
+/**
+ * @brief fill the pin table for the scene pixel order, port count and stride
+ *
+ * @param table the table to fill
+ * @param scene the scene information
+ */
+void bcm_pin_table_init(bcm_pin_table *table, const scene_info *scene);
+
+/**
+ * @brief return the fastest row encoder for this cpu, specialized for the scene bit depth class,
+ * port count and stride. NEON on arm, AVX2 or SSE2 on x86.
+ * output is bit identical to bcm_scalar_encoder()
+ *
+ * @param scene the scene information
+ * @return bcm_row_encoder_fn the row encoder or NULL if there is no SIMD support
+ */
+bcm_row_encoder_fn bcm_simd_encoder(const scene_info *scene);
+
+#endif
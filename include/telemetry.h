@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "rpihub75.h"
+
+#ifndef _HUB75_TELEMETRY_H
+#define _HUB75_TELEMETRY_H 1
+
+// shared memory name of the stats page, see hub_stats_open()
+#ifndef HUB_STATS_NAME
+#define HUB_STATS_NAME "/rpihub75_stats"
+#endif
+
+#define HUB_STATS_MAGIC   0x48554235
+#define HUB_STATS_VERSION 3
+
+// 8 buckets per power of 2, about 12% resolution, up to 2^33 ticks
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS  256
+
+// seconds between refresh rate reports
+#define TELEMETRY_REPORT_S 5
+
+/**
+ * @brief log linear histogram of durations in ticks. written only by the scan out thread,
+ * so updates are a relaxed load and store, never a locked read modify write
+ */
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t min;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[HISTOGRAM_BUCKETS];
+} hub_histogram;
+
+/**
+ * @brief scan out timing, mapped at HUB_STATS_NAME in /dev/shm when scene->telemetry is set.
+ *
+ * readers map it with hub_stats_open(), which checks magic and version (magic is written last).
+ * every counter has a single writer, the scan out thread, and is updated with relaxed stores,
+ * so a reader sees each value whole but a histogram may be a few samples ahead of another.
+ * there is no lock to take: set reset to clear the histograms at the next refresh.
+ * tools/hub_stats.c is a minimal reader
+ */
+typedef struct hub_stats {
+    /** @brief HUB_STATS_MAGIC and HUB_STATS_VERSION, checked by hub_stats_open() */
+    uint32_t magic;
+    uint32_t version;
+    /** @brief hub_cycles() ticks per second */
+    uint64_t tick_hz;
+    uint8_t  bit_depth;
+    uint8_t  half_height;
+
+    /** @brief incremented after every full refresh */
+    atomic_uint_fast32_t seq;
+    /** @brief bit planes per second over the last TELEMETRY_REPORT_S seconds */
+    atomic_uint_fast32_t refresh_hz;
+    /** @brief scene->render_scale at the last report, percent of the scene size shaders render at */
+    atomic_uint_fast32_t render_scale;
+    /** @brief set by a reader to clear all histograms at the next refresh */
+    atomic_bool reset;
+
+    /** @brief one full refresh, every bit plane of every row */
+    hub_histogram frame;
+    /** @brief one row of one bit plane shifted and latched */
+    hub_histogram row;
+    /** @brief all rows of each bit plane */
+    hub_histogram plane[64];
+    /** @brief padding added to each refresh to hold scene->refresh_hz, the headroom left */
+    hub_histogram pad;
+
+    /** @brief next report, in ticks. scan out thread only */
+    uint64_t report_at;
+    uint32_t report_planes;
+} hub_stats;
+
+
+/**
+ * @brief free running counter, read without a syscall. CNTVCT on arm, TSC on x86
+ */
+__attribute__((always_inline))
+static inline uint64_t hub_cycles(void) {
+#if defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#elif defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7
+    uint64_t ticks;
+    asm volatile("mrrc p15, 1, %Q0, %R0, c14" : "=r"(ticks));
+    return ticks;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief hub_cycles() ticks per second. read from the counter on arm, measured once everywhere else
+ */
+uint64_t hub_tick_hz(void);
+
+/**
+ * @brief histogram bucket for a duration: exact below 8 ticks, then 8 buckets per power of 2
+ */
+__attribute__((always_inline, const))
+static inline uint32_t histogram_bucket(const uint64_t ticks) {
+    if (ticks < (1U << HISTOGRAM_SUB_BITS)) {
+        return (uint32_t)ticks;
+    }
+    const uint32_t octave = 63 - __builtin_clzll(ticks);
+    const uint32_t sub    = (ticks >> (octave - HISTOGRAM_SUB_BITS)) & ((1U << HISTOGRAM_SUB_BITS) - 1);
+    const uint32_t bucket = ((octave - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub;
+    return (bucket < HISTOGRAM_BUCKETS) ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief add a duration to the histogram. single writer only
+ */
+__attribute__((hot, always_inline))
+static inline void histogram_add(hub_histogram *h, const uint64_t ticks) {
+    atomic_uint_fast64_t *bucket = &h->buckets[histogram_bucket(ticks)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&h->count, atomic_load_explicit(&h->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (UNLIKELY(ticks < atomic_load_explicit(&h->min, memory_order_relaxed))) {
+        atomic_store_explicit(&h->min, ticks, memory_order_relaxed);
+    }
+    if (UNLIKELY(ticks > atomic_load_explicit(&h->max, memory_order_relaxed))) {
+        atomic_store_explicit(&h->max, ticks, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief add the time since *start to the histogram and move *start to now
+ */
+__attribute__((hot, always_inline))
+static inline void telemetry_mark(hub_histogram *h, uint64_t *start) {
+    const uint64_t now = hub_cycles();
+    histogram_add(h, now - *start);
+    *start = now;
+}
+
+/**
+ * @brief create the stats for render_forever. shared at HUB_STATS_NAME if scene->telemetry,
+ * process local if only scene->show_fps is set (falls back to this if shared memory fails)
+ *
+ * @param scene the scene information
+ * @return hub_stats* the stats, or NULL if neither telemetry nor show_fps is set
+ */
+hub_stats *telemetry_create(const scene_info *scene);
+
+/**
+ * @brief release the stats from telemetry_create(). the shared page is unmapped and its name
+ * unlinked, readers that still have it mapped keep their copy
+ *
+ * @param stats from telemetry_create(), may be NULL
+ */
+void telemetry_destroy(hub_stats *stats);
+
+/**
+ * @brief end of a full refresh: record the frame time since *frame_start, honor reset
+ * requests and every TELEMETRY_REPORT_S seconds update refresh_hz and print it if show_fps
+ *
+ * @param scene the scene information
+ * @param stats from telemetry_create()
+ * @param frame_start start of this refresh, moved to now
+ * @param planes bit planes shown in this refresh
+ */
+void telemetry_frame(const scene_info *scene, hub_stats *stats, uint64_t *frame_start, const uint32_t planes);
+
+/**
+ * @brief map the stats page of a running render_forever (in this or another process).
+ * mapped read only if the caller may not write it
+ *
+ * @param name shared memory name, HUB_STATS_NAME by default
+ * @return hub_stats* the stats, or NULL if not found or the wrong version
+ */
+hub_stats *hub_stats_open(const char *name);
+
+/**
+ * @brief approximate percentile of a histogram
+ *
+ * @param h
+ * @param percentile 0 - 100
+ * @return uint64_t the duration in ticks, the middle of the bucket holding the percentile
+ */
+uint64_t histogram_percentile(const hub_histogram *h, const double percentile);
+
+/**
+ * @brief print min / p50 / p99 / max in microseconds for the frame, row and every plane histogram
+ *
+ * @param out
+ * @param stats
+ */
+void hub_stats_print(FILE *out, const hub_stats *stats);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rpihub75.h"
+#include "telemetry.h"
+
+#ifndef _HUB75_TRACE_H
+#define _HUB75_TRACE_H 1
+
+#define HUB_TRACE_MAGIC   0x54425548
+#define HUB_TRACE_VERSION 1
+
+// records kept in memory. with a file the ring is written out every time it fills
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS (1 << 20)
+#endif
+
+// refreshes recorded by -W file without a count, a trace file grows by 16 bytes a store
+#ifndef TRACE_REFRESHES
+#define TRACE_REFRESHES 10
+#endif
+
+/**
+ * @brief the GPIO register a store went to. OUT replaces every pin, SET and CLR only
+ * touch the pins in the written mask (Pi5 RIO, or GPSET0 / GPCLR0 on Pi3/4)
+ */
+enum gpio_reg_e {
+    GPIO_REG_OUT,
+    GPIO_REG_SET,
+    GPIO_REG_CLR
+};
+
+/**
+ * @brief one register store, ticks is hub_cycles() at the store
+ */
+typedef struct {
+    uint64_t ticks;
+    uint32_t value;
+    uint32_t reg;
+} gpio_trace_record;
+
+/**
+ * @brief register stores recorded by render_forever in place of the GPIO registers when
+ * scene->gpio_trace is set. a ring of capacity records: without a file the oldest records
+ * are overwritten, with a file every full ring is appended to it.
+ * replay it with a hub_decode, see decode.h
+ */
+typedef struct hub_trace {
+    gpio_trace_record *records;
+    uint32_t capacity;
+    /** @brief next record to write */
+    uint32_t head;
+    /** @brief stores recorded since the trace was created, including any written out or overwritten */
+    uint64_t count;
+    /** @brief hub_cycles() ticks per second of the record timestamps */
+    uint64_t tick_hz;
+    FILE    *file;
+
+    /** @brief render_forever returns after this many refreshes, 0 to run until do_render is cleared */
+    uint32_t max_refreshes;
+    uint32_t refreshes;
+} hub_trace;
+
+
+/**
+ * @brief write out (or wrap) a full ring. called by trace_store
+ */
+void hub_trace_wrap(hub_trace *trace);
+
+/**
+ * @brief record a register store
+ */
+__attribute__((hot, always_inline))
+static inline void trace_store(hub_trace *trace, const enum gpio_reg_e reg, const uint32_t value) {
+    gpio_trace_record *record = &trace->records[trace->head];
+    record->ticks = hub_cycles();
+    record->value = value;
+    record->reg   = reg;
+    trace->count++;
+    if (UNLIKELY(++trace->head == trace->capacity)) {
+        hub_trace_wrap(trace);
+    }
+}
+
+/**
+ * @brief store to a GPIO register, or record the store if trace is not NULL. the scan out loops
+ * are inlined with a NULL trace for the hardware, so there this is just the store
+ */
+__attribute__((hot, always_inline))
+static inline void gpio_store(hub_trace *trace, const enum gpio_reg_e reg, volatile uint32_t *ptr, const uint32_t value) {
+    if (trace != NULL) {
+        trace_store(trace, reg, value);
+    } else {
+        *ptr = value;
+    }
+}
+
+/**
+ * @brief create a trace
+ *
+ * @param capacity records kept in memory
+ * @param filename file to write the records to, NULL to keep only the last capacity records
+ * @return hub_trace* the trace, die() on failure
+ */
+hub_trace *hub_trace_create(const uint32_t capacity, const char *filename);
+
+/**
+ * @brief count a full refresh
+ *
+ * @param trace
+ * @return true if max_refreshes is reached and the scan out should stop
+ */
+bool hub_trace_refresh(hub_trace *trace);
+
+/**
+ * @brief write the records not yet written to the file. no-op without a file
+ */
+void hub_trace_flush(hub_trace *trace);
+
+/**
+ * @brief read a trace file written by render_forever
+ *
+ * @param filename
+ * @return hub_trace* every record of the file in order, NULL if it can not be read
+ */
+hub_trace *hub_trace_load(const char *filename);
+
+/**
+ * @brief flush, close the file and free the trace
+ */
+void hub_trace_free(hub_trace *trace);
+
+#endif
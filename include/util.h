@@ -48,10 +48,10 @@ void debug(const char *format, ...);
 
 
 /**
- * @brief  calculate a jitter mask for the OE pin that should randomly toggle the OE pin on/off acording to brightness
- * TODO: look for rows of > 3 bits that are all the same and spread these bits out. this will reduce flicker on the display
+ * @brief  calculate an OE mask that turns the display on for brightness / 255 of the clocks.
+ * the same low discrepancy sequence the PWM scan out steps through, see OE_SEQUENCE_STEP
  * 
- * @param jitter_size  prime number > 1024 < 4096
+ * @param jitter_size  number of clocks
  * @param brightness   larger values produce brighter output, max 255
  * @return uint32_t*   a pointer to the jitter mask. caller must release memory
  */
@@ -0,0 +1,5 @@
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+	vec3 col = texture(iChannel0, fragCoord / iResolution.xy).rgb;
+	// warm the fading tails
+	fragColor = vec4(pow(col, vec3(0.8, 0.9, 1.1)), 1.0);
+}
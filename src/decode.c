@@ -0,0 +1,229 @@
+/**
+ * HUB75 protocol decoder.
+ *
+ * replays a GPIO trace (trace.h) through a model of the panel: the color pins are shifted in on
+ * the rising edge of CLK, the shift register is copied to the output latch on the rising edge of
+ * LATCH, and the latched row is lit at the selected row address while OE is low. the result is
+ * the bit planes the scan out latched, the fraction of time every LED was lit, and clock / row /
+ * duty cycle numbers, all without a panel or a Pi.
+ *
+ * timing comes from the trace timestamps, which include the cost of recording each store. use it
+ * to compare scan out changes on the same machine, not as the real GPIO speed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "decode.h"
+
+
+// color pins of each port: top half R G B, then bottom half R G B
+static const uint8_t port_pins[3][6] = {
+    {ADDRESS_P0_R1, ADDRESS_P0_G1, ADDRESS_P0_B1, ADDRESS_P0_R2, ADDRESS_P0_G2, ADDRESS_P0_B2},
+    {ADDRESS_P1_R1, ADDRESS_P1_G1, ADDRESS_P1_B1, ADDRESS_P1_R2, ADDRESS_P1_G2, ADDRESS_P1_B2},
+    {ADDRESS_P2_R1, ADDRESS_P2_G1, ADDRESS_P2_B1, ADDRESS_P2_R2, ADDRESS_P2_G2, ADDRESS_P2_B2}
+};
+
+/**
+ * @brief the panel row selected by the address lines, see bcm_geometry.address. 0 if none is
+ */
+static inline uint16_t selected_row(const hub_decode *decode, const uint32_t pins) {
+    const uint32_t address = pins & (ADDRESS_MASK);
+    for (uint16_t y=0; y < decode->half_height; y++) {
+        if (decode->row_address[y] == address) {
+            return y;
+        }
+    }
+    return 0;
+}
+
+hub_decode *hub_decode_create(const scene_info *scene) {
+    hub_decode *decode = (hub_decode*)calloc(1, sizeof(hub_decode));
+    if (decode == NULL) {
+        die("unable to allocate HUB75 decoder\n");
+    }
+    decode->width       = scene->geometry.width;
+    decode->half_height = MIN(scene->geometry.half_height, 32);
+    decode->bit_depth   = scene->bit_depth;
+    decode->num_ports   = MIN(scene->num_ports, 3);
+    // the address while row y is shifted selects the row before it
+    for (uint16_t y=0; y < decode->half_height; y++) {
+        decode->row_address[y] = scene->geometry.address[(y + 1) % decode->half_height];
+    }
+    for (uint8_t port=0; port < decode->num_ports; port++) {
+        for (uint8_t pin=0; pin < 6; pin++) {
+            decode->color_pins |= 1U << port_pins[port][pin];
+        }
+    }
+
+    decode->shift      = (uint32_t*)calloc(decode->width, sizeof(uint32_t));
+    decode->latched    = (uint32_t*)calloc(decode->width, sizeof(uint32_t));
+    decode->lit_rows   = (uint64_t*)calloc(decode->half_height, sizeof(uint64_t));
+    decode->row_planes = (uint32_t*)calloc(decode->half_height, sizeof(uint32_t));
+    decode->planes     = (uint32_t*)calloc((size_t)decode->bit_depth * decode->half_height * decode->width, sizeof(uint32_t));
+    decode->intensity  = (double*)calloc((size_t)decode->num_ports * decode->half_height * 2 * decode->width * 3, sizeof(double));
+    if (!decode->shift || !decode->latched || !decode->lit_rows || !decode->row_planes || !decode->planes || !decode->intensity) {
+        die("unable to allocate HUB75 decoder for %dx%d\n", decode->width, decode->half_height * 2);
+    }
+    if (scene->scan_gather != NULL) {
+        const size_t pixels = (size_t)decode->num_ports * decode->half_height * 2 * decode->width;
+        decode->gather = (uint32_t*)malloc(pixels * sizeof(uint32_t));
+        if (decode->gather == NULL) {
+            die("unable to allocate HUB75 decoder scan table\n");
+        }
+        memcpy(decode->gather, scene->scan_gather, pixels * sizeof(uint32_t));
+    }
+    return decode;
+}
+
+/**
+ * @brief the latched row is about to be replaced: add the time it was lit to every LED it turned on.
+ * if another row is being latched, store it as the next plane of the row that is selected now.
+ * at the end of the trace the next row was never shifted, so the selected row means nothing
+ */
+static void close_row(hub_decode *decode, const bool relatched) {
+    if (!decode->latch_valid) {
+        return;
+    }
+    const uint16_t width = MIN(decode->latched_width, decode->width);
+    if (relatched) {
+        const uint16_t row   = selected_row(decode, decode->pins);
+        const uint32_t plane = decode->row_planes[row]++ % decode->bit_depth;
+        memcpy(decode->planes + (((size_t)plane * decode->half_height) + row) * decode->width, decode->latched, width * sizeof(uint32_t));
+    }
+
+    for (uint16_t y=0; y < decode->half_height; y++) {
+        const uint64_t lit = decode->lit_rows[y];
+        if (lit == 0) {
+            continue;
+        }
+        decode->lit_rows[y] = 0;
+        for (uint8_t port=0; port < decode->num_ports; port++) {
+            for (uint8_t half=0; half < 2; half++) {
+                // scan layout pixel of x, the same as the image pixel for a straight scan
+                const size_t first = ((((size_t)port * 2) + half) * decode->half_height + y) * decode->width;
+                for (uint16_t x=0; x < width; x++) {
+                    const size_t pixel = (decode->gather != NULL) ? decode->gather[first + x] : first + x;
+                    for (uint8_t c=0; c < 3; c++) {
+                        if (decode->latched[x] & (1U << port_pins[port][(half * 3) + c])) {
+                            decode->intensity[(pixel * 3) + c] += lit;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void hub_decode_store(hub_decode *decode, const gpio_trace_record *record) {
+    if (decode->stores == 0) {
+        decode->first_ticks = record->ticks;
+        decode->ticks       = record->ticks;
+    }
+
+    // the time since the last store was spent in the last pin state. OE is active low
+    const uint64_t elapsed = record->ticks - decode->ticks;
+    if (decode->latch_valid && !(decode->pins & PIN_OE)) {
+        decode->lit_rows[selected_row(decode, decode->pins)] += elapsed;
+        decode->lit_ticks += elapsed;
+    }
+    decode->ticks = record->ticks;
+    decode->stores++;
+
+    uint32_t pins = decode->pins;
+    switch (record->reg) {
+    case GPIO_REG_OUT:
+        pins = record->value;
+        break;
+    case GPIO_REG_SET:
+        pins |= record->value;
+        break;
+    case GPIO_REG_CLR:
+        pins &= ~record->value;
+        break;
+    }
+    const uint32_t rising = pins & ~decode->pins;
+
+    if (rising & PIN_CLK) {
+        if (decode->shifted < decode->width) {
+            decode->shift[decode->shifted] = pins & decode->color_pins;
+        }
+        decode->shifted++;
+        decode->clocks++;
+    }
+    if (rising & PIN_LATCH) {
+        // the row address of the old latch is the one selected up to this store
+        close_row(decode, true);
+        uint32_t *latched       = decode->latched;
+        decode->latched         = decode->shift;
+        decode->shift           = latched;
+        decode->latched_width   = decode->shifted;
+        decode->latch_valid     = true;
+        decode->bad_rows       += (decode->shifted != decode->width);
+        decode->shifted         = 0;
+        decode->latches++;
+    }
+    decode->pins = pins;
+}
+
+void hub_decode_trace(hub_decode *decode, const hub_trace *trace) {
+    // a ring without a file that filled up holds the newest capacity records, oldest at head
+    const uint64_t held  = MIN(trace->count, trace->capacity);
+    const uint32_t first = (trace->file == NULL && trace->count > trace->capacity) ? trace->head : 0;
+    for (uint64_t i=0; i < held; i++) {
+        hub_decode_store(decode, &trace->records[(first + i) % trace->capacity]);
+    }
+}
+
+void hub_decode_finish(hub_decode *decode) {
+    if (decode->finished) {
+        return;
+    }
+    close_row(decode, false);
+    decode->latch_valid = false;
+    decode->finished    = true;
+
+    const uint64_t traced = decode->ticks - decode->first_ticks;
+    if (traced == 0) {
+        return;
+    }
+    const size_t values = (size_t)decode->num_ports * decode->half_height * 2 * decode->width * 3;
+    for (size_t i=0; i < values; i++) {
+        decode->intensity[i] /= traced;
+    }
+}
+
+void hub_decode_print(FILE *out, const hub_decode *decode, const uint64_t tick_hz) {
+    const double   ns     = 1000000000.0 / tick_hz;
+    const uint64_t traced = decode->ticks - decode->first_ticks;
+    const uint64_t planes = (uint64_t)decode->half_height * decode->bit_depth;
+
+    fprintf(out, "stores: %lu, clocks: %lu, latches: %lu, rows not %d clocks wide: %lu\n",
+        (unsigned long)decode->stores, (unsigned long)decode->clocks, (unsigned long)decode->latches,
+        decode->width, (unsigned long)decode->bad_rows);
+    if (decode->clocks == 0 || decode->latches == 0 || traced == 0) {
+        return;
+    }
+    fprintf(out, "stores per clock: %.2f, per clock: %.1fns, per row: %.1fns, refresh: %.1fHz, lit: %.1f%%\n",
+        (double)decode->stores / decode->clocks, (traced * ns) / decode->clocks, (traced * ns) / decode->latches,
+        ((double)decode->latches / planes) / (traced * ns / 1000000000.0), (100.0 * decode->lit_ticks) / traced);
+}
+
+void hub_decode_free(hub_decode *decode) {
+    if (decode == NULL) {
+        return;
+    }
+    free(decode->shift);
+    free(decode->latched);
+    free(decode->lit_rows);
+    free(decode->row_planes);
+    free(decode->planes);
+    free(decode->intensity);
+    free(decode->gather);
+    free(decode);
+}
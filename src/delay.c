@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+/**
+ * calibrated GPIO settle delays.
+ *
+ * the scan out loops wait between GPIO stores with spin(). the cost of one iteration depends on
+ * the cpu and its current clock, so the GPIO_*_NS delays are converted to iteration counts by
+ * timing spin() against CLOCK_MONOTONIC_RAW once on the scan out cpu. a watcher thread off that cpu
+ * reads cpufreq and, when it reports a new frequency (governor change or thermal throttling),
+ * rescales the counts and publishes them in one atomic word. the scan out loops never make a
+ * syscall or spin for a calibration with a row lit.
+ *
+ * with a fixed scene->refresh_hz the refresh_pacer pads every refresh to a deadline in hub_cycles()
+ * ticks, so the panel refresh does not float with the chain length, bit depth or cpu clock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "delay.h"
+#include "telemetry.h"
+#include "realtime.h"
+
+
+/**
+ * @brief the cpufreq watcher thread, see gpio_delays_watch()
+ */
+struct delay_watcher {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool            stop;
+    gpio_delays    *delays;
+};
+
+
+uint32_t cpufreq_khz(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    unsigned long khz = 0;
+    if (fscanf(file, "%lu", &khz) != 1) {
+        khz = 0;
+    }
+    fclose(file);
+    return (uint32_t)khz;
+}
+
+static inline uint64_t ns_now(const clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief spin count for ns, never 0 so every delay is at least one iteration
+ */
+static inline uint32_t spins_for(const uint32_t ns, const uint32_t ps_per_spin) {
+    const uint64_t spins = (((uint64_t)ns * 1000) + ps_per_spin - 1) / ps_per_spin;
+    return (spins > 0) ? (uint32_t)spins : 1;
+}
+
+/**
+ * @brief pack settle, clock, latch and oe for ps_per_spin into one word, 16 bits each
+ */
+static uint64_t pack_spins(const uint32_t ps_per_spin) {
+    return ((uint64_t)MIN(spins_for(GPIO_SETTLE_NS, ps_per_spin), UINT16_MAX)) |
+        ((uint64_t)MIN(spins_for(GPIO_CLOCK_NS, ps_per_spin), UINT16_MAX) << 16) |
+        ((uint64_t)MIN(spins_for(GPIO_LATCH_NS, ps_per_spin), UINT16_MAX) << 32) |
+        ((uint64_t)MIN(spins_for(GPIO_OE_NS, ps_per_spin), UINT16_MAX) << 48);
+}
+
+static void unpack_spins(gpio_delays *delays, const uint64_t spins) {
+    delays->current = spins;
+    delays->settle  = spins & 0xFFFF;
+    delays->clock   = (spins >> 16) & 0xFFFF;
+    delays->latch   = (spins >> 32) & 0xFFFF;
+    delays->oe      = (spins >> 48) & 0xFFFF;
+}
+
+__attribute__((cold))
+static void calibrate(gpio_delays *delays) {
+    uint64_t samples[CALIBRATE_SAMPLES];
+    for (int i=0; i < CALIBRATE_SAMPLES; i++) {
+        const uint64_t start = ns_now(CLOCK_MONOTONIC_RAW);
+        spin(CALIBRATE_SPINS);
+        samples[i] = ns_now(CLOCK_MONOTONIC_RAW) - start;
+    }
+    // insertion sort, 7 samples
+    for (int i=1; i < CALIBRATE_SAMPLES; i++) {
+        const uint64_t sample = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j] > sample) {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = sample;
+    }
+    const uint64_t median_ns = samples[CALIBRATE_SAMPLES / 2];
+
+    delays->ps_per_spin = (uint32_t)((median_ns * 1000) / CALIBRATE_SPINS);
+    if (delays->ps_per_spin == 0) {
+        delays->ps_per_spin = 1;
+    }
+    const uint64_t spins = pack_spins(delays->ps_per_spin);
+    atomic_store_explicit(&delays->published, spins, memory_order_relaxed);
+    unpack_spins(delays, spins);
+    debug("spin %dps at %dkHz: settle %d, clock %d, latch %d, oe %d\n", delays->ps_per_spin, delays->cpu_khz,
+        delays->settle, delays->clock, delays->latch, delays->oe);
+}
+
+__attribute__((cold))
+void gpio_delays_init(gpio_delays *delays, const char *cpufreq_file) {
+    memset(delays, 0, sizeof(gpio_delays));
+    if (cpufreq_file != NULL) {
+        snprintf(delays->cpufreq_file, sizeof(delays->cpufreq_file), "%s", cpufreq_file);
+    } else {
+        snprintf(delays->cpufreq_file, sizeof(delays->cpufreq_file),
+            "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", sched_getcpu());
+    }
+    delays->cpu_khz = cpufreq_khz(delays->cpufreq_file);
+    calibrate(delays);
+}
+
+/**
+ * @brief poll the cpufreq file until stopped. a spin costs a fixed number of cycles, so its time
+ * scales with the clock period: rescale the calibration instead of spinning on another cpu
+ */
+__attribute__((cold))
+static void *watch_cpufreq(void *arg) {
+    struct delay_watcher *watcher = (struct delay_watcher*)arg;
+    gpio_delays *delays           = watcher->delays;
+    uint32_t khz = delays->cpu_khz;
+
+    pthread_mutex_lock(&watcher->lock);
+    while (!watcher->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec  += CPUFREQ_CHECK_MS / 1000;
+        deadline.tv_nsec += (CPUFREQ_CHECK_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            deadline.tv_sec++;
+        }
+        pthread_cond_timedwait(&watcher->wake, &watcher->lock, &deadline);
+        if (watcher->stop) {
+            break;
+        }
+
+        const uint32_t now_khz = cpufreq_khz(delays->cpufreq_file);
+        if (now_khz == 0 || now_khz == khz || delays->cpu_khz == 0) {
+            continue;
+        }
+        khz = now_khz;
+        const uint32_t ps_per_spin = (uint32_t)MAX(((uint64_t)delays->ps_per_spin * delays->cpu_khz) / khz, 1);
+        atomic_store_explicit(&delays->published, pack_spins(ps_per_spin), memory_order_relaxed);
+        debug("cpu at %dkHz, spin %dps\n", khz, ps_per_spin);
+    }
+    pthread_mutex_unlock(&watcher->lock);
+    return NULL;
+}
+
+__attribute__((cold))
+void gpio_delays_watch(const scene_info *scene, gpio_delays *delays) {
+    struct delay_watcher *watcher = (struct delay_watcher*)calloc(1, sizeof(struct delay_watcher));
+    if (watcher == NULL) {
+        die("unable to allocate the cpufreq watcher\n");
+    }
+    watcher->delays = delays;
+    pthread_mutex_init(&watcher->lock, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watcher->wake, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    // the scan out thread may already be SCHED_FIFO, the watcher must not inherit that
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    struct sched_param param = { .sched_priority = 0 };
+    pthread_attr_setschedparam(&attr, &param);
+    const int err = pthread_create(&watcher->thread, &attr, watch_cpufreq, watcher);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "unable to start the cpufreq watcher (%s), GPIO delays stay at %dkHz\n", strerror(err), delays->cpu_khz);
+        free(watcher);
+        return;
+    }
+    realtime_place_thread(scene, watcher->thread, THREAD_SOURCE);
+    delays->watcher = watcher;
+}
+
+__attribute__((cold))
+void gpio_delays_unwatch(gpio_delays *delays) {
+    struct delay_watcher *watcher = delays->watcher;
+    if (watcher == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&watcher->lock);
+    watcher->stop = true;
+    pthread_cond_signal(&watcher->wake);
+    pthread_mutex_unlock(&watcher->lock);
+    pthread_join(watcher->thread, NULL);
+    pthread_cond_destroy(&watcher->wake);
+    pthread_mutex_destroy(&watcher->lock);
+    free(watcher);
+    delays->watcher = NULL;
+}
+
+bool gpio_delays_update(gpio_delays *delays) {
+    const uint64_t spins = atomic_load_explicit(&delays->published, memory_order_relaxed);
+    if (LIKELY(spins == delays->current)) {
+        return false;
+    }
+    unpack_spins(delays, spins);
+    return true;
+}
+
+void refresh_pacer_init(refresh_pacer *pacer, const uint16_t refresh_hz) {
+    pacer->period   = (refresh_hz > 0) ? hub_tick_hz() / refresh_hz : 0;
+    pacer->deadline = 0;
+    pacer->warmup   = REFRESH_WARMUP;
+    pacer->busy_max = 0;
+    atomic_store_explicit(&pacer->headroom_min, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&pacer->missed, 0, memory_order_relaxed);
+}
+
+__attribute__((cold))
+void refresh_pacer_warmup(refresh_pacer *pacer, const uint64_t now) {
+    // the first refresh includes the scan out setup, only time the ones after it
+    if (pacer->deadline != 0) {
+        pacer->busy_max = MAX(pacer->busy_max, now - pacer->deadline);
+    }
+    pacer->deadline = now;
+    if (--pacer->warmup > 0) {
+        return;
+    }
+
+    const uint64_t tick_hz = hub_tick_hz();
+    if (pacer->busy_max * 100 > pacer->period * (100 - REFRESH_MIN_HEADROOM)) {
+        die("refresh rate %luHz is not possible, a refresh takes up to %.1fus of the %.1fus period "
+            "(%d%% headroom required), at most %luHz\n",
+            (unsigned long)(tick_hz / pacer->period), (pacer->busy_max * 1000000.0) / tick_hz,
+            (pacer->period * 1000000.0) / tick_hz, REFRESH_MIN_HEADROOM,
+            (unsigned long)((tick_hz * (100 - REFRESH_MIN_HEADROOM)) / (pacer->busy_max * 100)));
+    }
+    pacer->deadline = now + pacer->period;
+}
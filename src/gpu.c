@@ -1,12 +1,18 @@
 #define _GNU_SOURCE
 #include <stdio.h>
-#include <GLES3/gl3.h>
+#include <GLES3/gl31.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <sys/param.h>
+#if __has_include(<gbm.h>)
 #include <gbm.h>
+#define HAVE_GBM 1
+#endif
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 
@@ -14,6 +20,11 @@
 
 #include "rpihub75.h"
 #include "util.h"
+#include "telemetry.h"
+#include "gpu.h"
+#include "pixels.h"
+#include "simd.h"
+#include "realtime.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -44,6 +55,8 @@ const char *shadertoy_header =
     "uniform float iChannelTime[4];\n"
     "uniform sampler2D iChannel0;\n"
     "uniform sampler2D iChannel1;\n"
+    "uniform sampler2D iChannel2;\n"
+    "uniform sampler2D iChannel3;\n"
     "uniform float iTime;\n"
     "uniform float iTimeDelta;\n"
 
@@ -67,15 +80,73 @@ const char *vertex_shader_source =
     "}\n";
 
 
-// Load texture from a PNG file using stb_image
-GLuint load_texture(const char* filePath) {
+/**
+ * @brief draws the image pass, rendered at scene->render_scale, at the scene size. bilinear:
+ * interpolates below 100%, averages 2x2 pixels at 200%
+ */
+const char *resample_shader_source =
+    "#version 310 es\n"
+    "precision highp float;\n"
+    "uniform sampler2D image;\n"
+    "uniform vec2 region;\n"
+    "uniform vec2 size;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "    color = texture(image, (gl_FragCoord.xy / size) * region);\n"
+    "}\n";
+
+
+/**
+ * @brief the bit plane encoder, the encode_row_scalar() loop on the GPU. one invocation per pixel
+ * column of a row: the tone mapped word of every input from the lut texture (lo, hi words of the
+ * uint64_t table), then bit j of each is shifted to its pin for plane j.
+ * image rows are the rows glReadPixels would return, so the output matches the CPU encoders bit for bit
+ */
+// local_size_x is BCM_SIMD_GROUP (scene->width is always a multiple of it), 18 is BCM_MAX_INPUTS
+const char *encode_shader_source =
+    "#version 310 es\n"
+    "precision highp float;\n"
+    "precision highp int;\n"
+    "layout(local_size_x = 16) in;\n"
+    "uniform highp sampler2D image;\n"
+    "uniform highp usampler2D lut;\n"
+    "uniform uint pins[18];\n"
+    "uniform uint inputs;\n"
+    "uniform uint half_height;\n"
+    "uniform uint bit_depth;\n"
+    "uniform uint row_words;\n"
+    "uniform uint plane_words;\n"
+    "layout(std430, binding = 0) writeonly buffer planes { uint words[]; };\n"
+    "void main() {\n"
+    "    uint x = gl_GlobalInvocationID.x;\n"
+    "    uint y = gl_GlobalInvocationID.y;\n"
+    "    uvec2 bits[18];\n"
+    "    for (uint k = 0u; k < inputs; k++) {\n"
+    // inputs are [port][top/bottom][byte], each half panel half_height rows below the last
+    "        vec4 texel = texelFetch(image, ivec2(x, ((k / 3u) * half_height) + y), 0);\n"
+    "        uint value = uint(texel[k % 3u] * 255.0 + 0.5);\n"
+    "        bits[k] = texelFetch(lut, ivec2(value, k % 3u), 0).xy;\n"
+    "    }\n"
+    "    for (uint j = 0u; j < bit_depth; j++) {\n"
+    "        uint plane = 0u;\n"
+    "        for (uint k = 0u; k < inputs; k++) {\n"
+    "            uint bit = (j < 32u) ? (bits[k].x >> j) : (bits[k].y >> (j - 32u));\n"
+    "            plane |= (bit & 1u) << pins[k];\n"
+    "        }\n"
+    "        words[(j * plane_words) + (y * row_words) + x] = plane;\n"
+    "    }\n"
+    "}\n";
+
+
+// Load texture from a PNG file using stb_image. width and height are set to its size
+GLuint load_texture(const char* filePath, int *width, int *height) {
     GLuint textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_2D, textureID);
 
     // Load the texture data from a PNG file using stb_image
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(filePath, &width, &height, &nrChannels, 0);
+    int nrChannels;
+    unsigned char *data = stbi_load(filePath, width, height, &nrChannels, 0);
     if (data) {
         // Determine the format based on the number of channels in the PNG file
         GLenum format;
@@ -92,7 +163,7 @@ GLuint load_texture(const char* filePath) {
         }
 
         // Upload texture to GPU with mipmaps
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, *width, *height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);  // Generate mipmaps for texture
 
         // Set texture parameters for wrapping and filtering
@@ -138,20 +209,25 @@ static GLuint compile_shader(const char *source, const GLenum shader_type) {
  * @brief Create a complete OpenGL program for a shadertoy shader
  * 
  * @param file name of the shadertoy file to load
+ * @param common source every pass of a multi pass shader starts with, or NULL
  * @return GLuint OpenGL id of the new program
  */
-static GLuint create_shadertoy_program(char *file) {
+static GLuint create_shadertoy_program(const char *file, const char *common) {
     long filesize;
     char *src = file_get_contents(file, &filesize);
     if (filesize == 0) {
         die( "Failed to read shader source\n");
     }
 
-    char *src_with_header = (char *)malloc(filesize + 8192);
-    if (src_with_header == NULL) {
-        die("unable to allocate %d bytes memory for shader program\n", filesize + 8192);
+    const size_t common_size = (common == NULL) ? 0 : strlen(common);
+    const size_t size = filesize + common_size + 8192;
+    char *src_with_header = (char *)malloc(size);
+    char *combined = (char *)malloc(filesize + common_size + 2);
+    if (src_with_header == NULL || combined == NULL) {
+        die("unable to allocate %d bytes memory for shader program\n", size);
     }
-    snprintf(src_with_header, filesize + 8192, shadertoy_header, src);
+    snprintf(combined, filesize + common_size + 2, "%s%s%s", (common == NULL) ? "" : common, (common == NULL) ? "" : "\n", src);
+    snprintf(src_with_header, size, shadertoy_header, combined);
 
     GLuint vertex_shader = compile_shader(vertex_shader_source, GL_VERTEX_SHADER);
     GLuint fragment_shader = compile_shader(src_with_header, GL_FRAGMENT_SHADER);
@@ -159,6 +235,8 @@ static GLuint create_shadertoy_program(char *file) {
     GLuint program = glCreateProgram();
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
+    // every pass draws the same quad, keep position in the same attribute for all of them
+    glBindAttribLocation(program, 0, "position");
     glLinkProgram(program);
 
     GLint success;
@@ -172,7 +250,9 @@ static GLuint create_shadertoy_program(char *file) {
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
 
+    free(combined);
     free(src_with_header);
+    free(src);
     return program;
 }
 
@@ -219,67 +299,1164 @@ char *change_file_extension(const char *filename, const char *new_extension) {
 }
 
 
+// shadertoy buffer passes, A-D
+#define SHADER_BUFFERS 4
+// iChannel0-3
+#define SHADER_CHANNELS 4
+
 /**
- * @brief render the shadertoy compatible shader source code in the 
- * file pointed to at scene->shader_file
- * 
- * exits if shader is unable to be rendered
- * 
- * loop exits and memory is freed if/when scene->do_render becomes false
- * 
- * frame delay is adaptive and updates to current scene->fps on each frame update
- * 
- * 
- * @param arg pointer to the current scene_info object
+ * @brief what one iChannel of a pass samples: an image texture, the newest frame of a buffer, or nothing
  */
-void *render_shader(void *arg) {
-    scene_info *scene = (scene_info*)arg;
-    debug("render shader %s\n", scene->shader_file);
+typedef struct {
+    /** @brief image texture loaded with load_texture(), 0 for a buffer or nothing */
+    GLuint  texture;
+    /** @brief buffer pass 0-3 (A-D), -1 for an image or nothing */
+    int8_t  buffer;
+    int     width;
+    int     height;
+} shader_channel;
+
+/**
+ * @brief one pass of a shadertoy shader. buffer passes draw into one of 2 textures and
+ * read the other, so a pass sampling itself (or a later pass) gets the previous frame
+ */
+typedef struct {
+    GLuint   program;
+    GLint    time;
+    GLint    time_delta;
+    GLint    frame;
+    GLint    resolution;
+    GLint    channel_resolution;
+    GLint    channels[SHADER_CHANNELS];
+    uint16_t width;
+    uint16_t height;
+    /** @brief ping pong render targets of a buffer pass, texture[current] holds its newest frame */
+    GLuint   fbo[2];
+    GLuint   texture[2];
+    uint8_t  current;
+    shader_channel channel[SHADER_CHANNELS];
+} shader_pass;
+
+/**
+ * @brief the buffer passes (program 0 if not used) rendered in order A-D, then the image pass
+ */
+typedef struct {
+    shader_pass buffer[SHADER_BUFFERS];
+    shader_pass image;
+} shader_passes;
+
+/**
+ * @brief compile a pass and look up its uniforms
+ */
+static void shader_pass_compile(shader_pass *pass, const char *file, const char *common) {
+    pass->program            = create_shadertoy_program(file, common);
+    pass->time               = glGetUniformLocation(pass->program, "iTime");
+    pass->time_delta         = glGetUniformLocation(pass->program, "iTimeDelta");
+    pass->frame              = glGetUniformLocation(pass->program, "iFrame");
+    pass->resolution         = glGetUniformLocation(pass->program, "iResolution");
+    pass->channel_resolution = glGetUniformLocation(pass->program, "iChannelResolution");
+    for (int i=0; i<SHADER_CHANNELS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "iChannel%d", i);
+        pass->channels[i] = glGetUniformLocation(pass->program, name);
+    }
+}
+
+/**
+ * @brief a cleared render target texture for a buffer pass
+ *
+ * @return false if the format is not color renderable
+ */
+static bool shader_target_create(GLuint *fbo, GLuint *texture, const uint16_t width, const uint16_t height, const GLenum format) {
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_2D, *texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glDeleteFramebuffers(1, fbo);
+        glDeleteTextures(1, texture);
+        return false;
+    }
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    return true;
+}
+
+/**
+ * @brief the 2 render targets of a buffer pass. simulations (fluid, reaction diffusion) need
+ * more than 8 bits, so half floats if the driver can render to them
+ */
+static void shader_buffer_create(shader_pass *pass) {
+    static bool warned = false;
+    for (int i=0; i<2; i++) {
+        if (!shader_target_create(&pass->fbo[i], &pass->texture[i], pass->width, pass->height, GL_RGBA16F)) {
+            if (!warned) {
+                fprintf(stderr, "no half float render targets, shader buffers are 8 bit\n");
+                warned = true;
+            }
+            if (!shader_target_create(&pass->fbo[i], &pass->texture[i], pass->width, pass->height, GL_RGBA8)) {
+                die("unable to create a %dx%d shader buffer\n", pass->width, pass->height);
+            }
+        }
+    }
+}
+
+/**
+ * @brief parse the channel of a pass: A-D for a buffer, - for nothing, else an image file
+ * relative to dir
+ */
+static void shader_channel_parse(shader_channel *channel, const char *token, const char *dir) {
+    // the image pass channels replace the .channel0 / .channel1 images
+    if (channel->texture != 0) {
+        glDeleteTextures(1, &channel->texture);
+    }
+    memset(channel, 0, sizeof(shader_channel));
+    channel->buffer = -1;
+    if (strcmp(token, "-") == 0) {
+        return;
+    }
+    if (token[1] == '\0' && token[0] >= 'A' && token[0] < 'A' + SHADER_BUFFERS) {
+        channel->buffer = token[0] - 'A';
+        return;
+    }
+
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s%s", (token[0] == '/') ? "" : dir, token) >= (int)sizeof(path)) {
+        die("texture path too long: %s\n", token);
+    }
+    printf("loading texture %s\n", path);
+    channel->texture = load_texture(path, &channel->width, &channel->height);
+    if (channel->texture == 0) {
+        die("unable to load texture '%s'\n", path);
+    }
+}
+
+/**
+ * @brief parse a pass size: a scale of the scene size (0.5) or WIDTHxHEIGHT in pixels
+ */
+static void shader_pass_size(shader_pass *pass, const char *token, const scene_info *scene) {
+    unsigned width, height;
+    if (sscanf(token, "%ux%u", &width, &height) != 2) {
+        const float scale = strtof(token, NULL);
+        width  = (unsigned)lroundf(scene->width * scale);
+        height = (unsigned)lroundf(scene->height * scale);
+    }
+    if (width < 1 || height < 1 || width > 4096 || height > 4096) {
+        die("invalid shader buffer size '%s'\n", token);
+    }
+    pass->width  = (uint16_t)width;
+    pass->height = (uint16_t)height;
+}
+
+/**
+ * @brief load scene->shader_file as the image pass. its iChannel0 and iChannel1 are the
+ * .channel0 and .channel1 images next to it, if they exist.
+ *
+ * a .passes file next to it describes a multi pass shader, one line each:
+ *   common <file>                            source every pass starts with (shadertoy "Common")
+ *   <A-D> <file> <scale|WxH> [channel0-3]    a buffer pass rendered at a scale of the scene size, or WxH
+ *   image [channel0-3]                       channels of the image pass, replaces .channel0 / .channel1
+ * channels are A-D for the newest frame of a buffer, - for nothing, else an image file.
+ * files are relative to the .passes file. # starts a comment
+ */
+static void shader_passes_load(shader_passes *passes, const scene_info *scene) {
+    memset(passes, 0, sizeof(shader_passes));
+    shader_pass *image = &passes->image;
+    image->width  = scene->width;
+    image->height = scene->height;
+    for (int i=0; i<SHADER_CHANNELS; i++) {
+        image->channel[i].buffer = -1;
+    }
+    for (int i=0; i<2; i++) {
+        char extension[16];
+        snprintf(extension, sizeof(extension), "channel%d", i);
+        char *file = change_file_extension(scene->shader_file, extension);
+        if (access(file, R_OK) == 0) {
+            shader_channel_parse(&image->channel[i], file, "");
+        }
+        free(file);
+    }
+
+    char *passes_file = change_file_extension(scene->shader_file, "passes");
+    FILE *in = fopen(passes_file, "r");
+    if (in == NULL) {
+        free(passes_file);
+        shader_pass_compile(image, scene->shader_file, NULL);
+        return;
+    }
+
+    char dir[PATH_MAX];
+    const char *slash = strrchr(passes_file, '/');
+    snprintf(dir, sizeof(dir), "%.*s", (slash == NULL) ? 0 : (int)(slash - passes_file + 1), passes_file);
+    printf("loading shader passes %s\n", passes_file);
+
+    char *common = NULL;
+    char *sources[SHADER_BUFFERS] = {NULL};
+    char line[1024];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char *tokens[SHADER_CHANNELS + 3];
+        int count = 0;
+        char *save = NULL;
+        for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL && token[0] != '#' && count < SHADER_CHANNELS + 3;
+            token = strtok_r(NULL, " \t\r\n", &save)) {
+            tokens[count++] = token;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        if (strcmp(tokens[0], "common") == 0 && count == 2) {
+            char path[PATH_MAX];
+            long size;
+            if (snprintf(path, sizeof(path), "%s%s", (tokens[1][0] == '/') ? "" : dir, tokens[1]) >= (int)sizeof(path)) {
+                die("shader path too long: %s\n", tokens[1]);
+            }
+            free(common);
+            common = file_get_contents(path, &size);
+        } else if (strcmp(tokens[0], "image") == 0) {
+            for (int i=0; i<SHADER_CHANNELS; i++) {
+                shader_channel_parse(&image->channel[i], (i + 1 < count) ? tokens[i + 1] : "-", dir);
+            }
+        } else if (tokens[0][1] == '\0' && tokens[0][0] >= 'A' && tokens[0][0] < 'A' + SHADER_BUFFERS && count >= 3) {
+            const int index = tokens[0][0] - 'A';
+            shader_pass *pass = &passes->buffer[index];
+            free(sources[index]);
+            sources[index] = (char*)malloc(PATH_MAX);
+            if (sources[index] == NULL) {
+                die("unable to allocate shader pass\n");
+            }
+            if (snprintf(sources[index], PATH_MAX, "%s%s", (tokens[1][0] == '/') ? "" : dir, tokens[1]) >= PATH_MAX) {
+                die("shader path too long: %s\n", tokens[1]);
+            }
+            shader_pass_size(pass, tokens[2], scene);
+            for (int i=0; i<SHADER_CHANNELS; i++) {
+                shader_channel_parse(&pass->channel[i], (i + 3 < count) ? tokens[i + 3] : "-", dir);
+            }
+        } else {
+            die("invalid line in %s: %s\n", passes_file, tokens[0]);
+        }
+    }
+    fclose(in);
+
+    // compile once the common source is known, wherever it is in the file
+    for (int b=0; b<SHADER_BUFFERS; b++) {
+        if (sources[b] != NULL) {
+            shader_pass_compile(&passes->buffer[b], sources[b], common);
+            shader_buffer_create(&passes->buffer[b]);
+            free(sources[b]);
+        }
+    }
+    shader_pass_compile(image, scene->shader_file, common);
+
+    // every buffer a channel reads must be rendered
+    for (int b=0; b<=SHADER_BUFFERS; b++) {
+        const shader_pass *pass = (b < SHADER_BUFFERS) ? &passes->buffer[b] : image;
+        for (int i=0; i<SHADER_CHANNELS && pass->program != 0; i++) {
+            const int8_t buffer = pass->channel[i].buffer;
+            if (buffer >= 0 && passes->buffer[buffer].program == 0) {
+                die("%s reads buffer %c, which has no pass\n", passes_file, 'A' + buffer);
+            }
+        }
+    }
+    free(common);
+    free(passes_file);
+}
+
+/**
+ * @brief draw one pass into fbo. channels are bound to texture units 0-3
+ */
+static void shader_pass_draw(const shader_passes *passes, const shader_pass *pass, const GLuint fbo,
+    const float time, const float time_delta, const int frame) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, pass->width, pass->height);
+    glUseProgram(pass->program);
+
+    GLfloat channel_resolution[SHADER_CHANNELS][3] = {{0}};
+    for (int i=0; i<SHADER_CHANNELS; i++) {
+        const shader_channel *channel = &pass->channel[i];
+        GLuint texture = channel->texture;
+        if (channel->buffer >= 0) {
+            const shader_pass *buffer = &passes->buffer[channel->buffer];
+            texture = buffer->texture[buffer->current];
+            channel_resolution[i][0] = buffer->width;
+            channel_resolution[i][1] = buffer->height;
+        } else {
+            channel_resolution[i][0] = channel->width;
+            channel_resolution[i][1] = channel->height;
+        }
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glUniform1i(pass->channels[i], i);
+    }
+
+    glUniform1f(pass->time, time);
+    glUniform1f(pass->time_delta, time_delta);
+    glUniform1i(pass->frame, frame);
+    glUniform3f(pass->resolution, pass->width, pass->height, 0);
+    glUniform3fv(pass->channel_resolution, SHADER_CHANNELS, &channel_resolution[0][0]);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/**
+ * @brief draw buffers A-D, each into its older texture which then becomes its newest, then the image into fbo
+ */
+static void shader_passes_draw(shader_passes *passes, const GLuint fbo, const float time, const float time_delta, const int frame) {
+    for (int b=0; b<SHADER_BUFFERS; b++) {
+        shader_pass *pass = &passes->buffer[b];
+        if (pass->program != 0) {
+            shader_pass_draw(passes, pass, pass->fbo[pass->current ^ 1], time, time_delta, frame);
+            pass->current ^= 1;
+        }
+    }
+    shader_pass_draw(passes, &passes->image, fbo, time, time_delta, frame);
+}
+
+static void shader_passes_destroy(shader_passes *passes) {
+    for (int b=0; b<=SHADER_BUFFERS; b++) {
+        shader_pass *pass = (b < SHADER_BUFFERS) ? &passes->buffer[b] : &passes->image;
+        if (pass->program == 0) {
+            continue;
+        }
+        glDeleteProgram(pass->program);
+        if (pass->fbo[0] != 0) {
+            glDeleteFramebuffers(2, pass->fbo);
+            glDeleteTextures(2, pass->texture);
+        }
+        // an image can be loaded by more than one channel, each has its own texture
+        for (int i=0; i<SHADER_CHANNELS; i++) {
+            if (pass->channel[i].texture != 0) {
+                glDeleteTextures(1, &pass->channel[i].texture);
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief GPU time of every frame, and the render scale scene->gpu_adaptive_scale picks from it.
+ * the time is measured with EXT_disjoint_timer_query if the driver has it (and GPU_TIMER_QUERY).
+ * else it is estimated from when each frame fence signals: from when the GPU could start the frame
+ * (it was submitted and the frame before it was done) to when it was done, see gpu_scaler_watch.
+ * the map, encode and frame sync stages of the loop are not counted
+ */
+typedef struct {
+    /** @brief percent of the scene size the image pass draws at */
+    uint32_t scale;
+    bool     timer_query;
+    GLuint   query[GPU_READBACK_RING];
+    uint64_t submitted[GPU_READBACK_RING];
+    /** @brief when each frame's fence was seen signaled by gpu_scaler_watch, 0 if it was not */
+    uint64_t signaled[GPU_READBACK_RING];
+    /** @brief when the last frame waited for was done, for the fence estimate */
+    uint64_t last_done;
+    /** @brief GPU ticks and frames since the last scale change */
+    uint64_t gpu_ticks;
+    uint32_t frames;
+    /** @brief frames left before the scale may change. the first frames compile shaders and fill caches */
+    uint32_t warmup;
+    /** @brief a frame since the last scale change was still on the GPU when it was needed, or ran past the budget */
+    bool     gpu_bound;
+    /** @brief render target of the image pass below or above 100%, sized for GPU_SCALE_MAX */
+    GLuint   fbo;
+    GLuint   texture;
+    uint16_t width;
+    uint16_t height;
+    GLuint   program;
+    GLint    region;
+    GLint    size;
+} gpu_scaler;
+
+static void gpu_scaler_create(gpu_scaler *scaler, scene_info *scene) {
+    memset(scaler, 0, sizeof(gpu_scaler));
+    scaler->scale  = 100;
+    scaler->warmup = GPU_SCALE_FRAMES;
+    const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+    scaler->timer_query = GPU_TIMER_QUERY && extensions != NULL && strstr(extensions, "GL_EXT_disjoint_timer_query") != NULL;
+    if (scaler->timer_query) {
+        glGenQueries(GPU_READBACK_RING, scaler->query);
+    }
+    atomic_store_explicit(&scene->render_scale, scaler->scale, memory_order_relaxed);
+    if (!scene->gpu_adaptive_scale) {
+        return;
+    }
+
+    scaler->width  = (uint16_t)((scene->width * GPU_SCALE_MAX) / 100);
+    scaler->height = (uint16_t)((scene->height * GPU_SCALE_MAX) / 100);
+    glGenTextures(1, &scaler->texture);
+    glBindTexture(GL_TEXTURE_2D, scaler->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, scaler->width, scaler->height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &scaler->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scaler->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scaler->texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        die("unable to create a %dx%d render scale framebuffer\n", scaler->width, scaler->height);
+    }
+
+    GLuint vertex_shader   = compile_shader(vertex_shader_source, GL_VERTEX_SHADER);
+    GLuint fragment_shader = compile_shader(resample_shader_source, GL_FRAGMENT_SHADER);
+    scaler->program = glCreateProgram();
+    glAttachShader(scaler->program, vertex_shader);
+    glAttachShader(scaler->program, fragment_shader);
+    glBindAttribLocation(scaler->program, 0, "position");
+    glLinkProgram(scaler->program);
+    GLint success;
+    glGetProgramiv(scaler->program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char info_log[512];
+        glGetProgramInfoLog(scaler->program, 512, NULL, info_log);
+        die("resample program linking error: %s\n", info_log);
+    }
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    scaler->region = glGetUniformLocation(scaler->program, "region");
+    scaler->size   = glGetUniformLocation(scaler->program, "size");
+    glUseProgram(scaler->program);
+    glUniform1i(glGetUniformLocation(scaler->program, "image"), 0);
+}
+
+static void gpu_scaler_destroy(gpu_scaler *scaler, scene_info *scene) {
+    if (scaler->timer_query) {
+        glDeleteQueries(GPU_READBACK_RING, scaler->query);
+    }
+    if (scaler->program != 0) {
+        glDeleteProgram(scaler->program);
+        glDeleteFramebuffers(1, &scaler->fbo);
+        glDeleteTextures(1, &scaler->texture);
+    }
+    atomic_store_explicit(&scene->render_scale, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief draw all passes of a frame into fbo. the image pass draws at the render scale, anything
+ * but 100% into the scaler target first, then resampled to the scene size
+ */
+static void gpu_scaler_draw(gpu_scaler *scaler, const scene_info *scene, shader_passes *passes, const GLuint fbo,
+    const unsigned long frame, const float time, const float time_delta) {
+    const uint8_t index = frame % GPU_READBACK_RING;
+    if (scaler->timer_query) {
+        glBeginQuery(GL_TIME_ELAPSED_EXT, scaler->query[index]);
+    }
+
+    if (scaler->scale == 100) {
+        passes->image.width  = scene->width;
+        passes->image.height = scene->height;
+        shader_passes_draw(passes, fbo, time, time_delta, (int)frame);
+        return;
+    }
+
+    passes->image.width  = (uint16_t)MAX((scene->width * scaler->scale) / 100, 1);
+    passes->image.height = (uint16_t)MAX((scene->height * scaler->scale) / 100, 1);
+    shader_passes_draw(passes, scaler->fbo, time, time_delta, (int)frame);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, scene->width, scene->height);
+    glUseProgram(scaler->program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scaler->texture);
+    glUniform2f(scaler->region, (float)passes->image.width / scaler->width, (float)passes->image.height / scaler->height);
+    glUniform2f(scaler->size, scene->width, scene->height);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+/**
+ * @brief the frame is queued (and flushed), everything the GPU does for it is timed
+ */
+static void gpu_scaler_submitted(gpu_scaler *scaler, const unsigned long frame) {
+    const uint8_t index = frame % GPU_READBACK_RING;
+    if (scaler->timer_query) {
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+    }
+    scaler->submitted[index] = hub_cycles();
+}
 
-    // Open a file descriptor to the DRM device
-    int fd = open("/dev/dri/card0", O_RDWR);
-    if (fd < 0) {
-        die("Failed to open DRM device /dev/dri/card0\n");
+/**
+ * @brief the GPU time budget of a frame in hub_cycles() ticks, GPU_SCALE_BUDGET percent of 1 / scene->fps
+ */
+static uint64_t gpu_scaler_budget(const scene_info *scene) {
+    return (hub_tick_hz() * GPU_SCALE_BUDGET) / (100 * MAX(scene->fps, 1));
+}
+
+/**
+ * @brief note when the fence of the frame just queued signals, for the fence estimate. called after
+ * the oldest frame is encoded, before the frame sync sleeps. with scene->gpu_adaptive_scale it waits
+ * up to the budget after the frame was submitted, time the frame sync would sleep anyway, so a frame
+ * that fits is timed when it is done (an upper bound if it was done during the encode). a frame still
+ * running then is over budget. without the adaptive scale the fence is only polled, a frame not done
+ * yet is timed when it is waited for
+ */
+static void gpu_scaler_watch(gpu_scaler *scaler, const scene_info *scene, const GLsync fence, const unsigned long frame) {
+    const uint8_t index = frame % GPU_READBACK_RING;
+    if (scaler->timer_query || fence == 0) {
+        return;
     }
+    GLuint64 timeout = 0;
+    if (scene->gpu_adaptive_scale) {
+        const uint64_t budget  = gpu_scaler_budget(scene);
+        const uint64_t elapsed = hub_cycles() - scaler->submitted[index];
+        timeout = (elapsed < budget) ? ((budget - elapsed) * 1000000000ULL) / hub_tick_hz() : 0;
+    }
+    if (glClientWaitSync(fence, 0, timeout) == GL_TIMEOUT_EXPIRED) {
+        scaler->gpu_bound |= scene->gpu_adaptive_scale;
+        return;
+    }
+    scaler->signaled[index] = hub_cycles();
+}
 
+/**
+ * @brief pick the render scale that fits GPU_SCALE_BUDGET percent of the frame time. GPU time follows
+ * the pixel count, the square of the scale. the scale drops to fit at once, and grows one
+ * GPU_SCALE_STEP at a time only while the bigger frame still fits, so it settles instead of flipping
+ */
+static void gpu_scaler_adjust(gpu_scaler *scaler, scene_info *scene) {
+    const uint64_t budget  = gpu_scaler_budget(scene);
+    const uint64_t average = MAX(scaler->gpu_ticks / scaler->frames, 1);
+    uint32_t scale = (uint32_t)(scaler->scale * sqrt((double)budget / average));
+    scale -= scale % GPU_SCALE_STEP;
+
+    if (scale < scaler->scale) {
+        // a frame gpu_scaler_watch missed is timed when it was waited for, only trust that if the GPU held a frame up
+        if (!scaler->timer_query && !scaler->gpu_bound) {
+            scale = scaler->scale;
+        }
+    } else if (scale > scaler->scale) {
+        scale = scaler->scale + GPU_SCALE_STEP;
+    }
+    scale = MIN(MAX(scale, GPU_SCALE_MIN), GPU_SCALE_MAX);
 
-	static const EGLint context_attribs[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 2,
-		EGL_NONE
-	};
+    if (scale != scaler->scale) {
+        debug("render scale %u%% -> %u%%, GPU %.2fms of %.2fms\n", scaler->scale, scale,
+            (average * 1000.0) / hub_tick_hz(), (budget * 1000.0) / hub_tick_hz());
+        scaler->scale = scale;
+        atomic_store_explicit(&scene->render_scale, scale, memory_order_relaxed);
+    }
+    scaler->gpu_ticks = 0;
+    scaler->frames    = 0;
+    scaler->gpu_bound = false;
+}
 
-    // Create GBM device and surface
-    struct gbm_device *gbm = gbm_create_device(fd);
-    struct gbm_surface *surface = gbm_surface_create(gbm, scene->width, scene->height, GBM_FORMAT_XRGB8888, GBM_BO_USE_RENDERING);
+/**
+ * @brief the oldest frame's fence signaled, add its GPU time to the histogram (and the scale window)
+ *
+ * @param waited true if the fence had not signaled yet when the frame was needed
+ */
+static void gpu_scaler_done(gpu_scaler *scaler, scene_info *scene, hub_histogram *gpu, const unsigned long frame, const bool waited) {
+    const uint8_t index = frame % GPU_READBACK_RING;
+    const uint64_t now  = hub_cycles();
+    uint64_t ticks;
+    if (scaler->timer_query) {
+        // the fence signaled so the result is available. a disjoint event (frequency change) spoils it
+        GLuint ns = 0;
+        GLint disjoint = 0;
+        glGetQueryObjectuiv(scaler->query[index], GL_QUERY_RESULT, &ns);
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        if (disjoint) {
+            return;
+        }
+        ticks = ((uint64_t)ns * hub_tick_hz()) / 1000000000ULL;
+    } else {
+        const uint64_t done = (scaler->signaled[index] != 0) ? scaler->signaled[index] : now;
+        ticks = done - MAX(scaler->submitted[index], scaler->last_done);
+        scaler->last_done = done;
+        scaler->signaled[index] = 0;
+    }
 
-    // Initialize EGL
-    EGLDisplay display = eglGetDisplay(gbm);
-    eglInitialize(display, NULL, NULL);
+    histogram_add(gpu, ticks);
+    if (scaler->warmup > 0) {
+        scaler->warmup--;
+        return;
+    }
+    scaler->gpu_ticks += ticks;
+    scaler->gpu_bound |= waited;
+    if (scene->gpu_adaptive_scale && ++scaler->frames >= GPU_SCALE_FRAMES) {
+        gpu_scaler_adjust(scaler, scene);
+    }
+}
+
+/**
+ * @brief the EGL display and context render_shader draws with
+ */
+typedef struct {
+    int fd;
+#ifdef HAVE_GBM
+    struct gbm_device *gbm;
+#endif
+    EGLDisplay display;
+    EGLContext context;
+} gpu_context;
+
+/**
+ * @brief one frame of the render_shader ring: the framebuffer it is drawn to, and the fence
+ * that signals when the GPU is done with it
+ */
+typedef struct {
+    GLuint fbo;
+    GLuint color;
+    GLsync fence;
+    /** @brief pixel buffer glReadPixels copies the frame to, 0 when the frame is read in place */
+    GLuint pbo;
+    /** @brief with scene->gpu_encode the frame is drawn to this texture instead of the renderbuffer */
+    GLuint texture;
+    /** @brief shader storage buffer the encode shader writes the bit planes of the frame to */
+    GLuint planes;
+#ifdef HAVE_GBM
+    /** @brief linear GBM buffer the frame is drawn to with scene->gpu_zero_copy */
+    struct gbm_bo *bo;
+    EGLImageKHR image;
+    void *map_data;
+#endif
+} gpu_frame;
+
+/**
+ * @brief time spent in each stage of a render_shader frame, see GPU_READBACK_RING
+ */
+typedef struct {
+    /** @brief uniforms, draw call and queueing the read back, CPU time only */
+    hub_histogram draw;
+    /** @brief waiting for the GPU to finish the frame being read back */
+    hub_histogram fence;
+    /** @brief mapping the frame (and copying it for blur, an in place mapper or a padded pitch) or its encoded planes */
+    hub_histogram map;
+    /** @brief bcm_mapper, or copying the GPU encoded planes to the back buffer */
+    hub_histogram encode;
+    /** @brief hub_frame_sync, the fps and vsync wait */
+    hub_histogram sync;
+    /** @brief GPU time of the frame, see gpu_scaler */
+    hub_histogram gpu;
+    uint64_t report_at;
+} gpu_timings;
+
+/**
+ * @brief an EGL display on the GBM device GPU_DRM_DEVICE, or surfaceless EGL if that is not available.
+ * both render without a window surface, to a framebuffer object
+ */
+static void gpu_context_create(gpu_context *gpu) {
+    gpu->display = EGL_NO_DISPLAY;
+    gpu->fd      = open(GPU_DRM_DEVICE, O_RDWR);
+#ifdef HAVE_GBM
+    gpu->gbm = NULL;
+    if (gpu->fd >= 0) {
+        gpu->gbm     = gbm_create_device(gpu->fd);
+        gpu->display = (gpu->gbm != NULL) ? eglGetDisplay((EGLNativeDisplayType)gpu->gbm) : EGL_NO_DISPLAY;
+    }
+#endif
+    if (gpu->display == EGL_NO_DISPLAY) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display == NULL) {
+            die("no GBM device %s and no eglGetPlatformDisplayEXT for surfaceless EGL\n", GPU_DRM_DEVICE);
+        }
+        debug("rendering with surfaceless EGL\n");
+        gpu->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (gpu->display == EGL_NO_DISPLAY || !eglInitialize(gpu->display, NULL, NULL)) {
+        die("unable to initialize EGL: 0x%x\n", eglGetError());
+    }
     eglBindAPI(EGL_OPENGL_ES_API);
 
-    // Create EGL context and surface.
+    // no window surface, any config that renders GLES3 will do
     // TODO experiment with 565 color
     EGLConfig config;
-    EGLint num_configs;
-    EGLint attribs[] = {
+    EGLint num_configs = 0;
+    static const EGLint attribs[] = {
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
+        EGL_SURFACE_TYPE, 0,
+        EGL_NONE
+    };
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+    if (!eglChooseConfig(gpu->display, attribs, &config, 1, &num_configs) || num_configs < 1) {
+        die("no GLES3 EGL config: 0x%x\n", eglGetError());
+    }
+    gpu->context = eglCreateContext(gpu->display, config, EGL_NO_CONTEXT, context_attribs);
+    if (gpu->context == EGL_NO_CONTEXT || !eglMakeCurrent(gpu->display, EGL_NO_SURFACE, EGL_NO_SURFACE, gpu->context)) {
+        die("unable to create a surfaceless GLES3 context: 0x%x\n", eglGetError());
+    }
+}
+
+static void gpu_context_destroy(gpu_context *gpu) {
+    eglMakeCurrent(gpu->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(gpu->display, gpu->context);
+    eglTerminate(gpu->display);
+#ifdef HAVE_GBM
+    if (gpu->gbm != NULL) {
+        gbm_device_destroy(gpu->gbm);
+    }
+#endif
+    if (gpu->fd >= 0) {
+        close(gpu->fd);
+    }
+}
+
+#ifdef HAVE_GBM
+static PFNEGLCREATEIMAGEKHRPROC create_image = NULL;
+static PFNEGLDESTROYIMAGEKHRPROC destroy_image = NULL;
+static PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC image_storage = NULL;
+
+/**
+ * @brief back the bound renderbuffer with a linear XBGR8888 GBM buffer object. in memory that is
+ * R, G, B, X per pixel, the 4 byte stride layout the encoders already read, so nothing is converted
+ *
+ * @return false (with a warning) if the driver can not create or import one
+ */
+static bool gpu_frame_import_bo(const gpu_context *gpu, gpu_frame *frame, const uint16_t width, const uint16_t height) {
+    if (create_image == NULL) {
+        create_image  = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+        image_storage = (PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)eglGetProcAddress("glEGLImageTargetRenderbufferStorageOES");
+    }
+    if (create_image == NULL || destroy_image == NULL || image_storage == NULL) {
+        fprintf(stderr, "no EGL dmabuf import\n");
+        return false;
+    }
+    frame->bo = gbm_bo_create(gpu->gbm, width, height, GBM_FORMAT_XBGR8888, GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+    if (frame->bo == NULL) {
+        fprintf(stderr, "no linear %dx%d GBM buffers\n", width, height);
+        return false;
+    }
+
+    const int fd = gbm_bo_get_fd(frame->bo);
+    const EGLint attribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_LINUX_DRM_FOURCC_EXT, GBM_FORMAT_XBGR8888,
+        EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)gbm_bo_get_stride(frame->bo),
         EGL_NONE
     };
-    eglChooseConfig(display, attribs, &config, 1, &num_configs);
+    frame->image = (fd >= 0) ? create_image(gpu->display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs) : EGL_NO_IMAGE_KHR;
+    // the image holds its own reference to the dmabuf
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (frame->image == EGL_NO_IMAGE_KHR) {
+        fprintf(stderr, "unable to import a GBM buffer: 0x%x\n", eglGetError());
+        gbm_bo_destroy(frame->bo);
+        frame->bo = NULL;
+        return false;
+    }
+    image_storage(GL_RENDERBUFFER, (GLeglImageOES)frame->image);
+    return true;
+}
+#endif
+
+/**
+ * @brief the framebuffer of one ring frame. with zero_copy on a GBM display it draws into a GBM
+ * buffer object that is mapped in place, with plane_bytes into a texture the encode shader reads,
+ * else into a renderbuffer copied to a pixel buffer object
+ *
+ * @param plane_bytes size of the encoded bit planes, 0 if the frame is encoded on the CPU
+ * @return true if the frame is read in place
+ */
+static bool gpu_frame_create(const gpu_context *gpu, gpu_frame *frame, const uint16_t width, const uint16_t height,
+    const bool zero_copy, const size_t plane_bytes) {
+    memset(frame, 0, sizeof(gpu_frame));
+    glGenFramebuffers(1, &frame->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, frame->fbo);
+
+    bool in_place = false;
+    if (plane_bytes > 0) {
+        glGenTextures(1, &frame->texture);
+        glBindTexture(GL_TEXTURE_2D, frame->texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frame->texture, 0);
+
+        glGenBuffers(1, &frame->planes);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, frame->planes);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, plane_bytes, NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    } else {
+        glGenRenderbuffers(1, &frame->color);
+        glBindRenderbuffer(GL_RENDERBUFFER, frame->color);
+#ifdef HAVE_GBM
+        if (zero_copy && gpu->gbm != NULL) {
+            in_place = gpu_frame_import_bo(gpu, frame, width, height);
+        }
+#else
+        (void)gpu;
+        (void)zero_copy;
+#endif
+        if (!in_place) {
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            glGenBuffers(1, &frame->pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, frame->pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, frame->color);
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        die("unable to create a %dx%d framebuffer\n", width, height);
+    }
+    return in_place;
+}
+
+/**
+ * @brief map a finished frame for reading
+ *
+ * @param pitch set to the bytes per row, GBM buffers may pad their rows
+ * @return uint8_t* the first row, the bottom of the image like glReadPixels
+ */
+static uint8_t *gpu_frame_map(gpu_frame *frame, const uint16_t width, const uint16_t height, uint32_t *pitch) {
+    uint8_t *pixels;
+#ifdef HAVE_GBM
+    if (frame->bo != NULL) {
+        pixels = (uint8_t*)gbm_bo_map(frame->bo, 0, 0, width, height, GBM_BO_TRANSFER_READ, pitch, &frame->map_data);
+        if (pixels == NULL) {
+            die("unable to map the GBM frame\n");
+        }
+        return pixels;
+    }
+#endif
+    *pitch = width * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, frame->pbo);
+    pixels = (uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)width * height * 4, GL_MAP_READ_BIT);
+    if (pixels == NULL) {
+        die("unable to map the GPU frame: 0x%x\n", glGetError());
+    }
+    return pixels;
+}
+
+/**
+ * @brief true if gpu_frame_map returns cached memory. a GBM buffer is mapped write combined, every
+ * read of it goes to memory, so it is copied out once instead of read by both the row hash and the encoder
+ */
+static bool gpu_frame_cached(const gpu_frame *frame) {
+#ifdef HAVE_GBM
+    return frame->bo == NULL;
+#else
+    (void)frame;
+    return true;
+#endif
+}
+
+static void gpu_frame_unmap(gpu_frame *frame) {
+#ifdef HAVE_GBM
+    if (frame->bo != NULL) {
+        gbm_bo_unmap(frame->bo, frame->map_data);
+        frame->map_data = NULL;
+        return;
+    }
+#endif
+    // gpu_frame_map left the pixel buffer bound
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
 
-    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
-    EGLSurface egl_surface = eglCreateWindowSurface(display, config, (EGLNativeWindowType)surface, NULL);
-    eglMakeCurrent(display, egl_surface, egl_surface, context);
+static void gpu_frame_destroy(gpu_context *gpu, gpu_frame *frame) {
+    if (frame->fence != 0) {
+        glDeleteSync(frame->fence);
+    }
+    glDeleteFramebuffers(1, &frame->fbo);
+    if (frame->color != 0) {
+        glDeleteRenderbuffers(1, &frame->color);
+    }
+    if (frame->pbo != 0) {
+        glDeleteBuffers(1, &frame->pbo);
+    }
+    if (frame->texture != 0) {
+        glDeleteTextures(1, &frame->texture);
+        glDeleteBuffers(1, &frame->planes);
+    }
+#ifdef HAVE_GBM
+    if (frame->image != NULL) {
+        destroy_image(gpu->display, frame->image);
+    }
+    if (frame->bo != NULL) {
+        gbm_bo_destroy(frame->bo);
+    }
+#else
+    (void)gpu;
+#endif
+}
+
+/**
+ * @brief copy a mapped frame into packed rows of width * 4 bytes
+ */
+static void gpu_frame_copy(uint8_t *restrict dst, const uint8_t *restrict src, const uint16_t width, const uint16_t height, const uint32_t pitch) {
+    const size_t row = (size_t)width * 4;
+    if (pitch == row) {
+        memcpy(dst, src, row * height);
+        return;
+    }
+    for (uint16_t y=0; y < height; y++) {
+        memcpy(dst + (y * row), src + ((size_t)y * pitch), row);
+    }
+}
+
+/**
+ * @brief time since *start into the histogram, *start moves to now
+ */
+static inline void gpu_mark(hub_histogram *h, uint64_t *start) {
+    const uint64_t now = hub_cycles();
+    histogram_add(h, now - *start);
+    *start = now;
+}
+
+// texture units the encode shader reads the frame and the lookup table from. 0 and 1 are the shader channels
+#define GPU_ENCODE_IMAGE_UNIT 2
+#define GPU_ENCODE_LUT_UNIT 3
+
+/**
+ * @brief the compute shader that encodes frames to bit planes, and the lookup table texture it reads
+ */
+typedef struct {
+    GLuint   program;
+    /** @brief 256x3 RG32UI copy of bcm_tone_lut(), lo and hi word of every entry */
+    GLuint   lut;
+    uint32_t lut_generation;
+    GLint    pins;
+    GLint    inputs;
+    GLint    half_height;
+    GLint    bit_depth;
+    GLint    row_words;
+    GLint    plane_words;
+} gpu_encoder;
+
+/**
+ * @brief why the scene can not be encoded on the GPU, NULL if it can. the encode shader only writes
+ * the plain pwm layout from the frame as rendered, anything that changes the image or the planes
+ * on the CPU stays with map_byte_image_to_bcm()
+ */
+static const char *gpu_encode_unsupported(const scene_info *scene) {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major < 3 || (major == 3 && minor < 1)) {
+        return "no GLES 3.1 compute shaders";
+    }
+    if (scene->bcm_mapper != map_byte_image_to_bcm) {
+        return "a custom bcm_mapper";
+    }
+    if (scene->image_mapper != NULL) {
+        return "an image mapper";
+    }
+    if (scene->dither > 0.1f) {
+        return "dithering";
+    }
+    if (scene->motion_blur_frames > 0) {
+        return "motion blur";
+    }
+    if (scene->scan_gather != NULL) {
+        return "a multiplexed scan pattern";
+    }
+    if (scene->set_clr_pairs || scene->prebaked_stream) {
+        return "set / clr pairs or a prebaked stream";
+    }
+    return NULL;
+}
+
+static void gpu_encoder_create(gpu_encoder *encoder) {
+    memset(encoder, 0, sizeof(gpu_encoder));
+    GLuint shader = compile_shader(encode_shader_source, GL_COMPUTE_SHADER);
+    encoder->program = glCreateProgram();
+    glAttachShader(encoder->program, shader);
+    glLinkProgram(encoder->program);
+
+    GLint success;
+    glGetProgramiv(encoder->program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char info_log[512];
+        glGetProgramInfoLog(encoder->program, 512, NULL, info_log);
+        die("encode shader linking error: %s\n", info_log);
+    }
+    glDeleteShader(shader);
+
+    encoder->pins        = glGetUniformLocation(encoder->program, "pins");
+    encoder->inputs      = glGetUniformLocation(encoder->program, "inputs");
+    encoder->half_height = glGetUniformLocation(encoder->program, "half_height");
+    encoder->bit_depth   = glGetUniformLocation(encoder->program, "bit_depth");
+    encoder->row_words   = glGetUniformLocation(encoder->program, "row_words");
+    encoder->plane_words = glGetUniformLocation(encoder->program, "plane_words");
+    glUseProgram(encoder->program);
+    glUniform1i(glGetUniformLocation(encoder->program, "image"), GPU_ENCODE_IMAGE_UNIT);
+    glUniform1i(glGetUniformLocation(encoder->program, "lut"), GPU_ENCODE_LUT_UNIT);
+
+    // integer textures are only complete with nearest filtering
+    glGenTextures(1, &encoder->lut);
+    glBindTexture(GL_TEXTURE_2D, encoder->lut);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, 256, 3);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void gpu_encoder_destroy(gpu_encoder *encoder) {
+    glDeleteTextures(1, &encoder->lut);
+    glDeleteProgram(encoder->program);
+}
+
+/**
+ * @brief queue the encode of a drawn frame into its plane buffer. uploads the lookup table
+ * again when bcm_tone_lut() rebuilds it
+ */
+static void gpu_encode_frame(scene_info *scene, gpu_encoder *encoder, gpu_frame *frame) {
+    const bcm_geometry *geometry = &scene->geometry;
+    glUseProgram(encoder->program);
+
+    uint32_t generation;
+    const void *bits = bcm_tone_lut(scene, &generation);
+    if (UNLIKELY(generation != encoder->lut_generation)) {
+        const uint32_t *bits32 = (const uint32_t*)bits;
+        const uint64_t *bits64 = (const uint64_t*)bits;
+        GLuint lut[768][2];
+        for (int i=0; i<768; i++) {
+            lut[i][0] = (scene->bit_depth > 32) ? (uint32_t)bits64[i] : bits32[i];
+            lut[i][1] = (scene->bit_depth > 32) ? (uint32_t)(bits64[i] >> 32) : 0;
+        }
+        glActiveTexture(GL_TEXTURE0 + GPU_ENCODE_LUT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, encoder->lut);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 3, GL_RG_INTEGER, GL_UNSIGNED_INT, lut);
+        encoder->lut_generation = generation;
+    }
+
+    // the pixel order and port count can change while running, as with the CPU encoders
+    bcm_pin_table table;
+    bcm_pin_table_init(&table, scene);
+    GLuint pins[BCM_MAX_INPUTS];
+    for (uint8_t k=0; k < table.count; k++) {
+        pins[k] = table.pin[k];
+    }
+    glUniform1uiv(encoder->pins, table.count, pins);
+    glUniform1ui(encoder->inputs, table.count);
+    glUniform1ui(encoder->half_height, geometry->half_height);
+    glUniform1ui(encoder->bit_depth, geometry->bit_depth);
+    glUniform1ui(encoder->row_words, geometry->row_words);
+    glUniform1ui(encoder->plane_words, geometry->plane_words);
+
+    glActiveTexture(GL_TEXTURE0 + GPU_ENCODE_LUT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, encoder->lut);
+    glActiveTexture(GL_TEXTURE0 + GPU_ENCODE_IMAGE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, frame->texture);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, frame->planes);
+    glDispatchCompute(geometry->width / 16, geometry->half_height, 1);
+    // the shader storage writes must land before glMapBufferRange reads them
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // the frame is drawn to again GPU_READBACK_RING frames later, don't leave it bound
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+}
+
+/**
+ * @brief copy the encoded planes of a finished frame to the back buffer and publish it.
+ * the row hashes of the back buffer no longer describe it, see scene->skip_unchanged
+ */
+static void gpu_frame_publish(scene_info *scene, gpu_frame *frame, gpu_timings *timings, uint64_t *stage) {
+    const size_t bytes = (size_t)scene->geometry.frame_words * sizeof(uint32_t);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, frame->planes);
+    const uint32_t *planes = (const uint32_t*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (planes == NULL) {
+        die("unable to map the GPU encoded planes: 0x%x\n", glGetError());
+    }
+    gpu_mark(&timings->map, stage);
+
+    memcpy(bcm_back_buffer(scene), planes, bytes);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (scene->skip_unchanged) {
+        memset(scene->row_hash[scene->bcm_back], 0, scene->geometry.half_height * sizeof(uint64_t));
+    }
+    bcm_publish(scene);
+}
+
+/**
+ * @brief print p50 / p99 of every stage in microseconds and start a new window
+ */
+static void gpu_timings_report(gpu_timings *timings, const uint32_t scale) {
+    const double us = 1000000.0 / hub_tick_hz();
+    printf("GPU frame stages p50/p99us, draw: %.0f/%.0f, fence: %.0f/%.0f, map: %.0f/%.0f, encode: %.0f/%.0f, sync: %.0f/%.0f, "
+        "gpu: %.0f/%.0f, render scale: %u%%\n",
+        histogram_percentile(&timings->draw, 50.0) * us, histogram_percentile(&timings->draw, 99.0) * us,
+        histogram_percentile(&timings->fence, 50.0) * us, histogram_percentile(&timings->fence, 99.0) * us,
+        histogram_percentile(&timings->map, 50.0) * us, histogram_percentile(&timings->map, 99.0) * us,
+        histogram_percentile(&timings->encode, 50.0) * us, histogram_percentile(&timings->encode, 99.0) * us,
+        histogram_percentile(&timings->sync, 50.0) * us, histogram_percentile(&timings->sync, 99.0) * us,
+        histogram_percentile(&timings->gpu, 50.0) * us, histogram_percentile(&timings->gpu, 99.0) * us, scale);
+    memset(timings, 0, sizeof(gpu_timings));
+    timings->report_at = hub_cycles() + (hub_tick_hz() * TELEMETRY_REPORT_S);
+}
+
+/**
+ * @brief render the shadertoy compatible shader source code in the
+ * file pointed to at scene->shader_file
+ *
+ * exits if shader is unable to be rendered
+ *
+ * loop exits and memory is freed if/when scene->do_render becomes false
+ *
+ * frame delay is adaptive and updates to current scene->fps on each frame update
+ *
+ * each frame is drawn to a framebuffer object and glReadPixels copies it into the next pixel
+ * buffer of the ring without waiting. a fence marks when the GPU is done with it, the frame is
+ * only mapped and encoded GPU_READBACK_RING - 1 frames later, while the GPU renders the next.
+ * with scene->gpu_zero_copy the framebuffers are GBM buffer objects, mapped and copied out once with no read back.
+ * buffer passes from a .passes file are drawn first, see shader_passes_load().
+ * with scene->gpu_adaptive_scale the shader is drawn at the render scale that keeps the GPU time
+ * of a frame inside scene->fps and resampled to the scene size, see gpu_scaler.
+ * with scene->gpu_encode a compute shader encodes each frame to bit planes after it is drawn and
+ * only the planes are read back, copied to the back buffer and published.
+ *
+ * @param arg pointer to the current scene_info object
+ */
+void *render_shader(void *arg) {
+    scene_info *scene = (scene_info*)arg;
+    debug("render shader %s\n", scene->shader_file);
+
+    gpu_context gpu;
+    gpu_context_create(&gpu);
+
+    // encode on the GPU if the scene allows it, only the encoded planes are read back
+    gpu_encoder encoder;
+    memset(&encoder, 0, sizeof(encoder));
+    const char *unsupported = (scene->gpu_encode) ? gpu_encode_unsupported(scene) : NULL;
+    if (unsupported != NULL) {
+        fprintf(stderr, "shader frames are encoded on the CPU, GPU encoding does not support %s\n", unsupported);
+    } else if (scene->gpu_encode) {
+        gpu_encoder_create(&encoder);
+        // map_byte_image_to_bcm places the frame source when it creates the encode pool, there is none
+        realtime_place_thread(scene, pthread_self(), THREAD_SOURCE);
+    }
+    const size_t plane_bytes = (encoder.program != 0) ? (size_t)scene->geometry.frame_words * sizeof(uint32_t) : 0;
+
+    // the frame ring. every frame has its own render target, read back through a pixel buffer
+    // (glReadPixels into a bound GL_PIXEL_PACK_BUFFER returns at once), mapped in place or encoded
+    gpu_frame frames[GPU_READBACK_RING];
+    bool in_place = true;
+    for (int i=0; i<GPU_READBACK_RING; i++) {
+        // once a GBM buffer fails the rest would too, warn once
+        in_place &= gpu_frame_create(&gpu, &frames[i], scene->width, scene->height, scene->gpu_zero_copy && in_place, plane_bytes);
+    }
+    if (scene->gpu_zero_copy && !in_place && plane_bytes == 0) {
+        fprintf(stderr, "GBM zero copy is not available, shader frames are read back with glReadPixels\n");
+    }
 
     // Set up OpenGL ES
     printf("compiling GLSL shader...\n");
-    GLuint program = create_shadertoy_program(scene->shader_file);
-    glUseProgram(program);
+    shader_passes passes;
+    shader_passes_load(&passes, scene);
+    gpu_scaler scaler;
+    gpu_scaler_create(&scaler, scene);
 
     // Define a square with two triangles. This is a rendering surface for our fragment shader
     GLfloat vertices[] = {
@@ -294,13 +1471,13 @@ void *render_shader(void *arg) {
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    GLint posAttrib = glGetAttribLocation(program, "position");
-    glEnableVertexAttribArray(posAttrib);
-    glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    // create_shadertoy_program binds position to attribute 0 in every pass
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 
     // setup the timers for frame delays
-    struct timespec start_time, end_time, orig_time;
+    struct timespec end_time, orig_time;
     // uint32_t frame_time_us = 1000000 / scene->fps;
     size_t image_buf_sz = scene->width * (scene->height) * sizeof(uint32_t);
 
@@ -314,19 +1491,9 @@ void *render_shader(void *arg) {
     // pointer to the current motion blur buffer
     GLubyte *pixelsO = pixelsA+(image_buf_sz * scene->motion_blur_frames+1);
 
-    // uniforms point to information we will pass to the GLSL shader
-    GLint timeLocation = glGetUniformLocation(program, "iTime");
-    GLint timeDeltaLocation = glGetUniformLocation(program, "iTimeDelta");
-    GLint frameLocation = glGetUniformLocation(program, "iFrame");
-    GLint resLocation = glGetUniformLocation(program, "iResolution");
-    GLint chan0Location = glGetUniformLocation(program, "iChannel0");
-    GLint chan1Location = glGetUniformLocation(program, "iChannel1");
-    
-
-
     // some variables for each frame iteration
     float motion_blur[scene->motion_blur_frames+1];
-    float time1, time2 = 0.0f;
+    float time1, last_time = 0.0f;
     unsigned long frame= 0;
     int frame_num = 0;
 
@@ -344,100 +1511,128 @@ void *render_shader(void *arg) {
     }
 
 
-    GLuint texture0 = 0, texture1 = 0;
-    char *chan0 = change_file_extension(scene->shader_file, "channel0");
-    if (access(chan0, R_OK) == 0) {
-        printf("loading texture %s\n", chan0);
-        texture0 = load_texture(chan0);
-        if (texture0 == 0) {
-            die("unable to load texture '%s'\n", chan0);
-        }
-    }
-
-    char *chan1 = change_file_extension(scene->shader_file, "channel1");
-    if (access(chan1, R_OK) == 0) {
-        printf("loading texture %s\n", chan1);
-        texture1 = load_texture(chan1);
-        if (texture1 == 0) {
-            die("unable to load texture '%s'\n", chan1);
-        }
-    }
-
-
+    gpu_timings timings;
+    memset(&timings, 0, sizeof(timings));
+    timings.report_at = hub_cycles() + (hub_tick_hz() * TELEMETRY_REPORT_S);
 
 
     //printf("GLSL shader compiled. rendering...\n");
     // loop until do_render is false. most likely never exit...
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
     clock_gettime(CLOCK_MONOTONIC, &orig_time);
     while(scene->do_render) {
-        frame++;
+        uint64_t stage = hub_cycles();
         clock_gettime(CLOCK_MONOTONIC, &end_time);
         time1 = (end_time.tv_sec - orig_time.tv_sec) + (end_time.tv_nsec - orig_time.tv_nsec) / 1000000000.0f;
-        time2 = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1000000000.0f;
-        glUseProgram(program);
 
-        if (texture0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture0);
+        // Render, buffer passes first
+        gpu_frame *next = &frames[frame % GPU_READBACK_RING];
+        gpu_scaler_draw(&scaler, scene, &passes, next->fbo, frame, time1, time1 - last_time);
+        last_time = time1;
+
+        // queue the encode or the copy into this frame's pixel buffer, the fence signals when it is done
+        if (encoder.program != 0) {
+            gpu_encode_frame(scene, &encoder, next);
+        } else if (next->pbo != 0) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, next->pbo);
+            glReadPixels(0, 0, scene->width, scene->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        gpu_scaler_submitted(&scaler, frame);
+        next->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        gpu_mark(&timings.draw, &stage);
+        frame++;
 
-            if (texture1) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, texture1);
-            }
+        // fill the ring before reading the first frame back
+        if (frame < GPU_READBACK_RING) {
+            continue;
         }
 
-        glUniform1f(timeLocation, time1);
-        glUniform1f(timeDeltaLocation, time2);
-        glUniform1f(frameLocation, frame);
-        glUniform1i(chan0Location, 0);
-        glUniform1i(chan1Location, 1);
-        glUniform3f(resLocation, scene->width, (scene->height), 0);
-
-        // Render
-        glViewport(0, 0, scene->width, scene->height);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        eglSwapBuffers(display, egl_surface);
-
-        // switch between pixels buffers A-F based on frame number
-        pixels = pixelsA + (frame_num * image_buf_sz);
-        glReadPixels(0, 0, scene->width, scene->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-
-        // apply motion blur in the CPU
-        if (scene->motion_blur_frames > 0) {
-            for (int i = 0; i < scene->width * scene->height * 4; i++) {
-                float accum = 0;
-                for (int f = 0; f < scene->motion_blur_frames; f++) {
-                    GLubyte *frame_idx = pixelsA + (((f + frame_num) % scene->motion_blur_frames)* image_buf_sz);
-                    accum += ((float)(frame_idx[i])) * motion_blur[(f + frame_num) % scene->motion_blur_frames];
+        // the oldest frame in the ring, GPU_READBACK_RING - 1 frames behind the one just queued
+        gpu_frame *oldest = &frames[frame % GPU_READBACK_RING];
+        const bool gpu_bound = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED;
+        GLenum waited;
+        do {
+            waited = glClientWaitSync(oldest->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GPU_FENCE_TIMEOUT_NS);
+        } while (waited == GL_TIMEOUT_EXPIRED && scene->do_render);
+        glDeleteSync(oldest->fence);
+        oldest->fence = 0;
+        if (waited == GL_WAIT_FAILED) {
+            die("waiting for the GPU frame failed: 0x%x\n", glGetError());
+        }
+        // do_render was cleared while the GPU still had the frame, stop without mapping or encoding it
+        if (waited == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        gpu_mark(&timings.fence, &stage);
+        gpu_scaler_done(&scaler, scene, &timings.gpu, frame, gpu_bound);
+
+        if (encoder.program != 0) {
+            gpu_frame_publish(scene, oldest, &timings, &stage);
+        } else {
+            uint32_t pitch;
+            GLubyte *mapped = gpu_frame_map(oldest, scene->width, scene->height, &pitch);
+
+            // switch between pixels buffers A-F based on frame number
+            pixels = pixelsA + (frame_num * image_buf_sz);
+
+            // apply motion blur in the CPU
+            if (scene->motion_blur_frames > 0) {
+                gpu_frame_copy(pixels, mapped, scene->width, scene->height, pitch);
+                gpu_mark(&timings.map, &stage);
+                for (int i = 0; i < scene->width * scene->height * 4; i++) {
+                    float accum = 0;
+                    for (int f = 0; f < scene->motion_blur_frames; f++) {
+                        GLubyte *frame_idx = pixelsA + (((f + frame_num) % scene->motion_blur_frames)* image_buf_sz);
+                        accum += ((float)(frame_idx[i])) * motion_blur[(f + frame_num) % scene->motion_blur_frames];
+                    }
+
+                    pixelsO[i] = (uint8_t)(accum);
                 }
-
-                pixelsO[i] = (uint8_t)(accum);
+                scene->bcm_mapper(scene, pixelsO);
+                frame_num = frame % scene->motion_blur_frames;
             }
-            scene->bcm_mapper(scene, pixelsO);
-            frame_num = frame % scene->motion_blur_frames;
-        }
-        // skip motion blur ....
-        else {
-            scene->bcm_mapper(scene, pixels);
+            // the image mapper and dithering write the image in place, the mapping is read only.
+            // the encoders read packed rows, GBM may pad them. GBM buffers are write combined, see gpu_frame_cached
+            else if (scene->image_mapper != NULL || scene->dither > 0.1f || pitch != (uint32_t)scene->width * 4 || !gpu_frame_cached(oldest)) {
+                gpu_frame_copy(pixels, mapped, scene->width, scene->height, pitch);
+                gpu_mark(&timings.map, &stage);
+                scene->bcm_mapper(scene, pixels);
+            }
+            // skip motion blur .... encode straight from the pixel buffer
+            else {
+                gpu_mark(&timings.map, &stage);
+                scene->bcm_mapper(scene, mapped);
+            }
+            gpu_frame_unmap(oldest);
         }
+        gpu_mark(&timings.encode, &stage);
+
+        // time the frame just queued while it is on the GPU, before the frame sync sleeps
+        gpu_scaler_watch(&scaler, scene, frames[(frame - 1) % GPU_READBACK_RING].fence, frame - 1);
 
-        // calculate the current FPS and delay to achieve fram rate
-        calculate_fps(scene->fps, scene->show_fps);
+        // calculate the current FPS and delay to achieve fram rate (and panel refresh with -v)
+        hub_frame_sync(scene, scene->fps);
+        gpu_mark(&timings.sync, &stage);
+
+        if (scene->show_fps && stage >= timings.report_at) {
+            gpu_timings_report(&timings, scaler.scale);
+        }
     }
 
 
     // Cleanup
+    for (int i=0; i<GPU_READBACK_RING; i++) {
+        gpu_frame_destroy(&gpu, &frames[i]);
+    }
+    if (encoder.program != 0) {
+        gpu_encoder_destroy(&encoder);
+    }
+    shader_passes_destroy(&passes);
+    gpu_scaler_destroy(&scaler, scene);
     glDeleteBuffers(1, &vbo);
-    eglDestroySurface(display, egl_surface);
-    eglDestroyContext(display, context);
-    eglTerminate(display);
-    gbm_surface_destroy(surface);
-    gbm_device_destroy(gbm);
+    gpu_context_destroy(&gpu);
 
     free(pixelsA);
-    close(fd);
     return NULL;
 }
-
@@ -20,6 +20,10 @@
 #include "rpihub75.h"
 #include "util.h"
 #include "pixels.h"
+#include "simd.h"
+#include "pool.h"
+#include "realtime.h"
+#include "scan.h"
 
 
 
@@ -509,702 +513,158 @@ uint64_t byte_to_bcm64(const uint8_t input, const uint8_t num_bits) {
 
 
 /**
- * @brief map 6 pixels of to bcm data. supports 3 output ports with 2 pixels per port. RGB pixel order version.
+ * @brief map a normalized intensity to a binary weighted bcm value for BCM_MODE_BINARY.
+ * bit k of the result is displayed for 2^k time units so num_bits planes give 2^num_bits levels.
  * 
- * @param scene the scene information
- * @param void_bits pointer to the gamma corrected tone mapped pwm data for each RGB value. (uint32_t !)
- * @param pwm_signal pointer to the bcm data for current X/Y. (y = 0 - panel_height/2), scene->bit_depth bytes will be updated here
- * @param image pointer to 24bpp RGB or 32bpp RGBA image data at the current pixel offset. IE: image[offset]
+ * @param input intensity 0-1
+ * @param num_bits number of bit planes (1-16)
+ * @return uint32_t the plane bit mask
  */
-__attribute__((hot))
-void update_bcm_signal_32_rgb(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint32_t *bits_red = (const uint32_t*)void_bits;
-    const uint32_t *bits_green = bits_red+256;
-    const uint32_t *bits_blue = bits_red+512;
-
-    // offset to the Port0 top pixel image
-    //uint32_t img_idx = offset;
-    // offset from top pixel to lower pixel in image data. 
-    static uint32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint32_t mask = 1 << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits_red[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits_green[image[1]] & mask)) << ADDRESS_P0_G1 |
-            (!!(bits_blue[image[2]] & mask)) << ADDRESS_P0_B1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits_red[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits_green[image[p0b+1]] & mask)) << ADDRESS_P0_G2 |
-            (!!(bits_blue[image[p0b+2]] & mask)) << ADDRESS_P0_B2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits_green[image[p1t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits_blue[image[p1t+2]] & mask)) << ADDRESS_P1_B1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits_green[image[p1b+1]] & mask)) << ADDRESS_P1_G2 |
-            (!!(bits_blue[image[p1b+2]] & mask)) << ADDRESS_P1_B2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2t+0]] & mask)) << ADDRESS_P2_R1 |
-            (!!(bits_green[image[p2t+1]] & mask)) << ADDRESS_P2_G1 |
-            (!!(bits_blue[image[p2t+2]] & mask)) << ADDRESS_P2_B1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits_green[image[p2b+1]] & mask)) << ADDRESS_P2_G2 |
-            (!!(bits_blue[image[p2b+2]] & mask)) << ADDRESS_P2_B2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
+__attribute__((cold, pure))
+uint32_t normal_to_bcm_binary(const Normal input, const uint8_t num_bits) {
+    ASSERT(num_bits <= MAX_BINARY_BITS);
+    const uint32_t max_value = (1U << num_bits) - 1;
+    return (uint32_t)lroundf(clampf(input, 0.0f, 1.0f) * (float)max_value);
 }
 
+
 /**
- * @brief See update_bcm_signal_32_rgb. RBG pixel order version.
+ * @brief GPIO pin for image byte (0, 1, 2) of the top (half 0) or bottom (half 1) pixel on a port.
+ * only ever called with constants from encode_row_scalar, so it folds away.
  */
-__attribute__((hot))
-void update_bcm_signal_32_rbg(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint32_t *bits_red = (const uint32_t*)void_bits;
-    const uint32_t *bits_green = bits_red+256;
-    const uint32_t *bits_blue = bits_red+512;
-
-    // offset to the Port0 top pixel image
-    //uint32_t img_idx = offset;
-    // offset from top pixel to lower pixel in image data. 
-    static uint32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint32_t mask = 1 << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits_red[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits_green[image[1]] & mask)) << ADDRESS_P0_B1 |
-            (!!(bits_blue[image[2]] & mask)) << ADDRESS_P0_G1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits_red[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits_green[image[p0b+1]] & mask)) << ADDRESS_P0_B2 |
-            (!!(bits_blue[image[p0b+2]] & mask)) << ADDRESS_P0_G2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits_green[image[p1t+1]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits_blue[image[p1t+2]] & mask)) << ADDRESS_P1_G1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits_green[image[p1b+1]] & mask)) << ADDRESS_P1_B2 |
-            (!!(bits_blue[image[p1b+2]] & mask)) << ADDRESS_P1_G2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2t+0]] & mask)) << ADDRESS_P2_R1 |
-            (!!(bits_green[image[p2t+1]] & mask)) << ADDRESS_P2_B1 |
-            (!!(bits_blue[image[p2t+2]] & mask)) << ADDRESS_P2_G1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits_green[image[p2b+1]] & mask)) << ADDRESS_P2_B2 |
-            (!!(bits_blue[image[p2b+2]] & mask)) << ADDRESS_P2_G2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
+__attribute__((always_inline, const))
+static inline uint8_t pixel_pin(const uint8_t port, const uint8_t half, const uint8_t byte, const enum pixel_order_e order) {
+    static const uint8_t port_pins[3][2][3] = {
+        {{ADDRESS_P0_R1, ADDRESS_P0_G1, ADDRESS_P0_B1}, {ADDRESS_P0_R2, ADDRESS_P0_G2, ADDRESS_P0_B2}},
+        {{ADDRESS_P1_R1, ADDRESS_P1_G1, ADDRESS_P1_B1}, {ADDRESS_P1_R2, ADDRESS_P1_G2, ADDRESS_P1_B2}},
+        {{ADDRESS_P2_R1, ADDRESS_P2_G1, ADDRESS_P2_B1}, {ADDRESS_P2_R2, ADDRESS_P2_G2, ADDRESS_P2_B2}}
+    };
+    // which color pin image byte 0, 1, 2 drives for each pixel order
+    static const uint8_t color_of_byte[3][3] = {
+        [PIXEL_ORDER_RGB] = {0, 1, 2},
+        [PIXEL_ORDER_RBG] = {0, 2, 1},
+        [PIXEL_ORDER_BGR] = {2, 1, 0}
+    };
+    return port_pins[port][half][color_of_byte[order][byte]];
 }
 
 /**
- * @brief See update_bcm_signal_32_rgb. BGR pixel order version.
+ * @brief map one row of pixels to bcm data. supports 3 output ports with 2 pixels per port.
+ * every argument after image is a compile time constant in the ENCODER() specializations below,
+ * so the port, pixel and color loops unroll into one expression per bit plane.
+ *
+ * the tone mapped bcm word for each of the (ports * 6) image bytes is looked up once per pixel,
+ * then for each bit plane: bit j of each word is shifted to the correct pin (ADDRESS_Px_CX) and
+ * all of them are ORed into the plane's GPIO word.
+ * 
+ * @param scene the scene information
+ * @param bits gamma corrected tone mapped bcm data for each RGB value. uint32_t or uint64_t if wide
+ * @param bcm_signal plane 0 word of the first pixel in the row. each plane is geometry.plane_words apart
+ * @param image port 0 top pixel of the first pixel in the row, 24bpp RGB or 32bpp RGBA
+ * @param wide true for uint64_t bits (bit depth > 32)
+ * @param order pixel order of the panel
+ * @param ports number of output ports (1-3), only these are read
+ * @param stride bytes per pixel (3 or 4)
  */
-__attribute__((hot))
-void update_bcm_signal_32_bgr(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint32_t *bits_red = (const uint32_t*)void_bits;
-    const uint32_t *bits_green = bits_red+256;
-    const uint32_t *bits_blue = bits_red+512;
-
-    // offset to the Port0 top pixel image
-    //uint32_t img_idx = offset;
-    // offset from top pixel to lower pixel in image data.
-    static uint32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16.
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint32_t mask = 1 << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits_red[image[0]] & mask)) << ADDRESS_P0_B1 |
-            (!!(bits_green[image[1]] & mask)) << ADDRESS_P0_G1 |
-            (!!(bits_blue[image[2]] & mask)) << ADDRESS_P0_R1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits_red[image[p0b+0]] & mask)) << ADDRESS_P0_B2 |
-            (!!(bits_green[image[p0b+1]] & mask)) << ADDRESS_P0_G2 |
-            (!!(bits_blue[image[p0b+2]] & mask)) << ADDRESS_P0_R2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1t+0]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits_green[image[p1t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits_blue[image[p1t+2]] & mask)) << ADDRESS_P1_R1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1b+0]] & mask)) << ADDRESS_P1_B2 |
-            (!!(bits_green[image[p1b+1]] & mask)) << ADDRESS_P1_G2 |
-            (!!(bits_blue[image[p1b+2]] & mask)) << ADDRESS_P1_R2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2t+0]] & mask)) << ADDRESS_P2_B1 |
-            (!!(bits_green[image[p2t+1]] & mask)) << ADDRESS_P2_G1 |
-            (!!(bits_blue[image[p2t+2]] & mask)) << ADDRESS_P2_R1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2b+0]] & mask)) << ADDRESS_P2_B2 |
-            (!!(bits_green[image[p2b+1]] & mask)) << ADDRESS_P2_G2 |
-            (!!(bits_blue[image[p2b+2]] & mask)) << ADDRESS_P2_R2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
-}
-
-
-__attribute__((hot))
-void update_bcm_signal_dither_32_rgb(
+__attribute__((always_inline))
+static inline void encode_row_scalar(
     const scene_info *scene,
-    const void *__restrict__ void_bits,
+    const void *__restrict__ bits,
     uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint32_t *bits_red = (const uint32_t*)void_bits;
-    const uint32_t *bits_green = &bits_red[256];
-    const uint32_t *bits_blue = &bits_red[512];
-
-    // offset to the Port0 top pixel image
-    //uint32_t img_idx = offset;
-    // offset from top pixel to lower pixel in image data. 
-    static uint32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint32_t mask = 1 << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits_red[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits_green[image[1]] & mask)) << ADDRESS_P0_G1 |
-            (!!(bits_blue[image[2]] & mask)) << ADDRESS_P0_B1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits_red[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits_green[image[p0b+1]] & mask)) << ADDRESS_P0_G2 |
-            (!!(bits_blue[image[p0b+2]] & mask)) << ADDRESS_P0_B2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits_green[image[p1t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits_blue[image[p1t+2]] & mask)) << ADDRESS_P1_B1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits_green[image[p1b+1]] & mask)) << ADDRESS_P1_G2 |
-            (!!(bits_blue[image[p1b+2]] & mask)) << ADDRESS_P1_B2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2t+0]] & mask)) << ADDRESS_P2_R1 |
-            (!!(bits_green[image[p2t+1]] & mask)) << ADDRESS_P2_G1 |
-            (!!(bits_blue[image[p2t+2]] & mask)) << ADDRESS_P2_B1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits_green[image[p2b+1]] & mask)) << ADDRESS_P2_G2 |
-            (!!(bits_blue[image[p2b+2]] & mask)) << ADDRESS_P2_B2;
+    const uint8_t *__restrict__ image,
+    const bool wide,
+    const enum pixel_order_e order,
+    const uint8_t ports,
+    const uint8_t stride) {
+
+    // offset from each port / half panel to the next in the image. ports are stacked vertically
+    const uint32_t panel_stride = scene->geometry.width * scene->geometry.half_height * stride;
+    const uint32_t plane_words  = scene->geometry.plane_words;
+    const uint8_t  bit_depth    = scene->bit_depth;
+    const uint32_t *bits32      = (const uint32_t*)bits;
+    const uint64_t *bits64      = (const uint64_t*)bits;
+
+    for (uint16_t x=0; x < scene->geometry.width; x++) {
+        // tone mapped bcm word of every input: [port][top/bottom][byte]
+        uint64_t words[3][2][3];
+        for (uint8_t port=0; port < ports; port++) {
+            for (uint8_t half=0; half < 2; half++) {
+                for (uint8_t byte=0; byte < 3; byte++) {
+                    const uint8_t value = image[((port * 2 + half) * panel_stride) + byte];
+                    // byte 0 uses the red table (0-255), byte 1 green (256-511), byte 2 blue (512-767)
+                    words[port][half][byte] = (wide) ? bits64[(byte * 256) + value] : bits32[(byte * 256) + value];
+                }
+            }
+        }
 
+        uint32_t *out = bcm_signal + x;
+        for (uint8_t j=0; j < bit_depth; j++) {
+            uint32_t plane = 0;
+            for (uint8_t port=0; port < ports; port++) {
+                for (uint8_t half=0; half < 2; half++) {
+                    for (uint8_t byte=0; byte < 3; byte++) {
+                        plane |= (uint32_t)((words[port][half][byte] >> j) & 1) << pixel_pin(port, half, byte, order);
+                    }
+                }
+            }
+            out[j * plane_words] = plane;
+        }
+        image += stride;
     }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
 }
 
-
-
-__attribute__((hot))
-void update_bcm_signal_dither_32_rbg(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint32_t *bits_red = (const uint32_t*)void_bits;
-    const uint32_t *bits_green = &bits_red[256];
-    const uint32_t *bits_blue = &bits_red[512];
-
-    // offset to the Port0 top pixel image
-    //uint32_t img_idx = offset;
-    // offset from top pixel to lower pixel in image data. 
-    static uint32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint32_t mask = 1 << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits_red[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits_green[image[1]] & mask)) << ADDRESS_P0_B1 |
-            (!!(bits_blue[image[2]] & mask)) << ADDRESS_P0_G1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits_red[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits_green[image[p0b+1]] & mask)) << ADDRESS_P0_B2 |
-            (!!(bits_blue[image[p0b+2]] & mask)) << ADDRESS_P0_G2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits_green[image[p1t+1]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits_blue[image[p1t+2]] & mask)) << ADDRESS_P1_G1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits_red[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits_green[image[p1b+1]] & mask)) << ADDRESS_P1_B2 |
-            (!!(bits_blue[image[p1b+2]] & mask)) << ADDRESS_P1_G2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2t+0]] & mask)) << ADDRESS_P2_R1 |
-            (!!(bits_green[image[p2t+1]] & mask)) << ADDRESS_P2_B1 |
-            (!!(bits_blue[image[p2t+2]] & mask)) << ADDRESS_P2_G1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits_red[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits_green[image[p2b+1]] & mask)) << ADDRESS_P2_B2 |
-            (!!(bits_blue[image[p2b+2]] & mask)) << ADDRESS_P2_G2;
-
+// one specialization for every bit depth class (32: uint32_t bits, 64: uint64_t bits), pixel order, port count and stride
+#define ENCODER(depth, order, ports, stride) \
+    __attribute__((hot)) \
+    static void encode_row_##depth##_##order##_p##ports##_s##stride(const scene_info *scene, const struct bcm_pin_table *table, \
+        const void *bits, uint32_t *bcm_signal, const uint8_t *image, struct bcm_encode_scratch *scratch) { \
+        (void)table; (void)scratch; \
+        encode_row_scalar(scene, bits, bcm_signal, image, (depth) == 64, PIXEL_ORDER_##order, ports, stride); \
     }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
-}
-
 
-__attribute__((hot))
-void update_bcm_signal_64_rgb(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint64_t *bits = (const uint64_t*)void_bits;
-    // offset from top pixel to lower pixel in image data. 
-    static int32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
+#define ENCODER_STRIDES(depth, order, ports) ENCODER(depth, order, ports, 3) ENCODER(depth, order, ports, 4)
+#define ENCODER_PORTS(depth, order) ENCODER_STRIDES(depth, order, 1) ENCODER_STRIDES(depth, order, 2) ENCODER_STRIDES(depth, order, 3)
+#define ENCODER_ORDERS(depth) ENCODER_PORTS(depth, RGB) ENCODER_PORTS(depth, RBG) ENCODER_PORTS(depth, BGR)
+
+ENCODER_ORDERS(32)
+ENCODER_ORDERS(64)
+
+#define ENCODER_NAME(depth, order, ports, stride) encode_row_##depth##_##order##_p##ports##_s##stride
+#define ENCODER_ENTRY_PORTS(depth, order, ports) {ENCODER_NAME(depth, order, ports, 3), ENCODER_NAME(depth, order, ports, 4)}
+#define ENCODER_ENTRY_ORDER(depth, order) { \
+    ENCODER_ENTRY_PORTS(depth, order, 1), ENCODER_ENTRY_PORTS(depth, order, 2), ENCODER_ENTRY_PORTS(depth, order, 3) }
+
+/** @brief scalar encoders indexed by [bit depth > 32][pixel order][ports - 1][stride == 4] */
+static const func_bcm_encoder_t scalar_encoders[2][3][3][2] = {
+    {
+        [PIXEL_ORDER_RGB] = ENCODER_ENTRY_ORDER(32, RGB),
+        [PIXEL_ORDER_RBG] = ENCODER_ENTRY_ORDER(32, RBG),
+        [PIXEL_ORDER_BGR] = ENCODER_ENTRY_ORDER(32, BGR)
+    },
+    {
+        [PIXEL_ORDER_RGB] = ENCODER_ENTRY_ORDER(64, RGB),
+        [PIXEL_ORDER_RBG] = ENCODER_ENTRY_ORDER(64, RBG),
+        [PIXEL_ORDER_BGR] = ENCODER_ENTRY_ORDER(64, BGR)
     }
+};
 
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint64_t mask = 1ULL << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits[image[1]] & mask)) << ADDRESS_P0_G1 |
-            (!!(bits[image[2]] & mask)) << ADDRESS_P0_B1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits[image[p0b+1]] & mask)) << ADDRESS_P0_G2 |
-            (!!(bits[image[p0b+2]] & mask)) << ADDRESS_P0_B2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits[image[p1t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits[image[p1t+2]] & mask)) << ADDRESS_P1_B1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits[image[p1b+1]] & mask)) << ADDRESS_P1_G2 |
-            (!!(bits[image[p1b+2]] & mask)) << ADDRESS_P1_B2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits[image[p2t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits[image[p2t+2]] & mask)) << ADDRESS_P1_B1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits[image[p2b+1]] & mask)) << ADDRESS_P2_G2 |
-            (!!(bits[image[p2b+2]] & mask)) << ADDRESS_P2_B2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
+func_bcm_encoder_t bcm_scalar_encoder(const scene_info *scene) {
+    ASSERT(scene->num_ports >= 1 && scene->num_ports <= 3);
+    ASSERT(scene->stride == 3 || scene->stride == 4);
+    return scalar_encoders[scene->bit_depth > 32][scene->pixel_order][scene->num_ports - 1][scene->stride == 4];
 }
 
-
-__attribute__((hot))
-void update_bcm_signal_64_rbg(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint64_t *bits = (const uint64_t*)void_bits;
-    // offset from top pixel to lower pixel in image data. 
-    static int32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16. 
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint64_t mask = 1ULL << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits[image[0]] & mask)) << ADDRESS_P0_R1 |
-            (!!(bits[image[1]] & mask)) << ADDRESS_P0_B1 |
-            (!!(bits[image[2]] & mask)) << ADDRESS_P0_G1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits[image[p0b+0]] & mask)) << ADDRESS_P0_R2 |
-            (!!(bits[image[p0b+1]] & mask)) << ADDRESS_P0_B2 |
-            (!!(bits[image[p0b+2]] & mask)) << ADDRESS_P0_G2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits[image[p1t+1]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits[image[p1t+2]] & mask)) << ADDRESS_P1_G1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1b+0]] & mask)) << ADDRESS_P1_R2 |
-            (!!(bits[image[p1b+1]] & mask)) << ADDRESS_P1_B2 |
-            (!!(bits[image[p1b+2]] & mask)) << ADDRESS_P1_G2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2t+0]] & mask)) << ADDRESS_P1_R1 |
-            (!!(bits[image[p2t+1]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits[image[p2t+2]] & mask)) << ADDRESS_P1_G1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2b+0]] & mask)) << ADDRESS_P2_R2 |
-            (!!(bits[image[p2b+1]] & mask)) << ADDRESS_P2_B2 |
-            (!!(bits[image[p2b+2]] & mask)) << ADDRESS_P2_G2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
+/**
+ * @brief pack everything the encoder is specialized on, so the mapper can spot a stale encoder
+ */
+static inline uint16_t encoder_config(const scene_info *scene) {
+    return (scene->bit_depth > 32) | (scene->pixel_order << 1) | (scene->num_ports << 3) | (scene->stride << 6);
 }
 
-
-__attribute__((hot))
-void update_bcm_signal_64_bgr(
-    const scene_info *scene,
-    const void *__restrict__ void_bits,
-    uint32_t *__restrict__ bcm_signal,
-    const uint8_t *__restrict__ image) {
-
-    const uint64_t *bits = (const uint64_t*)void_bits;
-    // offset from top pixel to lower pixel in image data.
-    static int32_t panel_stride = 0;
-    // offsets for each pixel on each port
-    static uint32_t p0t = 0, p0b = 0, p1t = 0, p1b = 0, p2t = 0, p2b =0;
-
-    // calculate the image index to all 3 ports. we only need to do this once ever
-    if (UNLIKELY(panel_stride == 0)) {
-        panel_stride = scene->width * (scene->panel_height / 2) * scene->stride;
-        p0b = p0t + panel_stride;
-        p1t = p0b + panel_stride;
-        p1b = p1t + panel_stride;
-        p2t = p1b + panel_stride;
-        p2b = p2t + panel_stride;
-    }
-
-
-    // inform compiler that bit depth is aligned, improves compiler optimization
-    // BIT_DEPTH_ALIGNMENT should be multiple of 4, ideally 16.
-    uint8_t bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
-
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(bit_depth <= 32);
-
-    uint8_t bcm_offset = 0;
-    for (int j=0; j<bit_depth; j++) {
-        // mask off just this bit plane's data
-        const uint64_t mask = 1ULL << j;
-
-        // this works by first finding the index into the red byte (+0) of the 24bpp source image
-        // looking up the bcm bit mask value at that red color value (128 = 1010101010101..), logical AND with
-        // the current bit position we are calculating (1<<j) and then shifting that bit (0 or 1) to the correct pin (ADDRESS_Px_CX)
-        // and logical OR that value for the current bcm_signal offset.
-        // repeat this for green (+1), blue (+2), and once for each pixel on each port
-
-        // !! - first ! turns 00100000 into 0000000, second ! turns 000000 into 00000001
-        // !! - first ! turns 00000000 into 0000001, second ! turns 000001 into 00000000
-        // this way we get a 1 value for the mask of the (bcm_bits & mask) so we can << the correct number of bits
-
-        bcm_signal[bcm_offset++] =
-            // PORT 0, top pixel
-            (!!(bits[image[0]] & mask)) << ADDRESS_P0_B1 |
-            (!!(bits[image[1]] & mask)) << ADDRESS_P0_G1 |
-            (!!(bits[image[2]] & mask)) << ADDRESS_P0_R1 |
-
-            // PORT 0, bottom pixel
-            (!!(bits[image[p0b+0]] & mask)) << ADDRESS_P0_B2 |
-            (!!(bits[image[p0b+1]] & mask)) << ADDRESS_P0_G2 |
-            (!!(bits[image[p0b+2]] & mask)) << ADDRESS_P0_R2 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1t+0]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits[image[p1t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits[image[p1t+2]] & mask)) << ADDRESS_P1_R1 |
-
-            // PORT 1, bottom pixel
-            (!!(bits[image[p1b+0]] & mask)) << ADDRESS_P1_B2 |
-            (!!(bits[image[p1b+1]] & mask)) << ADDRESS_P1_G2 |
-            (!!(bits[image[p1b+2]] & mask)) << ADDRESS_P1_R2 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2t+0]] & mask)) << ADDRESS_P1_B1 |
-            (!!(bits[image[p2t+1]] & mask)) << ADDRESS_P1_G1 |
-            (!!(bits[image[p2t+2]] & mask)) << ADDRESS_P1_R1 |
-
-            // PORT 2, bottom pixel
-            (!!(bits[image[p2b+0]] & mask)) << ADDRESS_P2_B2 |
-            (!!(bits[image[p2b+1]] & mask)) << ADDRESS_P2_G2 |
-            (!!(bits[image[p2b+2]] & mask)) << ADDRESS_P2_R2;
-
-    }
-    // bcm_signal is now bit mask of length bit_depth for these 6 pixels that can be iterated through to light
-    // the LEDS to the correct brightness levels
+void bcm_select_encoder(scene_info *scene) {
+    scene->bcm_encoder_config = encoder_config(scene);
+    func_bcm_encoder_t simd_encoder = (USE_SIMD_ENCODER) ? bcm_simd_encoder(scene) : NULL;
+    scene->bcm_encoder = (simd_encoder != NULL) ? simd_encoder : bcm_scalar_encoder(scene);
 }
 
 
@@ -1267,7 +727,13 @@ void *tone_map_rgb_bits(const scene_info *scene, const int num_bits, float *quan
 
 
 
-        if (num_bits > 32 && num_bits <= 64) {
+        if (scene->bcm_mode == BCM_MODE_BINARY) {
+            // brightness is always part of the bcm data, the binary scan out has no OE jitter
+            const Normal level = normalize8(scene->brightness);
+            bits32[i]     = normal_to_bcm_binary(tone_pixel.r * level, num_bits);
+            bits32[i+256] = normal_to_bcm_binary(tone_pixel.g * level, num_bits);
+            bits32[i+512] = normal_to_bcm_binary(tone_pixel.b * level, num_bits);
+        } else if (num_bits > 32 && num_bits <= 64) {
             bits64[i]     = byte_to_bcm64(MIN(tone_pixel.r * brightness, 255), scene->bit_depth);
             bits64[i+256] = byte_to_bcm64(MIN(tone_pixel.g * brightness, 255), scene->bit_depth);
             bits64[i+512] = byte_to_bcm64(MIN(tone_pixel.b * brightness, 255), scene->bit_depth);
@@ -1289,32 +755,249 @@ void *tone_map_rgb_bits(const scene_info *scene, const int num_bits, float *quan
 
 
 
+
 /**
- * @brief this function takes the image data and maps it to the bcm signal.
+ * @brief turn rows [first_row, last_row) of every plane of an encoded bcm buffer into a pre-baked
+ * GPIO word stream for render_stream_planes. the bcm buffer is already in scan out order, the row
+ * address and OE are merged into every word in place. OE follows the OE sequence (see OE_SEQUENCE_STEP)
+ * as if the scan out stepped it once per word of the stream, for brightness / 255 on clocks.
  * 
- * if scene->tone_mapper is updated, new bcm bit masks will be created.
+ * @param scene the scene information
+ * @param stream the encoded bcm buffer
+ * @param first_row first row to bake
+ * @param last_row one past the last row to bake
+ */
+__attribute__((hot))
+static void prebake_rows(const scene_info *scene, uint32_t *restrict stream, const uint16_t first_row, const uint16_t last_row) {
+    const bcm_geometry *geometry = &scene->geometry;
+
+    for (uint8_t j=0; j < geometry->bit_depth; j++) {
+        for (uint16_t y=first_row; y < last_row; y++) {
+            const uint32_t row_start = (j * geometry->plane_words) + (y * geometry->row_words);
+            uint32_t *restrict row   = stream + row_start;
+            const uint32_t address   = geometry->address[y];
+
+            if (scene->jitter_brightness) {
+                // the sequence runs continuously through the whole stream, so every row can start at its own offset
+                const uint32_t oe_on = oe_threshold(scene->brightness);
+                uint32_t oe_phase    = row_start * OE_SEQUENCE_STEP;
+                for (uint16_t x=0; x < geometry->width; x++) {
+                    row[x]   |= address | ((oe_phase >= oe_on) ? PIN_OE : 0);
+                    oe_phase += OE_SEQUENCE_STEP;
+                }
+            } else {
+                for (uint16_t x=0; x < geometry->width; x++) {
+                    row[x] |= address;
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief turn rows [first_row, last_row) of every plane into GPIO SET / CLR register pairs for
+ * the pi4 backend, see bcm_geometry. the encoder wrote one pin mask per pixel to the start of
+ * the row, they are expanded in place from the end so no mask is overwritten before it is read.
+ * the first pixel of a row sets every color pin, so rows never depend on what was shifted before.
  * 
  * @param scene the scene information
- * @param image the image to map to the scene bcm data. if NULL scene->image will be used
+ * @param stream the encoded bcm buffer
+ * @param first_row first row to expand
+ * @param last_row one past the last row to expand
+ * @param color_pins every color pin of the configured ports
  */
 __attribute__((hot))
-void map_byte_image_to_bcm(scene_info *scene, uint8_t *image) {
+static void pair_rows(const scene_info *scene, uint32_t *restrict stream, const uint16_t first_row, const uint16_t last_row,
+    const uint32_t color_pins) {
+    const bcm_geometry *geometry = &scene->geometry;
+
+    for (uint8_t j=0; j < geometry->bit_depth; j++) {
+        for (uint16_t y=first_row; y < last_row; y++) {
+            uint32_t *restrict row = stream + (j * geometry->plane_words) + (y * geometry->row_words);
+            uint32_t *restrict pixels = row + geometry->pixel_offset;
+
+            for (uint16_t x=geometry->width - 1; x > 0; x--) {
+                const uint32_t mask = pixels[x];
+                const uint32_t last = pixels[x - 1];
+                pixels[(x * 2) + 1] = mask & ~last;
+                pixels[x * 2]       = (~mask & last) | PIN_CLK;
+            }
+            const uint32_t mask = pixels[0];
+            pixels[1] = mask;
+            pixels[0] = (~mask & color_pins) | PIN_CLK;
+
+            // address lines, row 0 follows the last row of the previous plane
+            const uint32_t address = geometry->address[y];
+            const uint32_t last    = geometry->address[(y == 0) ? geometry->half_height - 1 : y - 1];
+            row[0] = address & ~last;
+            row[1] = ~address & last;
+        }
+    }
+}
+
+
+/**
+ * @brief everything an encode thread needs to encode its rows of a frame
+ */
+typedef struct {
+    const scene_info     *scene;
+    const void           *bits;
+    bcm_pin_table         pin_table;
+    func_bcm_encoder_t    encoder;
+    uint32_t              color_pins;
+    uint32_t             *bcm_signal;
+    const uint8_t        *image;
+
+    // incremental encoding, see scene->skip_unchanged. NULL hashes encode every row
+    uint64_t             *back_hash;
+    const uint64_t       *last_hash;
+    const uint32_t       *last_signal;
+} bcm_encode_job;
+
+/**
+ * @brief hash len bytes (a multiple of 8) into h. 8 bytes at a time with a multiply
+ * and xor shift mix, plenty to spot a changed pixel
+ */
+__attribute__((hot))
+static inline uint64_t hash_bytes(uint64_t h, const uint8_t *restrict data, const uint32_t len) {
+    for (uint32_t i=0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h  = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/**
+ * @brief pool_job_fn hashing the image rows that feed rows [first_row, last_row) of the bcm buffer.
+ * that is the top and bottom pixel row of every port. never returns 0 so 0 can mean unknown
+ */
+__attribute__((hot))
+static void hash_rows(void *arg, void *scratch, const uint16_t first_row, const uint16_t last_row) {
+    (void)scratch;
+    const bcm_encode_job *job = (const bcm_encode_job*)arg;
+    const scene_info *scene   = job->scene;
+    const uint32_t row_stride = scene->geometry.width * scene->stride;
+    const uint32_t half_panel = row_stride * scene->geometry.half_height;
+    const uint8_t  num_halves = MIN(scene->num_ports, 3) * 2;
+
+    for (uint16_t y=first_row; y < last_row; y++) {
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for (uint8_t half=0; half < num_halves; half++) {
+            h = hash_bytes(h, job->image + (half * half_panel) + (y * row_stride), row_stride);
+        }
+        scene->image_hash[y] = h | 1;
+    }
+}
+
+/**
+ * @brief encode image row y to all bit planes of the back buffer
+ */
+__attribute__((hot, always_inline))
+static inline void encode_row_planes(const bcm_encode_job *job, void *scratch, const uint16_t y) {
+    const scene_info *scene   = job->scene;
+    const uint32_t row_stride = scene->geometry.width * scene->stride;
+
+    // every bit plane of the row at once with the encoder selected for this scene configuration
+    job->encoder(scene, &job->pin_table, job->bits,
+        job->bcm_signal + (y * scene->geometry.row_words) + scene->geometry.pixel_offset,
+        job->image + (y * row_stride), (bcm_encode_scratch*)scratch);
+
+    if (scene->prebaked_stream) {
+        prebake_rows(scene, job->bcm_signal, y, y + 1);
+    } else if (scene->set_clr_pairs) {
+        pair_rows(scene, job->bcm_signal, y, y + 1, job->color_pins);
+    }
+}
+
+/**
+ * @brief pool_job_fn encoding rows [first_row, last_row) of the frame to all bit planes.
+ * rows are independent in the plane major layout, so threads never write the same cache line.
+ * with row hashes, rows the back buffer already holds are skipped and rows the last
+ * published frame holds are copied from it
+ */
+__attribute__((hot))
+static void encode_rows(void *arg, void *scratch, const uint16_t first_row, const uint16_t last_row) {
+    const bcm_encode_job *job    = (const bcm_encode_job*)arg;
+    const scene_info *scene      = job->scene;
+    const bcm_geometry *geometry = &scene->geometry;
+
+    if (job->back_hash == NULL) {
+        for (uint16_t y=first_row; y < last_row; y++) {
+            encode_row_planes(job, scratch, y);
+        }
+        return;
+    }
+
+    for (uint16_t y=first_row; y < last_row; y++) {
+        const uint64_t hash = scene->image_hash[y];
+        if (job->back_hash[y] == hash) {
+            continue;
+        }
+        if (job->last_hash[y] == hash) {
+            // the last frame has this row already encoded (and baked), copy every plane of it
+            const uint32_t row_start = y * geometry->row_words;
+            for (uint8_t j=0; j < geometry->bit_depth; j++) {
+                const uint32_t offset = (j * geometry->plane_words) + row_start;
+                memcpy(job->bcm_signal + offset, job->last_signal + offset, geometry->row_words * sizeof(uint32_t));
+            }
+        } else {
+            encode_row_planes(job, scratch, y);
+        }
+        job->back_hash[y] = hash;
+    }
+}
+
+
+/**
+ * @brief scene settings the encoded bcm words depend on besides the image.
+ * if any of them change the row hashes no longer describe the buffers
+ */
+typedef struct {
+    const void        *bits;
+    uint32_t           lut_generation;
+    uint8_t            brightness;
+    enum pixel_order_e pixel_order;
+    uint8_t            num_ports;
+    bool               prebaked_stream;
+    bool               jitter_brightness;
+} encode_key;
 
-    // tone map the bits for the current scene, update if the lookup table if scene tone mapping changes....
+
+/**
+ * @brief number of threads to encode with. scene->encode_threads, or if 0 one for every
+ * cpu except the scan out cpu
+ */
+static uint8_t encode_thread_count(const scene_info *scene) {
+    if (scene->encode_threads > 0) {
+        return MIN(scene->encode_threads, MAX_ENCODE_THREADS);
+    }
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (uint8_t)MAX(1, MIN(num_cpus - 1, MAX_ENCODE_THREADS));
+}
+
+
+/**
+ * @brief the tone mapped rgb to bcm lookup table for the scene, see tone_map_rgb_bits().
+ * rebuilt when scene->tone_mapper, bcm_mode, bit_depth or the brightness in the table changes
+ */
+const void *bcm_tone_lut(const scene_info *scene, uint32_t *generation) {
     static void *bits = NULL;
     static float *quant_errors = NULL;
-    static float *dither_map = NULL;
     static func_tone_mapper_t last_tone_map = NULL;
-    update_bcm_signal_fn update_bcm_signal = NULL;
-
-    if (UNLIKELY(bits == NULL || last_tone_map != scene->tone_mapper)) {
+    static enum bcm_mode_e last_bcm_mode = BCM_MODE_PWM;
+    static uint8_t last_bit_depth = 0;
+    static uint8_t last_brightness = 0;
+    static uint32_t lut_generation = 0;
+
+    // brightness is in the LUT unless the PWM scan out applies it with OE, see tone_map_rgb_bits
+    const uint8_t brightness = (scene->jitter_brightness && scene->bcm_mode != BCM_MODE_BINARY) ? 255 : scene->brightness;
+    if (UNLIKELY(bits == NULL || last_tone_map != scene->tone_mapper || last_bcm_mode != scene->bcm_mode ||
+        last_bit_depth != scene->bit_depth || last_brightness != brightness)) {
         if (quant_errors == NULL) {
             quant_errors = (float*)malloc(768 * sizeof(float));
-            dither_map = (float*)malloc(scene->width * scene->height * scene->stride * sizeof(float));
-
-            for (int i=0; i<scene->width * scene->height * scene->stride; i++) {
-                dither_map[i] = ((rand() / (float)RAND_MAX) - (rand() / (float)RAND_MAX)) * scene->dither;
-            }
         }
         if (bits != NULL) { // don't leak memory!
             free(bits);
@@ -1325,8 +1008,44 @@ void map_byte_image_to_bcm(scene_info *scene, uint8_t *image) {
             bits = (uint32_t*)tone_map_rgb_bits(scene, scene->bit_depth, quant_errors);
         }
         last_tone_map = scene->tone_mapper;
+        last_bcm_mode = scene->bcm_mode;
+        last_bit_depth = scene->bit_depth;
+        last_brightness = brightness;
+        lut_generation++;
     }
 
+    if (generation != NULL) {
+        *generation = lut_generation;
+    }
+    return bits;
+}
+
+/**
+ * @brief this function takes the image data and maps it to the bcm signal.
+ * 
+ * if scene->tone_mapper is updated, new bcm bit masks will be created.
+ * if scene->prebaked_stream is set the output is a GPIO word stream, see prebake_rows
+ * the rows are split over scene->encode_threads threads, see encode_pool
+ * 
+ * @param scene the scene information
+ * @param image the image to map to the scene bcm data. if NULL scene->image will be used
+ */
+__attribute__((hot))
+void map_byte_image_to_bcm(scene_info *scene, uint8_t *image) {
+
+    static float *dither_map = NULL;
+    static encode_key last_key;
+
+    // check_scene() selects the encoder. this covers scenes that were never checked, or that
+    // changed stride (rgb / rgba source) or pixel order after the check
+    if (UNLIKELY(scene->bcm_encoder == NULL || scene->bcm_encoder_config != encoder_config(scene))) {
+        bcm_select_encoder(scene);
+    }
+
+    // tone map the bits for the current scene, the lookup table is rebuilt if scene tone mapping changes....
+    uint32_t lut_generation;
+    const void *bits = bcm_tone_lut(scene, &lut_generation);
+
     // select our image source
     uint8_t *base_ptr  = (image == NULL) ? scene->image : image;
     uint8_t *image_ptr = base_ptr;
@@ -1339,64 +1058,38 @@ void map_byte_image_to_bcm(scene_info *scene, uint8_t *image) {
     }
 
 
-    // use the correct bcm_signal mapper, 32 or 64 bit
-    if (scene->bit_depth > 32) {
-        switch (scene->pixel_order) {
-        case PIXEL_ORDER_RGB:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_64_rgb;
-            break;
-        case PIXEL_ORDER_RBG:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_64_rbg;
-            break;
-        case PIXEL_ORDER_BGR:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_64_bgr;
-            break;
-        }
-    } else {
-        switch (scene->pixel_order) {
-        case PIXEL_ORDER_RGB:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_32_rgb;
-            break;
-        case PIXEL_ORDER_RBG:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_32_rbg;
-            break;
-        case PIXEL_ORDER_BGR:
-            update_bcm_signal = (update_bcm_signal_fn)update_bcm_signal_32_bgr;
-            break;
-        }
-    }
-    ASSERT(update_bcm_signal);
-
     ASSERT(scene->panel_height % 16 == 0);
     ASSERT(scene->panel_width % 16 == 0);
     // pwm_stride is the row length in bytes of the pwm output data
     //uint32_t pwm_stride __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->width * scene->bit_depth;
     // const uint32_t pwm_stride = scene->width * scene->bit_depth;
     // half_height is 1/2 the panel height. since we clock in 2 pixels at a time, 
-    // we only need to process half the rows
-    const uint8_t  half_height __attribute__((aligned(16))) = scene->panel_height / 2;
+    // we only need to process half the rows (fewer on multiplexed panels, see scan.h)
+    const uint8_t  half_height __attribute__((aligned(16))) = scene->geometry.half_height;
     // ensure 16 bit alignment for width
     const uint16_t width __attribute__((aligned(32))) = scene->width;
 
     // ensure alignment for the compiler to optimize these loops
     ASSERT(scene->bit_depth % BIT_DEPTH_ALIGNMENT == 0);
-    ASSERT(half_height % 16 == 0);
     ASSERT(pwm_stride % BIT_DEPTH_ALIGNMENT == 0);
     ASSERT(width % 32 == 0);                        // Ensure length is a multiple of 32
 
     // which buffer we are rendering to
-    uint32_t *bcm_signal = (scene->bcm_ptr)
-        ? (scene->bcm_signalA)
-        : (scene->bcm_signalB);
+    uint32_t *bcm_signal = bcm_back_buffer(scene);
 
     // convenience variables
     const uint16_t stride     = scene->stride;
-    const uint8_t  bit_depth  = scene->bit_depth;
     //const uint16_t height     = scene->height;
     const uint16_t row_stride = width * stride;
 
 
     if (scene->dither > 0.1f) {
+        if (UNLIKELY(dither_map == NULL)) {
+            dither_map = (float*)malloc(scene->width * scene->height * scene->stride * sizeof(float));
+            for (int i=0; i<scene->width * scene->height * scene->stride; i++) {
+                dither_map[i] = ((rand() / (float)RAND_MAX) - (rand() / (float)RAND_MAX)) * scene->dither;
+            }
+        }
         float *dither_ptr     = dither_map;
         const uint16_t width  = scene->width;
         const uint16_t height = scene->height;
@@ -1417,23 +1110,68 @@ void map_byte_image_to_bcm(scene_info *scene, uint8_t *image) {
 
     image_ptr = (image == NULL) ? scene->image : image;
 
-    for (uint16_t y=0; y < half_height; y ++) {
-        // for clarity: calculate the offset into the PWM buffer for the first pixel in this row
-        //unsigned int pwm_offset = y * pwm_stride;
+    // multiplexed panels shift several image rows per address, put the pixels in shift order
+    if (scene->scan_gather != NULL) {
+        scan_gather_image(scene, image_ptr, scene->scan_image);
+        image_ptr = scene->scan_image;
+    }
 
-        for (uint16_t x=0; x < width; x++) {
+    if (UNLIKELY(scene->encode_pool == NULL)) {
+        scene->encode_pool = encode_pool_create(encode_thread_count(scene), sizeof(bcm_encode_scratch), scene->scanout_cpu);
+        // whoever feeds the mapper is the frame source, keep it off the scan out cpu too
+        realtime_place_thread(scene, pthread_self(), THREAD_SOURCE);
+    }
 
-            // create the bcm signal for the current pixel, 
-            // writes bit_depth *(sizeof(uint32_t)) bytes to bcm_signal
-            update_bcm_signal(scene, bits, bcm_signal, image_ptr);
+    bcm_encode_job job = {
+        .scene             = scene,
+        .bits              = bits,
+        .encoder           = scene->bcm_encoder,
+        .bcm_signal        = bcm_signal,
+        .image             = image_ptr
+    };
+    bcm_pin_table_init(&job.pin_table, scene);
+    for (uint8_t k=0; k < job.pin_table.count; k++) {
+        job.color_pins |= 1U << job.pin_table.pin[k];
+    }
 
-            bcm_signal += bit_depth + 1;
-            image_ptr += stride;
+    if (scene->skip_unchanged) {
+        // anything that changes the encoded words, other than the image, makes every row hash stale
+        // memset so the padding compares equal too
+        encode_key key;
+        memset(&key, 0, sizeof(key));
+        key.bits              = bits;
+        key.lut_generation    = lut_generation;
+        key.brightness        = scene->brightness;
+        key.pixel_order       = scene->pixel_order;
+        key.num_ports         = scene->num_ports;
+        key.prebaked_stream   = scene->prebaked_stream;
+        key.jitter_brightness = scene->jitter_brightness;
+        if (UNLIKELY(memcmp(&key, &last_key, sizeof(key)) != 0)) {
+            for (int i=0; i<3; i++) {
+                memset(scene->row_hash[i], 0, half_height * sizeof(uint64_t));
+            }
+            last_key = key;
         }
+
+        encode_pool_run(scene->encode_pool, hash_rows, &job, half_height);
+
+        // whole frame dedup, the panel already shows (or is about to show) exactly this frame
+        const uint64_t *last_hash = scene->row_hash[scene->bcm_last];
+        if (memcmp(scene->image_hash, last_hash, half_height * sizeof(uint64_t)) == 0) {
+            atomic_fetch_add_explicit(&scene->frames_unchanged, 1, memory_order_relaxed);
+            return;
+        }
+
+        job.back_hash   = scene->row_hash[scene->bcm_back];
+        job.last_hash   = last_hash;
+        job.last_signal = scene->bcm_signal[scene->bcm_last];
     }
 
-    // flip the double buffer. render_forever will detect this on next vsync and switch the buffers
-    scene->bcm_ptr = !scene->bcm_ptr;
+    // returns after every row is written, so the frame can be published
+    encode_pool_run(scene->encode_pool, encode_rows, &job, half_height);
+
+    // hand the frame to render_forever, it will switch to it on the next vsync
+    bcm_publish(scene);
 }
 
 
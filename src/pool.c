@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+/**
+ * persistent worker pool for bcm encoding.
+ *
+ * the workers are started once and wait on a barrier between frames, so there is no
+ * thread creation per frame. every frame the rows are split in equal contiguous slices,
+ * the caller encodes slice 0 itself and the second barrier guarantees every slice is
+ * written before the caller publishes the buffer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "pool.h"
+#include "realtime.h"
+
+
+typedef struct {
+    encode_pool *pool;
+    uint8_t      index;
+    void        *scratch;
+} pool_worker;
+
+struct encode_pool {
+    pthread_t         threads[MAX_ENCODE_THREADS];
+    pool_worker       workers[MAX_ENCODE_THREADS];
+    uint8_t           num_threads;
+    uint8_t           avoid_cpu;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+
+    // the current job, written by encode_pool_run() before the start barrier
+    pool_job_fn       job;
+    void             *arg;
+    uint16_t          num_rows;
+    bool              exit;
+};
+
+
+/**
+ * @brief run this worker's slice of the current job
+ */
+__attribute__((hot))
+static inline void run_slice(encode_pool *pool, const pool_worker *worker) {
+    const uint16_t first_row = (pool->num_rows * worker->index) / pool->num_threads;
+    const uint16_t last_row  = (pool->num_rows * (worker->index + 1)) / pool->num_threads;
+    if (first_row < last_row) {
+        pool->job(pool->arg, worker->scratch, first_row, last_row);
+    }
+}
+
+static void *pool_thread(void *arg) {
+    pool_worker *worker = (pool_worker*)arg;
+    encode_pool *pool   = worker->pool;
+
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->exit) {
+            break;
+        }
+        run_slice(pool, worker);
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+/**
+ * @brief pin a worker to the nth online cpu that is not the scan out cpu.
+ * with fewer cpus than workers they share, it is only a hint
+ */
+static void pin_worker(pthread_t thread, const uint8_t index, const uint8_t avoid_cpu) {
+    const int cpu = realtime_spare_cpu(index, avoid_cpu);
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset) != 0) {
+        fprintf(stderr, "unable to pin encode thread %d to cpu %d\n", index, cpu);
+    }
+}
+
+encode_pool *encode_pool_create(const uint8_t num_threads, const size_t scratch_size, const uint8_t avoid_cpu) {
+    if (num_threads < 1 || num_threads > MAX_ENCODE_THREADS) {
+        die("encode threads must be 1 - %d, got %d\n", MAX_ENCODE_THREADS, num_threads);
+    }
+
+    encode_pool *pool = (encode_pool*)calloc(1, sizeof(encode_pool));
+    if (pool == NULL) {
+        die("unable to allocate encode pool\n");
+    }
+    pool->num_threads = num_threads;
+    pool->avoid_cpu   = avoid_cpu;
+    pthread_barrier_init(&pool->start, NULL, num_threads);
+    pthread_barrier_init(&pool->done, NULL, num_threads);
+
+    // round the scratch up to whole cache lines so workers never share one
+    const size_t scratch_bytes = (scratch_size + 63) & ~((size_t)63);
+    for (uint8_t i=0; i<num_threads; i++) {
+        pool->workers[i].pool    = pool;
+        pool->workers[i].index   = i;
+        pool->workers[i].scratch = (scratch_bytes > 0) ? aligned_alloc(64, scratch_bytes) : NULL;
+        if (scratch_bytes > 0 && pool->workers[i].scratch == NULL) {
+            die("unable to allocate %zu bytes of encode scratch\n", scratch_bytes);
+        }
+    }
+
+    // worker 0 is the thread calling encode_pool_run()
+    for (uint8_t i=1; i<num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, &pool->workers[i]) != 0) {
+            die("unable to create encode thread %d\n", i);
+        }
+        pin_worker(pool->threads[i], i, pool->avoid_cpu);
+    }
+
+    return pool;
+}
+
+__attribute__((hot))
+void encode_pool_run(encode_pool *pool, pool_job_fn job, void *arg, const uint16_t num_rows) {
+    pool->job      = job;
+    pool->arg      = arg;
+    pool->num_rows = num_rows;
+
+    if (pool->num_threads == 1) {
+        run_slice(pool, &pool->workers[0]);
+        return;
+    }
+
+    // the barriers order the job fields before the workers read them, and the
+    // workers' writes before our return
+    pthread_barrier_wait(&pool->start);
+    run_slice(pool, &pool->workers[0]);
+    pthread_barrier_wait(&pool->done);
+}
+
+uint8_t encode_pool_size(const encode_pool *pool) {
+    return pool->num_threads;
+}
+
+void encode_pool_destroy(encode_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    if (pool->num_threads > 1) {
+        pool->exit = true;
+        pthread_barrier_wait(&pool->start);
+        for (uint8_t i=1; i<pool->num_threads; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+    }
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    for (uint8_t i=0; i<pool->num_threads; i++) {
+        free(pool->workers[i].scratch);
+    }
+    free(pool);
+}
@@ -0,0 +1,213 @@
+/**
+ * preview backend.
+ *
+ * instead of shifting the bcm buffers out it works out what the panel would show: the duty cycle
+ * of every LED from the bit planes of the front buffer, mapped back to the scene image layout.
+ * the image is published in shared memory (HUB_PREVIEW_NAME) PREVIEW_HZ times a second so another
+ * process can show it, and vsync still runs so producers pace themselves as with a panel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "backend.h"
+
+
+// color pins of each port: top half R G B, then bottom half R G B
+static const uint8_t port_pins[3][6] = {
+    {ADDRESS_P0_R1, ADDRESS_P0_G1, ADDRESS_P0_B1, ADDRESS_P0_R2, ADDRESS_P0_G2, ADDRESS_P0_B2},
+    {ADDRESS_P1_R1, ADDRESS_P1_G1, ADDRESS_P1_B1, ADDRESS_P1_R2, ADDRESS_P1_G2, ADDRESS_P1_B2},
+    {ADDRESS_P2_R1, ADDRESS_P2_G1, ADDRESS_P2_B1, ADDRESS_P2_R2, ADDRESS_P2_G2, ADDRESS_P2_B2}
+};
+
+/**
+ * @brief the mapped preview and the plane weight sums of every LED
+ */
+typedef struct {
+    hub_preview *preview;
+    size_t       bytes;
+    uint32_t    *sums;
+    uint32_t     frames;
+} preview_sink;
+
+
+static void *preview_init(scene_info *scene) {
+    preview_sink *sink = (preview_sink*)calloc(1, sizeof(preview_sink));
+    if (sink == NULL) {
+        die("unable to allocate preview backend\n");
+    }
+    const uint16_t height = MIN(scene->num_ports, 3) * scene->panel_height;
+    const size_t   pixels = (size_t)scene->width * height;
+    sink->bytes = sizeof(hub_preview) + (pixels * 3);
+    sink->sums  = (uint32_t*)calloc(pixels * 3, sizeof(uint32_t));
+    if (sink->sums == NULL) {
+        die("unable to allocate preview for %dx%d\n", scene->width, height);
+    }
+
+    int fd = shm_open(HUB_PREVIEW_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        die("unable to create shared memory %s: %s\n", HUB_PREVIEW_NAME, strerror(errno));
+    }
+    if (ftruncate(fd, sink->bytes) != 0) {
+        die("unable to size shared memory %s: %s\n", HUB_PREVIEW_NAME, strerror(errno));
+    }
+    sink->preview = (hub_preview*)mmap(NULL, sink->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sink->preview == MAP_FAILED) {
+        die("unable to map shared memory %s: %s\n", HUB_PREVIEW_NAME, strerror(errno));
+    }
+
+    hub_preview *preview = sink->preview;
+    preview->width   = scene->width;
+    preview->height  = height;
+    preview->version = HUB_PREVIEW_VERSION;
+    atomic_store(&preview->seq, 0);
+    memset(preview->rgb, 0, pixels * 3);
+    preview->magic = HUB_PREVIEW_MAGIC;
+    return sink;
+}
+
+/**
+ * @brief add up the weight of every plane each LED is on in, and publish them as 0-255 duty cycles
+ */
+__attribute__((hot))
+static void preview_render(const scene_info *scene, preview_sink *sink, const uint32_t *bcm_signal) {
+    const bcm_geometry *geometry = &scene->geometry;
+    const uint8_t  ports  = MIN(scene->num_ports, 3);
+    const bool     binary = scene->bcm_mode == BCM_MODE_BINARY;
+    const size_t   values = (size_t)sink->preview->width * sink->preview->height * 3;
+    const uint32_t total  = (binary) ? (1U << geometry->bit_depth) - 1 : geometry->bit_depth;
+    memset(sink->sums, 0, values * sizeof(uint32_t));
+
+    for (uint8_t plane=0; plane < geometry->bit_depth; plane++) {
+        const uint32_t weight = (binary) ? 1U << plane : 1;
+        for (uint16_t y=0; y < geometry->half_height; y++) {
+            const uint32_t *row = bcm_signal + (plane * geometry->plane_words) + (y * geometry->row_words) + geometry->pixel_offset;
+            uint32_t mask = 0;
+            for (uint16_t x=0; x < geometry->width; x++) {
+                // SET / CLR pairs hold the pin changes from the last pixel, see pair_rows
+                mask = (scene->set_clr_pairs) ? (mask & ~row[x * 2]) | row[(x * 2) + 1] : row[x];
+                for (uint8_t port=0; port < ports; port++) {
+                    for (uint8_t half=0; half < 2; half++) {
+                        const size_t scan   = ((((size_t)port * 2) + half) * geometry->half_height + y) * geometry->width + x;
+                        const size_t pixel  = (scene->scan_gather != NULL) ? scene->scan_gather[scan] : scan;
+                        for (uint8_t c=0; c < 3; c++) {
+                            sink->sums[(pixel * 3) + c] += (mask >> port_pins[port][(half * 3) + c] & 1) * weight;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // the OE brightness sequence dims the whole panel
+    const uint32_t scale = (scene->jitter_brightness) ? scene->brightness : 255;
+    hub_preview *preview = sink->preview;
+    atomic_fetch_add_explicit(&preview->seq, 1, memory_order_acq_rel);
+    for (size_t i=0; i < values; i++) {
+        preview->rgb[i] = (uint8_t)(((uint64_t)sink->sums[i] * scale) / total);
+    }
+    atomic_fetch_add_explicit(&preview->seq, 1, memory_order_release);
+    sink->frames++;
+}
+
+static void preview_scan(scene_info *scene, void *state) {
+    preview_sink *sink = (preview_sink*)state;
+    const uint32_t *shown = NULL;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (scene->do_render) {
+        // a new frame is always in a different buffer than the one on the "wire"
+        const uint32_t *bcm_signal = bcm_front_buffer(scene);
+        if (bcm_signal != shown) {
+            preview_render(scene, sink, bcm_signal);
+            shown = bcm_signal;
+        }
+        hub_vsync_signal(scene);
+
+        next.tv_nsec += 1000000000L / PREVIEW_HZ;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+}
+
+static void preview_stats(FILE *out, const scene_info *scene, const void *state) {
+    const preview_sink *sink = (const preview_sink*)state;
+    fprintf(out, "preview backend: %u frames of %dx%d in %s\n", sink->frames, sink->preview->width,
+        sink->preview->height, HUB_PREVIEW_NAME);
+    (void)scene;
+}
+
+static void preview_close(scene_info *scene, void *state) {
+    (void)scene;
+    preview_sink *sink = (preview_sink*)state;
+    // readers that still have it mapped keep their copy, new ones get NULL from hub_preview_open()
+    sink->preview->magic = 0;
+    munmap(sink->preview, sink->bytes);
+    shm_unlink(HUB_PREVIEW_NAME);
+    free(sink->sums);
+    free(sink);
+}
+
+const hub_backend hub_backend_preview = {
+    .name     = "preview",
+    .pi_model = 0,
+    .init     = preview_init,
+    .scan     = preview_scan,
+    .stats    = preview_stats,
+    .close    = preview_close
+};
+
+
+const hub_preview *hub_preview_open(const char *name) {
+    int fd = shm_open((name == NULL) ? HUB_PREVIEW_NAME : name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hub_preview)) {
+        close(fd);
+        return NULL;
+    }
+    hub_preview *preview = (hub_preview*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (preview == MAP_FAILED) {
+        return NULL;
+    }
+    if (preview->magic != HUB_PREVIEW_MAGIC || preview->version != HUB_PREVIEW_VERSION ||
+        sizeof(hub_preview) + ((size_t)preview->width * preview->height * 3) > (size_t)st.st_size) {
+        munmap(preview, st.st_size);
+        return NULL;
+    }
+    return preview;
+}
+
+uint32_t hub_preview_read(const hub_preview *preview, uint8_t *rgb) {
+    const size_t bytes = (size_t)preview->width * preview->height * 3;
+    while (true) {
+        const uint32_t seq = atomic_load_explicit(&((hub_preview*)preview)->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(rgb, preview->rgb, bytes);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&((hub_preview*)preview)->seq, memory_order_relaxed) == seq) {
+            return seq / 2;
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+/**
+ * realtime placement of the scan out, encode and frame source threads.
+ *
+ * the scan out loop is a busy loop that should not be preempted: it is pinned alone to
+ * scene->scanout_cpu and everything else is kept off that cpu. SCHED_FIFO (-r) and locked
+ * memory (-M) keep a page fault or another task from stalling the panel mid plane, but the
+ * loop never yields, so they are opt in: boot with isolcpus=, nohz_full= and rcu_nocbs= set
+ * to the scan out cpu first or the rest of the system can starve.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "realtime.h"
+
+
+bool cpu_list_contains(const char *list, const int cpu) {
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        if (cpu >= first && cpu <= last) {
+            return true;
+        }
+        while (*p == ',' || isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief read the first line of a sysfs or procfs file. these report a size of 0 or 4096
+ * so file_get_contents() can not be used. returns false if the file can not be read
+ */
+static bool read_line(const char *filename, char *buffer, const size_t size) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return false;
+    }
+    const bool ok = fgets(buffer, size, file) != NULL;
+    fclose(file);
+    if (!ok) {
+        buffer[0] = '\0';
+    }
+    return true;
+}
+
+/**
+ * @brief write a string to a procfs file, returns false if the kernel refused it
+ */
+static bool write_string(const char *filename, const char *value) {
+    int fd = open(filename, O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const ssize_t len = strlen(value);
+    const bool ok = write(fd, value, len) == len;
+    close(fd);
+    return ok;
+}
+
+int realtime_spare_cpu(const uint8_t index, const uint8_t avoid_cpu) {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 2) {
+        return -1;
+    }
+
+    int cpu = index % (num_cpus - 1);
+    if (cpu >= avoid_cpu) {
+        cpu++;
+    }
+    return cpu;
+}
+
+/**
+ * @brief every online cpu except avoid_cpu, or every cpu if that is the only one
+ */
+static void spare_cpus(cpu_set_t *cpuset, const uint8_t avoid_cpu) {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(cpuset);
+    for (long cpu=0; cpu < num_cpus; cpu++) {
+        if (cpu != avoid_cpu || num_cpus < 2) {
+            CPU_SET(cpu, cpuset);
+        }
+    }
+}
+
+void realtime_place_thread(const scene_info *scene, const pthread_t thread, const enum thread_role_e role) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+
+    switch (role) {
+    case THREAD_SCANOUT:
+        CPU_SET(scene->scanout_cpu, &cpuset);
+        break;
+    case THREAD_SOURCE:
+        spare_cpus(&cpuset, scene->scanout_cpu);
+        break;
+    }
+
+    if (pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset) != 0) {
+        fprintf(stderr, "unable to set cpu affinity of %s thread\n", (role == THREAD_SOURCE) ? "source" : "scan out");
+    }
+}
+
+__attribute__((cold))
+void realtime_check_isolation(const uint8_t cpu) {
+    char list[256];
+    if (read_line("/sys/devices/system/cpu/isolated", list, sizeof(list)) && !cpu_list_contains(list, cpu)) {
+        fprintf(stderr, "warning: scan out cpu %d is not isolated, add isolcpus=%d to the kernel command line\n", cpu, cpu);
+    }
+    if (read_line("/sys/devices/system/cpu/nohz_full", list, sizeof(list)) && !cpu_list_contains(list, cpu)) {
+        fprintf(stderr, "warning: scan out cpu %d takes the scheduler tick, add nohz_full=%d to the kernel command line\n", cpu, cpu);
+    }
+}
+
+__attribute__((cold))
+int realtime_move_irqs(const uint8_t cpu) {
+    cpu_set_t cpuset;
+    spare_cpus(&cpuset, cpu);
+    if (CPU_ISSET(cpu, &cpuset)) {
+        return 0;
+    }
+
+    // "0,1,2" for smp_affinity_list and a hex mask for default_smp_affinity
+    char cpu_list[256] = "";
+    unsigned long mask = 0;
+    for (int i=0; i < CPU_SETSIZE && i < 64; i++) {
+        if (CPU_ISSET(i, &cpuset)) {
+            size_t len = strlen(cpu_list);
+            snprintf(cpu_list + len, sizeof(cpu_list) - len, "%s%d", (len > 0) ? "," : "", i);
+            mask |= 1UL << i;
+        }
+    }
+    char hex_mask[32];
+    snprintf(hex_mask, sizeof(hex_mask), "%lx", mask);
+    if (!write_string("/proc/irq/default_smp_affinity", hex_mask)) {
+        fprintf(stderr, "unable to set default irq affinity (%s), interrupts stay on cpu %d\n", strerror(errno), cpu);
+        return 0;
+    }
+
+    DIR *dir = opendir("/proc/irq");
+    if (dir == NULL) {
+        return 0;
+    }
+    int moved = 0, refused = 0;
+    struct dirent *entry;
+    char filename[300];
+    while ((entry = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)entry->d_name[0])) {
+            continue;
+        }
+        snprintf(filename, sizeof(filename), "/proc/irq/%s/smp_affinity_list", entry->d_name);
+        if (write_string(filename, cpu_list)) {
+            moved++;
+        } else {
+            refused++;
+        }
+    }
+    closedir(dir);
+    debug("moved %d interrupts off cpu %d, %d can not be moved\n", moved, cpu, refused);
+    return moved;
+}
+
+__attribute__((cold))
+void realtime_setup_scanout(const scene_info *scene) {
+    // only this thread, threads created earlier keep their own placement
+    realtime_place_thread(scene, pthread_self(), THREAD_SCANOUT);
+    cpu_set_t cpuset;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0 ||
+        CPU_COUNT(&cpuset) != 1 || !CPU_ISSET(scene->scanout_cpu, &cpuset)) {
+        die("unable to set CPU affinity to %d\n", scene->scanout_cpu);
+    }
+
+    realtime_check_isolation(scene->scanout_cpu);
+    if (scene->move_irqs) {
+        realtime_move_irqs(scene->scanout_cpu);
+    }
+
+    // page faults in the scan out loop show up as a flash on the panel
+    if (scene->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(stderr, "unable to lock memory (%s), scan out may stall on page faults\n", strerror(errno));
+    }
+
+    if (scene->scanout_priority > 0) {
+        struct sched_param param = { .sched_priority = scene->scanout_priority };
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "unable to set SCHED_FIFO priority %d (%s), run as root or grant CAP_SYS_NICE\n",
+                scene->scanout_priority, strerror(err));
+        }
+    }
+}
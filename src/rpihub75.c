@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -42,14 +43,24 @@
 #include <sched.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "rpihub75.h"
 #include "util.h"
+#include "pixels.h"
+#include "realtime.h"
+#include "telemetry.h"
+#include "delay.h"
+#include "trace.h"
+#include "scan.h"
+#include "backend.h"
 
 
 /**
  * @brief calculate an address line pin mask for row y
- * not used outside this file
+ * 
  * @param y the panel row number to calculate the mask for
  * @return uint32_t the bitmask for the address lines at row y
  */
@@ -73,12 +84,69 @@ uint32_t row_to_address(const int y, uint8_t half_height) {
 
 
 
+/**
+ * @brief compute scene->geometry and the scan gather table for the current scene
+ * @param scene 
+ */
+void bcm_geometry_init(scene_info *scene) {
+    bcm_geometry *geometry = &scene->geometry;
+    const uint16_t panel_rows = scene->panel_height / 2;
+    // check_scene() dies on scan rows the panel can not have, keep the tables in bounds until then
+    const uint16_t scan_rows  = (scene->scan_rows > 0) ? MIN(scene->scan_rows, 32) : panel_rows;
+
+    geometry->half_height      = MAX(scan_rows, 1);
+    geometry->rows_per_address = MAX(panel_rows / geometry->half_height, 1);
+    geometry->width            = scene->width * geometry->rows_per_address;
+    geometry->bit_depth        = scene->bit_depth;
+    geometry->pixel_words      = (scene->set_clr_pairs) ? 2 : 1;
+    geometry->pixel_offset     = (scene->set_clr_pairs) ? 2 : 0;
+    geometry->row_words        = geometry->pixel_offset + (geometry->width * geometry->pixel_words);
+    geometry->plane_words      = geometry->row_words * geometry->half_height;
+    geometry->frame_words      = geometry->plane_words * geometry->bit_depth;
+
+    memset(geometry->address, 0, sizeof(geometry->address));
+    for (uint16_t y=0; y < MIN(geometry->half_height, 32); y++) {
+        geometry->address[y] = scan_row_address(scene->scan_pattern, (y + geometry->half_height - 1) % geometry->half_height);
+    }
+
+    // multiplexed panels: the bcm_mapper gathers each frame into scan layout for the encoders
+    free(scene->scan_gather);
+    scene->scan_gather = scan_gather_create(scene);
+    free(scene->scan_image);
+    scene->scan_image = NULL;
+    if (scene->scan_gather != NULL) {
+        const size_t bytes = (size_t)geometry->width * geometry->half_height * 2 * MIN(scene->num_ports, 3) * 4;
+        scene->scan_image  = (uint8_t*)aligned_alloc(64, (bytes + 63) & ~(size_t)63);
+        if (scene->scan_image == NULL) {
+            die("unable to allocate scan layout image\n");
+        }
+    }
+}
+
+/**
+ * @brief nanoseconds of every refresh spent in the GPIO_*_NS delays and binary BCM holds, before
+ * the cost of a single GPIO store. no refresh rate above 1s / this is possible
+ */
+static uint64_t refresh_floor_ns(const scene_info *scene) {
+    const uint64_t rows = (uint64_t)scene->geometry.half_height * scene->bit_depth;
+    uint64_t row_ns = GPIO_LATCH_NS;
+    if (scene->set_clr_pairs) {
+        // address and OE settles, then a settle and both clock phases for every pixel
+        row_ns += (3 * GPIO_SETTLE_NS) + GPIO_OE_NS + ((uint64_t)scene->geometry.width * (GPIO_SETTLE_NS + (2 * GPIO_CLOCK_NS)));
+    }
+    if (scene->bcm_mode == BCM_MODE_BINARY) {
+        // every row shows every plane for its weight, (2^bit_depth - 1) lsb times
+        return (rows * row_ns) + ((uint64_t)scene->geometry.half_height * scene->bcm_lsb_ns * ((1ULL << scene->bit_depth) - 1));
+    }
+    return rows * row_ns;
+}
+
 /**
  * @brief verify that the scene configuration is valid
  * will die() if invalid configuration is found
  * @param scene 
  */
-void check_scene(const scene_info *scene) {
+void check_scene(scene_info *scene) {
     if (CONSOLE_DEBUG) {
         printf("ports: %d, chains: %d, width: %d, height: %d, stride: %d, bit_depth: %d\n", 
             scene->num_ports, scene->num_chains, scene->width, scene->height, scene->stride, scene->bit_depth);
@@ -101,31 +169,82 @@ void check_scene(const scene_info *scene) {
     if (scene->stride != 3 && scene->stride != 4) { 
         die("Only 3 or 4 byte stride supported\n");
     }
-    if (scene->bcm_signalA == NULL) {
-        die("No bcm signal buffer A defined\n");
+    for (int i=0; i<3; i++) {
+        if (scene->bcm_signal[i] == NULL) {
+            die("No bcm signal buffer %d defined\n", i);
+        }
+    }
+    const scan_pattern *pattern = scene->scan_pattern;
+    const uint16_t scan_rows    = (scene->scan_rows > 0) ? scene->scan_rows : scene->panel_height / 2;
+    if (scan_rows == 0 || scan_rows > 32 || (scene->panel_height / 2) % scan_rows != 0) {
+        die("panel height %d can not be scanned in %d rows\n", scene->panel_height, scan_rows);
     }
-    if (scene->bcm_signalB == NULL) {
-        die("No bcm signal buffer B defined\n");
+    if (pattern != NULL && pattern->address == SCAN_ADDRESS_DIRECT && scan_rows > 5) {
+        die("scan pattern %s selects at most 5 rows, not %d\n", pattern->name, scan_rows);
+    }
+    if (scan_rows < scene->panel_height / 2) {
+        if (pattern != NULL && pattern->stripe > 0 && scene->panel_width % pattern->stripe != 0) {
+            die("scan pattern %s needs a panel width that is a multiple of %d\n", pattern->name, pattern->stripe);
+        }
+        if (scene->width % scene->panel_width != 0) {
+            die("scan pattern needs whole panels, width %d is not a multiple of %d\n", scene->width, scene->panel_width);
+        }
+    }
+    if (scene->geometry.width != scene->width * ((scene->panel_height / 2) / scan_rows) || scene->geometry.half_height != scan_rows ||
+        scene->geometry.bit_depth != scene->bit_depth || scene->geometry.pixel_words != ((scene->set_clr_pairs) ? 2 : 1)) {
+        die("bcm buffers were sized for %dx%d at %d bits, scene is %dx%d at %d bits\n",
+            scene->geometry.width, scene->geometry.half_height * 2, scene->geometry.bit_depth,
+            scene->width, scene->panel_height, scene->bit_depth);
+    }
+    if (scene->geometry.rows_per_address > 1 && (scene->scan_gather == NULL || scene->scan_image == NULL)) {
+        die("no scan gather table for %d rows per address, call bcm_geometry_init()\n", scene->geometry.rows_per_address);
+    }
+    if (scene->bcm_back == (atomic_load(&scene->bcm_ready) & BCM_FRAME_INDEX) ||
+        scene->bcm_back == atomic_load(&scene->bcm_front) ||
+        atomic_load(&scene->bcm_front) == (atomic_load(&scene->bcm_ready) & BCM_FRAME_INDEX)) {
+        die("bcm buffer indexes must all be different\n");
     }
     if (scene->image == NULL) {
         die("No RGB image buffer defined\n");
     }
-    if (scene->bit_depth < 4 || scene->bit_depth > 64) {
+    if (scene->set_clr_pairs && (scene->prebaked_stream || scene->bcm_mode == BCM_MODE_BINARY)) {
+        die("pre-baked GPIO streams and binary BCM are only supported on Pi5\n");
+    }
+    if (scene->bcm_mode == BCM_MODE_BINARY) {
+        if (scene->bit_depth < 1 || scene->bit_depth > MAX_BINARY_BITS) {
+            die("Only 1-%d bit planes supported for binary BCM\n", MAX_BINARY_BITS);
+        }
+        if (scene->prebaked_stream) {
+            die("binary BCM can not be used with a pre-baked GPIO stream\n");
+        }
+        if (scene->bcm_lsb_ns == 0) {
+            die("binary BCM requires a least significant bit time (bcm_lsb_ns)\n");
+        }
+    }
+    else if (scene->bit_depth < 4 || scene->bit_depth > 64) {
         die("Only 4-64 bit depth supported\n");
     }
     if (scene->motion_blur_frames > 32) {
         die("Max motion blur frames is 32\n");
     }
 
-    if (scene->brightness > 254) {
-        die("Max brightness is 254\n");
-    }
-    if (scene->bit_depth % BIT_DEPTH_ALIGNMENT != 0) {
+    if (scene->bcm_mode == BCM_MODE_PWM && scene->bit_depth % BIT_DEPTH_ALIGNMENT != 0) {
         die("requested bit_depth %d, but %d is not aligned to %d bytes\n"
             "To use this bit depth, you must #define BIT_DEPTH_ALIGNMENT to the\n"
             "least common denominator of %d\n", 
             scene->bit_depth, scene->bit_depth, BIT_DEPTH_ALIGNMENT);
     }
+    if (scene->scanout_cpu >= sysconf(_SC_NPROCESSORS_ONLN)) {
+        die("scan out cpu %d is not online, only %ld cpus\n", scene->scanout_cpu, sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    if (scene->scanout_priority > 99) {
+        die("SCHED_FIFO priority must be 0-99\n");
+    }
+    if (scene->refresh_hz > 0 && refresh_floor_ns(scene) * scene->refresh_hz > 1000000000ULL) {
+        die("refresh rate %dHz is not possible, the GPIO delays alone take %luns of every %luns refresh\n",
+            scene->refresh_hz, (unsigned long)refresh_floor_ns(scene), (unsigned long)(1000000000UL / scene->refresh_hz));
+    }
+    bcm_select_encoder(scene);
 }
 
 /**
@@ -249,152 +368,590 @@ uint8_t *mirror_flip_mapper(uint8_t *image, uint8_t *image_out, const struct sce
 
 
 /**
- * internal method for rendering on pi zero, 3 and 4
+ * @brief return the bcm buffer the producer should write the next frame to.
+ * bcm_publish() only ever hands back the slot render_forever swapped out, so the back
+ * buffer is never the one on the wire as long as there is a single producer.
  */
-void render_forever_pi4(const scene_info *scene, int version) {
+uint32_t *bcm_back_buffer(scene_info *scene) {
+    return scene->bcm_signal[scene->bcm_back];
+}
 
-    srand(time(NULL));
-    // map the gpio address to we can control the GPIO pins
-    uint32_t *PERIBase = map_gpio(0, version); // for root on pi5 (/dev/mem, offset is 0xD0000)
-    // offset to the RIO registers (required for #define register access. 
-    // TODO: this needs to be improved and #define to RIOBase removed)
-    if (version == 4) {
-    	configure_gpio(PERIBase, 4);
-    } else if (version == 3) {
-    	configure_gpio(PERIBase, 3);
+/**
+ * @brief swap the finished back buffer with the ready slot. the release half of the exchange
+ * makes the frame data visible to render_forever, the acquire half hands us back a buffer
+ * render_forever is done with.
+ */
+void bcm_publish(scene_info *scene) {
+    uint_fast8_t prev = atomic_exchange_explicit(&scene->bcm_ready, scene->bcm_back | BCM_FRAME_NEW, memory_order_acq_rel);
+    if (prev & BCM_FRAME_NEW) {
+        atomic_fetch_add_explicit(&scene->frames_dropped, 1, memory_order_relaxed);
+    }
+    scene->bcm_last = scene->bcm_back;
+    scene->bcm_back = prev & BCM_FRAME_INDEX;
+}
+
+/**
+ * @brief swap the front buffer with the ready slot if a new frame was published.
+ * cheap enough to call once per bit plane: a relaxed load and a branch when nothing changed.
+ */
+__attribute__((hot))
+uint32_t *bcm_front_buffer(scene_info *scene) {
+    uint_fast8_t front = atomic_load_explicit(&scene->bcm_front, memory_order_relaxed);
+    if (UNLIKELY(atomic_load_explicit(&scene->bcm_ready, memory_order_relaxed) & BCM_FRAME_NEW)) {
+        front = atomic_exchange_explicit(&scene->bcm_ready, front, memory_order_acq_rel) & BCM_FRAME_INDEX;
+        atomic_store_explicit(&scene->bcm_front, front, memory_order_release);
+    }
+    return scene->bcm_signal[front];
+}
+
+/**
+ * @brief publish a completed refresh to hub_wait_vsync(). the timestamp is stored before the
+ * sequence number so a waiter that sees the new sequence also sees its timestamp.
+ * the futex syscall is only made when a producer is actually waiting.
+ */
+__attribute__((hot))
+static inline void vsync_signal(scene_info *scene) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    atomic_store_explicit(&scene->vsync_ns, (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec, memory_order_relaxed);
+    atomic_fetch_add_explicit(&scene->vsync_seq, 1, memory_order_seq_cst);
+    if (UNLIKELY(atomic_load_explicit(&scene->vsync_waiters, memory_order_seq_cst) > 0)) {
+        syscall(SYS_futex, &scene->vsync_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/**
+ * @brief block on the vsync_seq futex until it moves past last_seq.
+ * waiters is incremented before the sequence is re-checked so render_forever can not
+ * miss us between the check and the FUTEX_WAIT.
+ */
+uint32_t hub_wait_vsync(scene_info *scene, const uint32_t last_seq, uint64_t *timestamp_ns) {
+    const struct timespec timeout = {.tv_sec = 0, .tv_nsec = VSYNC_TIMEOUT_MS * 1000000L};
+    uint32_t seq = atomic_load_explicit(&scene->vsync_seq, memory_order_acquire);
+
+    if (seq == last_seq) {
+        atomic_fetch_add_explicit(&scene->vsync_waiters, 1, memory_order_seq_cst);
+        while ((seq = atomic_load_explicit(&scene->vsync_seq, memory_order_seq_cst)) == last_seq) {
+            // EAGAIN (sequence moved), EINTR and ETIMEDOUT all fall through to the re-check
+            if (syscall(SYS_futex, &scene->vsync_seq, FUTEX_WAIT_PRIVATE, last_seq, &timeout, NULL, 0) != 0 && errno == ETIMEDOUT) {
+                break;
+            }
+        }
+        atomic_fetch_sub_explicit(&scene->vsync_waiters, 1, memory_order_relaxed);
+    }
+
+    if (timestamp_ns != NULL) {
+        *timestamp_ns = atomic_load_explicit(&scene->vsync_ns, memory_order_relaxed);
+    }
+    return seq;
+}
+
+/**
+ * @brief limit producers to target_fps and optionally to the panel refresh.
+ * render_forever clears BCM_FRAME_NEW when it picks up the frame at the start of a
+ * refresh, the next vsync after that means the frame was shown in full.
+ */
+void hub_frame_sync(scene_info *scene, const uint16_t target_fps) {
+    if (scene->vsync) {
+        uint32_t seq = atomic_load_explicit(&scene->vsync_seq, memory_order_acquire);
+        while (scene->do_render && (atomic_load_explicit(&scene->bcm_ready, memory_order_acquire) & BCM_FRAME_NEW)) {
+            uint32_t next = hub_wait_vsync(scene, seq, NULL);
+            if (next == seq) {
+                // timed out, render_forever is not running
+                break;
+            }
+            seq = next;
+        }
+        hub_wait_vsync(scene, seq, NULL);
+    }
+
+    calculate_fps(target_fps, scene->show_fps);
+}
+
+
+/**
+ * @brief busy wait until hub_cycles() reaches end. used to time the binary BCM plane holds
+ * and the refresh_hz padding.
+ */
+__attribute__((hot, always_inline))
+static inline void hold_until(const uint64_t end) {
+    while (hub_cycles() < end) {
+        asm volatile ("" : : : "memory");
+    }
+}
+
+/**
+ * @brief end of a refresh with a fixed scene->refresh_hz: blank the panel and wait for the deadline,
+ * see refresh_pacer. a refresh that ran past its deadline skips to the next period so the refresh
+ * keeps its phase. the warm up refreshes are only timed
+ *
+ * @param relight turn OE back on after the wait, for loops that keep the last row lit into the next refresh
+ */
+__attribute__((hot, always_inline))
+static inline void refresh_pad(scene_info *scene, hub_stats *stats, volatile uint32_t *set, volatile uint32_t *clr,
+    const bool relight, hub_trace *trace) {
+    refresh_pacer *pacer = &scene->pacer;
+    if (LIKELY(pacer->period == 0)) {
+        return;
+    }
+    const uint64_t now = hub_cycles();
+    if (UNLIKELY(pacer->warmup > 0)) {
+        refresh_pacer_warmup(pacer, now);
+        return;
+    }
+    if (UNLIKELY(now > pacer->deadline)) {
+        atomic_store_explicit(&pacer->missed, atomic_load_explicit(&pacer->missed, memory_order_relaxed) + 1, memory_order_relaxed);
+        pacer->deadline += (((now - pacer->deadline) / pacer->period) + 1) * pacer->period;
+    }
+
+    // the padding is the headroom left in this refresh
+    const uint64_t headroom = pacer->deadline - now;
+    if (UNLIKELY(headroom < atomic_load_explicit(&pacer->headroom_min, memory_order_relaxed))) {
+        atomic_store_explicit(&pacer->headroom_min, headroom, memory_order_relaxed);
+    }
+    if (stats) {
+        histogram_add(&stats->pad, headroom);
     }
 
+    gpio_store(trace, GPIO_REG_SET, set, PIN_OE);
+    hold_until(pacer->deadline);
+    if (relight) {
+        gpio_store(trace, GPIO_REG_CLR, clr, PIN_OE);
+    }
+    pacer->deadline += pacer->period;
+}
 
-     
-    // index into the OE jitter mask
-    uint16_t jitter_idx = 0;
+/**
+ * @brief Pi3/4 scan out of SET / CLR register pairs, see bcm_geometry.
+ * set and clr are GPSET0 and GPCLR0, trace records the stores instead when not NULL
+ */
+__attribute__((hot, always_inline))
+static inline void scan_pairs(scene_info *scene, volatile uint32_t *set, volatile uint32_t *clr, hub_trace *trace) {
     // pre compute some variables. let the compiler know the alignment for optimizations
-    const uint8_t  half_height __attribute__((aligned(16))) = scene->panel_height / 2;
-    const uint16_t width __attribute__((aligned(16))) = scene->width;
+    const uint8_t  half_height __attribute__((aligned(16))) = scene->geometry.half_height;
+    const uint16_t width __attribute__((aligned(16))) = scene->geometry.width;
     const uint8_t  bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
+    const uint32_t plane_words = scene->geometry.plane_words;
+    const uint32_t row_words   = scene->geometry.row_words;
 
     // pointer to the current bcm data to be displayed
-    uint32_t *bcm_signal = scene->bcm_signalA;
+    uint32_t *bcm_signal = bcm_front_buffer(scene);
     ASSERT(width % 16 == 0);
-    ASSERT(half_height % 16 == 0);
     ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
 
-    bool last_pointer = scene->bcm_ptr;
-
-    // create the OE jitter mask to control screen brightness
-    // if we are using BCM brightness, then set OE to 0 (0 is display on ironically)
-    uint32_t *jitter_mask = create_jitter_mask(JITTER_SIZE, scene->brightness);
-    if (scene->jitter_brightness == false) {
-        memset(jitter_mask, 0, JITTER_SIZE);
-    }
-
-    // store the row to address mapping in an array for faster access
-    uint32_t addr_map[half_height];
-    for (int i=0; i<half_height; i++) {
-        addr_map[i] = row_to_address(i, half_height);
-    }
+    // the address SET / CLR words of row 0 assume the last row was selected before it
+    gpio_store(trace, GPIO_REG_CLR, clr, ADDRESS_MASK);
+    spin(scene->delays.settle);
+    gpio_store(trace, GPIO_REG_SET, set, scene->geometry.address[half_height - 1]);
+    spin(scene->delays.settle);
 
-    time_t last_time_s     = time(NULL);
-    uint32_t frame_count   = 0;
-    uint32_t last_addr     = 0;
-    uint32_t color_pins    = 0;
+    // scan out timing, NULL unless show_fps or telemetry is set
+    hub_stats *stats       = telemetry_create(scene);
+    uint64_t row_start     = hub_cycles();
+    uint64_t plane_start   = row_start;
+    uint64_t frame_start   = row_start;
 
-    // uint8_t bright = scene->brightness;
     while(scene->do_render) {
+        // calibrated spin counts, constant for the whole refresh
+        const uint32_t settle = scene->delays.settle;
+        const uint32_t clock  = scene->delays.clock;
+        const uint32_t latch  = scene->delays.latch;
+        const uint32_t oe     = scene->delays.oe;
 
         // iterate over the bit plane
         for (uint8_t pwm=0; pwm<bit_depth; pwm++) {
-            time_t current_time_s = time(NULL);
-            frame_count++;
             // for the current bit plane, render the entire frame
-            uint32_t offset = pwm;
+            const uint32_t *row = bcm_signal + (pwm * plane_words);
             for (uint16_t y=0; y<half_height; y++) {
                 asm volatile ("" : : : "memory");  // Prevents optimization
+                const uint32_t *pair = row;
 
-                PERIBase[7]  = addr_map[y] & ~last_addr;
-                SLOW
-                PERIBase[10] = ~addr_map[y] & last_addr;
-                SLOW
-                last_addr    = addr_map[y];
+                // address line transitions from the previous row, see bcm_geometry
+                gpio_store(trace, GPIO_REG_SET, set, pair[0]);
+                spin(settle);
+                gpio_store(trace, GPIO_REG_CLR, clr, pair[1]);
+                spin(settle);
+                pair += 2;
 
+                // CLR (including the clock) then SET, the encoder already worked out which pins change
                 for (uint16_t x=0; x<width; x++) {
                     asm volatile ("" : : : "memory");  // Prevents optimization
-                    uint32_t new_mask = (bcm_signal[offset]);// | jitter_mask[jitter_idx]);
-                    PERIBase[10]      = (~new_mask & color_pins) | PIN_CLK;
-                    SLOW
-                    PERIBase[7]       = (new_mask & ~color_pins);
-                    SLOW
-                    SLOW
-                    SLOW
-                    PERIBase[7]       = (new_mask) | PIN_CLK;
-
-                    SLOW
-                    SLOW
-                    SLOW
-                    color_pins        = new_mask;
-
-                    // advance the global OE jitter mask 1 frame
-                    jitter_idx = (jitter_idx + 1) % JITTER_SIZE;
-
-                    // advance to the next pixel in the bcm signal
-                    offset += bit_depth + 1;
+                    gpio_store(trace, GPIO_REG_CLR, clr, pair[0]);
+                    spin(settle);
+                    gpio_store(trace, GPIO_REG_SET, set, pair[1]);
+                    spin(clock);
+                    gpio_store(trace, GPIO_REG_SET, set, PIN_CLK);
+                    spin(clock);
+                    pair += 2;
                 }
-                PERIBase[7] = PIN_LATCH | PIN_OE;
-                SLOW
-                SLOW
-                PERIBase[10] = PIN_LATCH;
-                SLOW
-                SLOW
-                PERIBase[10] = PIN_OE;
-                SLOW
+                gpio_store(trace, GPIO_REG_SET, set, PIN_LATCH | PIN_OE);
+                spin(latch);
+                gpio_store(trace, GPIO_REG_CLR, clr, PIN_LATCH);
+                spin(oe);
+                gpio_store(trace, GPIO_REG_CLR, clr, PIN_OE);
+                spin(settle);
+                row += row_words;
+                if (stats) {
+                    telemetry_mark(&stats->row, &row_start);
+                }
+            }
+            if (stats) {
+                telemetry_mark(&stats->plane[pwm], &plane_start);
             }
+        }
+
+        // full set of bit planes shown, swap the buffers on vsync
+        // the last row stays lit into the next refresh, so it is lit again after the padding
+        refresh_pad(scene, stats, set, clr, true, trace);
+        vsync_signal(scene);
+        bcm_signal = bcm_front_buffer(scene);
+        gpio_delays_update(&scene->delays);
+        if (stats) {
+            telemetry_frame(scene, stats, &frame_start, bit_depth);
+        }
+        if (trace != NULL && hub_trace_refresh(trace)) {
+            scene->do_render = false;
+        }
+    }
+    telemetry_destroy(stats);
+}
+
+// pixels per unrolled group of the scan out loops. widths are always a multiple of 16
+#define SCAN_GROUP 16
+
+/**
+ * @brief shift SCAN_GROUP pre-baked words, fully unrolled. the cache line prefetch_words ahead (the
+ * same pixels of the next row) is prefetched first, PRFM on arm. without a memory barrier per pixel
+ * the loads can be scheduled ahead of the (volatile) register stores
+ */
+__attribute__((hot, always_inline))
+static inline void shift_stream_group(const uint32_t *restrict words, const uint32_t prefetch_words,
+    volatile uint32_t *out, volatile uint32_t *set, hub_trace *trace) {
+    __builtin_prefetch(words + prefetch_words, 0, 3);
+    #pragma GCC unroll 16
+    for (uint8_t k=0; k<SCAN_GROUP; k++) {
+        // color pins, row address and OE are all already in the word
+        gpio_store(trace, GPIO_REG_OUT, out, words[k]);
+        gpio_store(trace, GPIO_REG_SET, set, PIN_CLK);
+    }
+}
+
+/**
+ * @brief shift SCAN_GROUP bcm words with the row address and OE merged in, fully unrolled.
+ * see shift_stream_group
+ */
+__attribute__((hot, always_inline))
+static inline void shift_pwm_group(const uint32_t *restrict words, const uint32_t prefetch_words, const uint32_t address,
+    const uint32_t oe_pin, const uint32_t oe_on, uint32_t *oe_phase, volatile uint32_t *out, volatile uint32_t *set, hub_trace *trace) {
+    uint32_t phase = *oe_phase;
+    __builtin_prefetch(words + prefetch_words, 0, 3);
+    #pragma GCC unroll 16
+    for (uint8_t k=0; k<SCAN_GROUP; k++) {
+        // set all bits in 1 op. RGB data, current row address and OE (brightness control)
+        gpio_store(trace, GPIO_REG_OUT, out, words[k] | address | ((phase >= oe_on) ? oe_pin : 0));
+        // toggle clock pin high
+        gpio_store(trace, GPIO_REG_SET, set, PIN_CLK);
+        // advance the OE sequence 1 clock
+        phase += OE_SEQUENCE_STEP;
+    }
+    *oe_phase = phase;
+}
 
-            // swap the buffers on vsync
-            if (UNLIKELY(scene->bcm_ptr != last_pointer)) {
-                last_pointer = scene->bcm_ptr;
-                bcm_signal = (last_pointer) ? scene->bcm_signalB : scene->bcm_signalA;
+/**
+ * @brief shift one complete set of bit planes from a pre-baked GPIO word stream.
+ * see map_byte_image_to_bcm for the stream layout. width and half_height are the scene geometry,
+ * constants in the specialized kernels (see scan_kernels)
+ */
+__attribute__((hot, always_inline))
+static inline void stream_planes(const scene_info *scene, const uint32_t *restrict stream,
+    volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr, hub_stats *stats, hub_trace *trace,
+    const uint16_t width, const uint8_t half_height) {
+
+    // the stream is plane major like the bcm buffers, bit_depth * half_height rows back to back
+    const uint8_t bit_depth   = scene->geometry.bit_depth;
+    const uint32_t latch      = scene->delays.latch;
+    uint64_t row_start        = (stats) ? hub_cycles() : 0;
+    uint64_t plane_start      = row_start;
+    ASSERT(width % SCAN_GROUP == 0);
+
+    for (uint8_t plane=0; plane<bit_depth; plane++) {
+        for (uint8_t y=0; y<half_height; y++) {
+            for (uint16_t x=0; x<width; x+=SCAN_GROUP) {
+                shift_stream_group(stream + x, width, out, set, trace);
+            }
+            stream += width;
+            // make sure enable pin is high (display off) while we are latching data
+            gpio_store(trace, GPIO_REG_SET, set, PIN_OE | PIN_LATCH);
+            spin(latch);
+            gpio_store(trace, GPIO_REG_CLR, clr, PIN_LATCH);
+            if (stats) {
+                telemetry_mark(&stats->row, &row_start);
             }
+        }
+        if (stats) {
+            telemetry_mark(&stats->plane[plane], &plane_start);
+        }
+    }
+}
+
+__attribute__((hot))
+void render_stream_planes(const scene_info *scene, const uint32_t *restrict stream,
+    volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr, hub_stats *stats) {
+    stream_planes(scene, stream, out, set, clr, stats, NULL, scene->geometry.width, scene->geometry.half_height);
+}
+
+
+/**
+ * @brief binary coded modulation scan out for Pi5. each row is shifted once per bit plane,
+ * latched, and then displayed for bcm_lsb_ns << plane nanoseconds.
+ *
+ * with scene->overlap_shift the latched plane stays lit while the next plane is shifted in and
+ * the display is only off for the latch. a plane whose hold would end mid shift is finished
+ * (and blanked) before the shift starts, so an OE pulse is never longer than its weight.
+ * 
+ * @param scene the scene to render
+ * @param out RIO Out, or unused with a trace
+ * @param set RIO SET
+ * @param clr RIO CLR
+ * @param trace records the stores instead of writing the registers if not NULL
+ */
+__attribute__((hot, always_inline))
+static inline void scan_binary(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr,
+    hub_trace *trace) {
+    const uint8_t  half_height = scene->geometry.half_height;
+    const uint16_t width       = scene->geometry.width;
+    const uint8_t  bit_depth   = scene->bit_depth;
+    const uint32_t row_words   = scene->geometry.row_words;
+    const uint32_t plane_words = scene->geometry.plane_words;
+    const bool     overlap     = scene->overlap_shift;
+
+    // hold time for each bit plane in hub_cycles() ticks
+    const uint64_t tick_hz = hub_tick_hz();
+    uint64_t hold_ticks[MAX_BINARY_BITS];
+    for (int i=0; i<bit_depth; i++) {
+        hold_ticks[i] = MAX(((uint64_t)scene->bcm_lsb_ns << i) * tick_hz / 1000000000ULL, 1);
+    }
+
+    // geometry.address[y] is the row before y, the row the PWM scan out shows while y is shifted in.
+    // here row y is shown after it is latched, so select y itself
+    uint32_t addr_map[half_height];
+    for (int i=0; i<half_height; i++) {
+        addr_map[i] = scene->geometry.address[(i + 1) % half_height];
+    }
+
+    uint32_t *bcm_signal = bcm_front_buffer(scene);
+    // every row of every plane is one row and one plane sample, shift, latch and hold
+    hub_stats *stats     = telemetry_create(scene);
+    uint64_t row_start   = hub_cycles();
+    uint64_t frame_start = row_start;
+
+    // the plane on the panel: its row address, OE (0 while lit) and when its hold ends
+    uint32_t shown       = addr_map[half_height - 1];
+    uint32_t dark        = PIN_OE;
+    uint64_t lit_end     = 0;
+    // the last shift, to tell if the plane on the panel would end during the next one
+    uint64_t shift_ticks = 0;
+
+    while(scene->do_render) {
+        const uint32_t latch = scene->delays.latch;
 
-            if (UNLIKELY(current_time_s >= last_time_s + 5)) {
+        for (uint16_t y=0; y<half_height; y++) {
+            const uint32_t row_offset = y * row_words;
 
-                if (scene->show_fps) {
-                    printf("Panel Refresh Rate: %dHz\n", frame_count / 5);
+            for (uint8_t plane=0; plane<bit_depth; plane++) {
+                const uint32_t *row = bcm_signal + (plane * plane_words) + row_offset;
+
+                if (!dark && hub_cycles() + shift_ticks > lit_end) {
+                    hold_until(lit_end);
+                    gpio_store(trace, GPIO_REG_SET, set, PIN_OE);
+                    dark = PIN_OE;
+                }
+                // the shown row stays selected (and lit if overlapped) while the plane is shifted in
+                const uint64_t shift_start = hub_cycles();
+                for (uint16_t x=0; x<width; x++) {
+                    asm volatile ("" : : : "memory");  // Prevents optimization
+                    gpio_store(trace, GPIO_REG_OUT, out, row[x] | shown | dark);
+                    gpio_store(trace, GPIO_REG_SET, set, PIN_CLK);
+                }
+                shift_ticks = hub_cycles() - shift_start;
+
+                // finish the shown plane, then blank only to latch and select the new row
+                hold_until(lit_end);
+                gpio_store(trace, GPIO_REG_SET, set, PIN_OE);
+                shown = addr_map[y];
+                gpio_store(trace, GPIO_REG_OUT, out, shown | PIN_OE | PIN_LATCH);
+                spin(latch);
+                gpio_store(trace, GPIO_REG_CLR, clr, PIN_LATCH);
+
+                // display the plane for its binary weight
+                gpio_store(trace, GPIO_REG_CLR, clr, PIN_OE);
+                lit_end = hub_cycles() + hold_ticks[plane];
+                dark    = 0;
+                if (!overlap) {
+                    hold_until(lit_end);
+                    gpio_store(trace, GPIO_REG_SET, set, PIN_OE);
+                    dark = PIN_OE;
+                }
+                if (stats) {
+                    const uint64_t start = row_start;
+                    telemetry_mark(&stats->row, &row_start);
+                    histogram_add(&stats->plane[plane], row_start - start);
                 }
-                frame_count = 0;
-                last_time_s = current_time_s;
             }
         }
+
+        // the last plane keeps its exact weight, it is not left on while we wait for vsync
+        if (!dark) {
+            hold_until(lit_end);
+            gpio_store(trace, GPIO_REG_SET, set, PIN_OE);
+            dark = PIN_OE;
+        }
+
+        // swap the buffers on vsync
+        refresh_pad(scene, stats, set, clr, false, trace);
+        vsync_signal(scene);
+        bcm_signal = bcm_front_buffer(scene);
+        gpio_delays_update(&scene->delays);
+        if (stats) {
+            telemetry_frame(scene, stats, &frame_start, bit_depth);
+        }
+        if (trace != NULL && hub_trace_refresh(trace)) {
+            scene->do_render = false;
+        }
     }
+    telemetry_destroy(stats);
 }
 
 
 /**
- * @brief you can cause render_forever to exit by updating the value of do_hub65_render pointer
- * EG:
- * 
- * 
+ * @brief Pi5 scan out of a pre-baked GPIO word stream, see render_stream_planes
+ */
+__attribute__((hot, always_inline))
+static inline void scan_stream(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr,
+    hub_trace *trace, const uint16_t width, const uint8_t half_height) {
+    const uint8_t bit_depth = scene->bit_depth;
+    uint32_t *bcm_signal    = bcm_front_buffer(scene);
+
+    // scan out timing, NULL unless show_fps or telemetry is set
+    hub_stats *stats     = telemetry_create(scene);
+    uint64_t frame_start = hub_cycles();
+
+    // address lines and OE are already in the stream, we only need to shift it out
+    while (scene->do_render) {
+        stream_planes(scene, bcm_signal, out, set, clr, stats, trace, width, half_height);
+
+        // swap the buffers on vsync
+        refresh_pad(scene, stats, set, clr, false, trace);
+        vsync_signal(scene);
+        bcm_signal = bcm_front_buffer(scene);
+        gpio_delays_update(&scene->delays);
+        if (stats) {
+            telemetry_frame(scene, stats, &frame_start, bit_depth);
+        }
+        if (trace != NULL && hub_trace_refresh(trace)) {
+            scene->do_render = false;
+        }
+    }
+    telemetry_destroy(stats);
+}
+
+/**
+ * @brief Pi5 PWM scan out. the row address and OE are merged into every word. with jitter_brightness
+ * OE is on for the clocks where the OE sequence is below scene->oe_threshold, see OE_SEQUENCE_STEP.
+ * width and half_height are the scene geometry, constants in the specialized kernels (see scan_kernels)
  */
-void render_forever(const scene_info *scene) {
+__attribute__((hot, always_inline))
+static inline void scan_pwm(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr,
+    hub_trace *trace, const uint16_t width, const uint8_t half_height) {
+    // position in the OE sequence, runs on through every row and refresh
+    uint32_t oe_phase = 0;
+    // if we are using BCM brightness, then OE is always 0 (0 is display on ironically)
+    const uint32_t oe_pin = (scene->jitter_brightness) ? PIN_OE : 0;
+    // pre compute some variables. let the compiler know the alignment for optimizations
+    const uint8_t  bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
+    // rows are back to back, a plane is half_height rows of width words
+    const uint32_t plane_words = (uint32_t)width * half_height;
+
+    // pointer to the current bcm data to be displayed
+    uint32_t *bcm_signal = bcm_front_buffer(scene);
+    ASSERT(width % SCAN_GROUP == 0);
+    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
+
+    // the row address lines, see bcm_geometry
+    const uint32_t *addr_map = scene->geometry.address;
+
+
+    // scan out timing, NULL unless show_fps or telemetry is set
+    hub_stats *stats       = telemetry_create(scene);
+    uint64_t row_start     = hub_cycles();
+    uint64_t plane_start   = row_start;
+    uint64_t frame_start   = row_start;
+
+    // uint8_t bright = scene->brightness;
+    while(scene->do_render) {
+        const uint32_t latch = scene->delays.latch;
+
+        // iterate over the bit plane
+        //PRE_TIME;
+        for (uint8_t pwm=0; pwm<bit_depth; pwm++) {
+            // for the current bit plane, render the entire frame. each plane is one contiguous run
+            uint32_t offset = pwm * plane_words;
+            for (uint16_t y=0; y<half_height; y++) {
+                asm volatile ("" : : : "memory");  // Prevents optimization
+                // hub_set_brightness() takes effect from the next row
+                const uint32_t oe_on   = atomic_load_explicit(&scene->oe_threshold, memory_order_relaxed);
+                const uint32_t address = addr_map[y];
+
+                // prefetch the same pixels of the next row while shifting this one
+                for (uint16_t x=0; x<width; x+=SCAN_GROUP) {
+                    shift_pwm_group(bcm_signal + offset + x, width, address, oe_pin, oe_on, &oe_phase, out, set, trace);
+                }
+                // advance to the next row in the bcm signal
+                offset += width;
+                // make sure enable pin is high (display off) while we are latching data
+                // latch the data for the entire row
+                gpio_store(trace, GPIO_REG_SET, set, PIN_OE | PIN_LATCH);
+                spin(latch);
+                gpio_store(trace, GPIO_REG_CLR, clr, PIN_LATCH);
+                if (stats) {
+                    telemetry_mark(&stats->row, &row_start);
+                }
+            }
+            if (stats) {
+                telemetry_mark(&stats->plane[pwm], &plane_start);
+            }
+        }
 
-    pid_t pid = getpid();
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(3, &cpuset);
+        // full set of bit planes shown, swap the buffers on vsync
+        refresh_pad(scene, stats, set, clr, false, trace);
+        vsync_signal(scene);
+        bcm_signal = bcm_front_buffer(scene);
+        gpio_delays_update(&scene->delays);
+        if (stats) {
+            telemetry_frame(scene, stats, &frame_start, bit_depth);
+        }
+        if (trace != NULL && hub_trace_refresh(trace)) {
+            scene->do_render = false;
+        }
+    }
+    telemetry_destroy(stats);
+}
 
-    if (sched_setaffinity(pid, sizeof(cpuset), &cpuset) != 0) {
-	    die("unable to set CPU affinity to 3\n");
+int hub_pi_model(void) {
+    static int cpu_model = -1;
+    if (cpu_model >= 0) {
+        return cpu_model;
     }
 
-    // check the CPU model to determine which GPIO function to use
     // note one cannot use file_get_contents as this file is zero length...
     char *line = NULL;
     size_t line_sz;
-    int cpu_model = 0;
+    cpu_model = 0;
     FILE *file = fopen("/proc/cpuinfo", "rb");
     if (file == NULL) {
         die("Could not open file /proc/cpuinfo\n");
     }
-    while (getline(&line, &line_sz, file)) {
+    while (getline(&line, &line_sz, file) != -1) {
         if (strstr(line, "Pi 5") != NULL) {
             cpu_model = 5;
             break;
@@ -410,109 +967,351 @@ void render_forever(const scene_info *scene) {
     }
     free(line);
     fclose(file);
-    if (cpu_model == 0) die("Only Pi5, Pi4 and Pi3 are currently supported");
-    if (cpu_model < 5 ) {
-        render_forever_pi4(scene, cpu_model);
+    return cpu_model;
+}
+
+typedef void (*scan_kernel_fn)(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr);
+
+/**
+ * @brief the Pi5 PWM and pre-baked stream loops of one panel geometry
+ */
+typedef struct {
+    uint16_t       width;
+    uint8_t        half_height;
+    const char    *name;
+    scan_kernel_fn pwm;
+    scan_kernel_fn stream;
+} scan_kernel;
+
+/**
+ * instantiate scan_pwm and scan_stream with the shift width and scan rows as constants. the row and
+ * group loops get constant trip counts and the plane and row offsets fold to immediates. traces
+ * always run the generic loops, see scan_encoding
+ */
+#define SCAN_KERNELS(W, H) \
+    __attribute__((hot)) static void scan_pwm_##W##_##H(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) { \
+        scan_pwm(scene, out, set, clr, NULL, W, H); \
+    } \
+    __attribute__((hot)) static void scan_stream_##W##_##H(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) { \
+        scan_stream(scene, out, set, clr, NULL, W, H); \
+    }
+#define SCAN_KERNEL_ENTRY(W, H) \
+    { W, H, #W "x" #H, scan_pwm_##W##_##H, scan_stream_##W##_##H }
+
+// chains of 1 to 6 64 pixel panels (or 2 / 3 128 pixel panels) at 1/16 and 1/32 scan
+SCAN_KERNELS(64, 16)
+SCAN_KERNELS(64, 32)
+SCAN_KERNELS(128, 16)
+SCAN_KERNELS(128, 32)
+SCAN_KERNELS(192, 16)
+SCAN_KERNELS(192, 32)
+SCAN_KERNELS(256, 16)
+SCAN_KERNELS(256, 32)
+SCAN_KERNELS(384, 16)
+SCAN_KERNELS(384, 32)
+
+// every other geometry, width and half_height read from scene->geometry
+static void scan_pwm_generic(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) {
+    scan_pwm(scene, out, set, clr, NULL, scene->geometry.width, scene->geometry.half_height);
+}
+static void scan_stream_generic(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) {
+    scan_stream(scene, out, set, clr, NULL, scene->geometry.width, scene->geometry.half_height);
+}
+
+// the trace backend records every store, one copy of each loop for every geometry is enough
+__attribute__((cold))
+static void scan_pwm_trace(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) {
+    scan_pwm(scene, out, set, clr, scene->gpio_trace, scene->geometry.width, scene->geometry.half_height);
+}
+__attribute__((cold))
+static void scan_stream_trace(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr) {
+    scan_stream(scene, out, set, clr, scene->gpio_trace, scene->geometry.width, scene->geometry.half_height);
+}
+
+static const scan_kernel scan_kernels[] = {
+    SCAN_KERNEL_ENTRY(64, 16),  SCAN_KERNEL_ENTRY(64, 32),
+    SCAN_KERNEL_ENTRY(128, 16), SCAN_KERNEL_ENTRY(128, 32),
+    SCAN_KERNEL_ENTRY(192, 16), SCAN_KERNEL_ENTRY(192, 32),
+    SCAN_KERNEL_ENTRY(256, 16), SCAN_KERNEL_ENTRY(256, 32),
+    SCAN_KERNEL_ENTRY(384, 16), SCAN_KERNEL_ENTRY(384, 32),
+};
+static const scan_kernel scan_kernel_generic = {
+    0, 0, "generic", scan_pwm_generic, scan_stream_generic
+};
+
+/**
+ * @brief the specialized scan loops for this geometry, scan_kernel_generic if there are none
+ */
+static const scan_kernel *scan_kernels_find(const bcm_geometry *geometry) {
+    for (size_t i=0; i < sizeof(scan_kernels) / sizeof(scan_kernels[0]); i++) {
+        if (scan_kernels[i].width == geometry->width && scan_kernels[i].half_height == geometry->half_height) {
+            debug("scan kernel %s\n", scan_kernels[i].name);
+            return &scan_kernels[i];
+        }
+    }
+    debug("scan kernel generic for %dx%d\n", geometry->width, geometry->half_height);
+    return &scan_kernel_generic;
+}
+
+/**
+ * @brief the scan out loop for the scene's bcm encoding. out, set and clr are the GPIO registers,
+ * or memory for the memory and trace backends. trace records the stores when not NULL, it must be
+ * NULL or scene->gpio_trace. traces, pairs and binary BCM run the runtime geometry loops
+ */
+__attribute__((always_inline))
+static inline void scan_encoding(scene_info *scene, volatile uint32_t *out, volatile uint32_t *set, volatile uint32_t *clr,
+    hub_trace *trace) {
+    const scan_kernel *kernel = scan_kernels_find(&scene->geometry);
+    if (scene->set_clr_pairs) {
+        scan_pairs(scene, set, clr, trace);
+    } else if (scene->bcm_mode == BCM_MODE_BINARY) {
+        scan_binary(scene, out, set, clr, trace);
+    } else if (scene->prebaked_stream) {
+        ((trace != NULL) ? scan_stream_trace : kernel->stream)(scene, out, set, clr);
+    } else {
+        ((trace != NULL) ? scan_pwm_trace : kernel->pwm)(scene, out, set, clr);
+    }
+}
+
+
+static void *pi5_init(scene_info *scene) {
+    if (scene->set_clr_pairs) {
+        die("Pi5 scan out requires bcm buffers encoded without scene->set_clr_pairs\n");
     }
-    // This is Pi 5
     srand(time(NULL));
     // map the gpio address to we can control the GPIO pins
     uint32_t *PERIBase = map_gpio(0, 5); // for root on pi5 (/dev/mem, offset is 0xD0000)
-    // offset to the RIO registers (required for #define register access. 
-    // TODO: this needs to be improved and #define to RIOBase removed)
-    uint32_t *RIOBase;
-    RIOBase = PERIBase + RIO5_OFFSET;
     configure_gpio(PERIBase, 5);
-         
-    // index into the OE jitter mask
-    uint16_t jitter_idx = 0;
-    // pre compute some variables. let the compiler know the alignment for optimizations
-    const uint8_t  half_height __attribute__((aligned(16))) = scene->panel_height / 2;
-    const uint16_t width __attribute__((aligned(16))) = scene->width;
-    const uint8_t  bit_depth __attribute__((aligned(BIT_DEPTH_ALIGNMENT))) = scene->bit_depth;
+    // offset to the RIO registers, the rio / rioSET / rioCLR macros index from RIOBase
+    return PERIBase + RIO5_OFFSET;
+}
 
-    // pointer to the current bcm data to be displayed
-    uint32_t *bcm_signal = scene->bcm_signalA;
-    ASSERT(width % 16 == 0);
-    ASSERT(half_height % 16 == 0);
-    ASSERT(bit_depth % BIT_DEPTH_ALIGNMENT == 0);
+__attribute__((hot))
+static void pi5_scan(scene_info *scene, void *state) {
+    uint32_t *RIOBase = (uint32_t*)state;
 
-    bool last_pointer = scene->bcm_ptr;
+    const scan_kernel *kernel = scan_kernels_find(&scene->geometry);
 
-    // create the OE jitter mask to control screen brightness
-    // if we are using BCM brightness, then set OE to 0 (0 is display on ironically)
-    uint32_t *jitter_mask = create_jitter_mask(JITTER_SIZE, scene->brightness);
-    if (scene->jitter_brightness == false) {
-        memset(jitter_mask, 0, JITTER_SIZE);
+    if (scene->bcm_mode == BCM_MODE_BINARY) {
+        scan_binary(scene, &rio->Out, &rioSET->Out, &rioCLR->Out, NULL);
+    } else if (scene->prebaked_stream) {
+        kernel->stream(scene, &rio->Out, &rioSET->Out, &rioCLR->Out);
+    } else {
+        kernel->pwm(scene, &rio->Out, &rioSET->Out, &rioCLR->Out);
     }
+}
 
-    // store the row to address mapping in an array for faster access
-    uint32_t addr_map[half_height];
-    for (int i=0; i<half_height; i++) {
-        addr_map[i] = row_to_address(i, half_height);
+static void gpio_close(scene_info *scene, void *state) {
+    (void)scene;
+    (void)state;
+    // the GPIO mapping lives until the process exits, like it always has
+}
+
+const hub_backend hub_backend_pi5 = {
+    .name     = "pi5",
+    .pi_model = 5,
+    .init     = pi5_init,
+    .scan     = pi5_scan,
+    .stats    = NULL,
+    .close    = gpio_close
+};
+
+
+/**
+ * internal method for rendering on pi zero, 3 and 4
+ */
+static void *pi4_init(scene_info *scene) {
+    if (scene->prebaked_stream) {
+        die("pre-baked GPIO streams are only supported on Pi5\n");
+    }
+    if (scene->bcm_mode == BCM_MODE_BINARY) {
+        die("binary BCM is only supported on Pi5\n");
+    }
+    if (!scene->set_clr_pairs) {
+        die("Pi3/4 scan out requires bcm buffers encoded with scene->set_clr_pairs\n");
     }
 
+    srand(time(NULL));
+    const int version = (hub_pi_model() == 3) ? 3 : 4;
+    // map the gpio address to we can control the GPIO pins
+    uint32_t *PERIBase = map_gpio(0, version);
+    configure_gpio(PERIBase, version);
+    return PERIBase;
+}
 
-    time_t last_time_s     = time(NULL);
-    uint32_t frame_count   = 0;
-    // uint32_t addr_pins     = 0;
-    // uint32_t color_pins    = 0;
+__attribute__((hot))
+static void pi4_scan(scene_info *scene, void *state) {
+    uint32_t *PERIBase = (uint32_t*)state;
+    scan_pairs(scene, &PERIBase[7], &PERIBase[10], NULL);
+}
 
+const hub_backend hub_backend_pi4 = {
+    .name     = "pi4",
+    .pi_model = 4,
+    .init     = pi4_init,
+    .scan     = pi4_scan,
+    .stats    = NULL,
+    .close    = gpio_close
+};
 
-    // uint8_t bright = scene->brightness;
-    while(scene->do_render) {
 
-        // iterate over the bit plane
-        //PRE_TIME;
-        for (uint8_t pwm=0; pwm<bit_depth; pwm++) {
-            time_t current_time_s = time(NULL);
-            frame_count++;
-            // for the current bit plane, render the entire frame
-            uint32_t offset = pwm;
-            for (uint16_t y=0; y<half_height; y++) {
-                asm volatile ("" : : : "memory");  // Prevents optimization
+/**
+ * @brief registers of the memory backend and the refresh count when it started
+ */
+typedef struct {
+    volatile uint32_t out;
+    volatile uint32_t set;
+    volatile uint32_t clr;
+    uint32_t start_seq;
+    uint64_t start_ticks;
+    uint64_t end_ticks;
+} memory_sink;
+
+static void *memory_init(scene_info *scene) {
+    memory_sink *sink = (memory_sink*)calloc(1, sizeof(memory_sink));
+    if (sink == NULL) {
+        die("unable to allocate memory backend\n");
+    }
+    sink->start_seq   = atomic_load(&scene->vsync_seq);
+    sink->start_ticks = hub_cycles();
+    return sink;
+}
 
-                // compute the bcm row start address for y
-                // uint32_t offset = ((y * scene->width ) * bit_depth) + pwm;
+__attribute__((hot))
+static void memory_scan(scene_info *scene, void *state) {
+    memory_sink *sink = (memory_sink*)state;
+    // the same loops as the GPIO backends with literal NULL traces, only the stores land in memory
+    scan_encoding(scene, &sink->out, &sink->set, &sink->clr, NULL);
+    sink->end_ticks = hub_cycles();
+}
 
-                for (uint16_t x=0; x<width; x++) {
-                    asm volatile ("" : : : "memory");  // Prevents optimization
-                    // set all bits in 1 op. RGB data, current row address and the OE jitter mask (brightness control)
-                    rio->Out = bcm_signal[offset] | addr_map[y] | jitter_mask[jitter_idx];
+static void memory_stats(FILE *out, const scene_info *scene, const void *state) {
+    const memory_sink *sink  = (const memory_sink*)state;
+    const uint32_t refreshes = atomic_load(&scene->vsync_seq) - sink->start_seq;
+    const double   seconds   = (double)(sink->end_ticks - sink->start_ticks) / hub_tick_hz();
+    fprintf(out, "memory backend: %u refreshes in %.3fs, %.1fHz\n", refreshes, seconds, (seconds > 0) ? refreshes / seconds : 0.0);
+}
 
-                    // SLOW2
-                    // toggle clock pin high
-                    rioSET->Out = PIN_CLK;
+static void memory_close(scene_info *scene, void *state) {
+    (void)scene;
+    free(state);
+}
 
-                    // advance the global OE jitter mask 1 frame
-                    jitter_idx = (jitter_idx + 1) % JITTER_SIZE;
+const hub_backend hub_backend_memory = {
+    .name     = "memory",
+    .pi_model = 0,
+    .init     = memory_init,
+    .scan     = memory_scan,
+    .stats    = memory_stats,
+    .close    = memory_close
+};
 
-                    // advance to the next pixel in the bcm signal
-                    offset += bit_depth + 1;
-                }
-                // make sure enable pin is high (display off) while we are latching data
-                // latch the data for the entire row
-                rioSET->Out = PIN_OE | PIN_LATCH;
-                SLOW2
-                rioCLR->Out = PIN_LATCH;
-            }
 
-            // swap the buffers on vsync
-            if (UNLIKELY(scene->bcm_ptr != last_pointer)) {
-                last_pointer = scene->bcm_ptr;
-                bcm_signal = (last_pointer) ? scene->bcm_signalB : scene->bcm_signalA;
-            }
+static void *trace_init(scene_info *scene) {
+    if (scene->gpio_trace == NULL) {
+        die("the trace backend records to scene->gpio_trace, see hub_trace_create()\n");
+    }
+    return scene->gpio_trace;
+}
 
-            if (UNLIKELY(current_time_s >= last_time_s + 5)) {
-                if (scene->show_fps) {
-                    printf("Panel Refresh Rate: %dHz\n", frame_count / 5);
-                }
-                frame_count = 0;
-                last_time_s = current_time_s;
-            }
+/**
+ * @brief run the scan out loop for the scene's bcm encoding with every register store recorded
+ * to scene->gpio_trace. no GPIO is touched, so this runs on any machine
+ */
+__attribute__((cold))
+static void trace_scan(scene_info *scene, void *state) {
+    // never written, gpio_store records the stores
+    volatile uint32_t unused = 0;
+    scan_encoding(scene, &unused, &unused, &unused, (hub_trace*)state);
+}
+
+static void trace_stats(FILE *out, const scene_info *scene, const void *state) {
+    (void)scene;
+    const hub_trace *trace = (const hub_trace*)state;
+    fprintf(out, "trace backend: %lu stores in %u refreshes\n", (unsigned long)trace->count, trace->refreshes);
+}
+
+static void trace_close(scene_info *scene, void *state) {
+    (void)scene;
+    hub_trace_flush((hub_trace*)state);
+}
+
+const hub_backend hub_backend_trace = {
+    .name     = "trace",
+    .pi_model = 0,
+    .init     = trace_init,
+    .scan     = trace_scan,
+    .stats    = trace_stats,
+    .close    = trace_close
+};
+
+
+const hub_backend *hub_backend_find(const char *name) {
+    static const hub_backend *backends[] = {
+        &hub_backend_pi5, &hub_backend_pi4, &hub_backend_memory, &hub_backend_trace, &hub_backend_preview
+    };
+    for (size_t i=0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcasecmp(name, backends[i]->name) == 0) {
+            return backends[i];
         }
+    }
+    return NULL;
+}
 
+const hub_backend *hub_backend_select(const scene_info *scene) {
+    if (scene->backend != NULL) {
+        return scene->backend;
     }
+    // record the register stores instead of driving the pins, see trace.h
+    if (scene->gpio_trace != NULL) {
+        return &hub_backend_trace;
+    }
+    // check the CPU model to determine which GPIO backend to use
+    const int cpu_model = hub_pi_model();
+    if (cpu_model == 0) die("Only Pi5, Pi4 and Pi3 are currently supported");
+    return (cpu_model < 5) ? &hub_backend_pi4 : &hub_backend_pi5;
+}
+
+void hub_vsync_signal(scene_info *scene) {
+    vsync_signal(scene);
+}
+
+uint32_t oe_threshold(const uint8_t brightness) {
+    // 255 * 0x01010101 is 0xFFFFFFFF
+    return brightness * 0x01010101U;
 }
 
+void hub_set_brightness(scene_info *scene, const uint8_t brightness) {
+    scene->brightness = brightness;
+    atomic_store_explicit(&scene->oe_threshold, oe_threshold(brightness), memory_order_relaxed);
+}
 
+/**
+ * @brief you can cause render_forever to exit by updating the value of do_hub65_render pointer
+ * EG:
+ * 
+ * 
+ */
+void render_forever(scene_info *scene) {
+
+    // pin only this thread, optionally lock memory and go SCHED_FIFO. see realtime.h
+    realtime_setup_scanout(scene);
+    // spin counts for the GPIO settle times at the current clock, on the scan out cpu.
+    // frequency changes are picked up by a watcher thread on another cpu
+    gpio_delays_init(&scene->delays, scene->cpufreq_file);
+    gpio_delays_watch(scene, &scene->delays);
+
+    // the OE duty cycle of scene->brightness, in case it was set without hub_set_brightness()
+    atomic_store(&scene->oe_threshold, oe_threshold(scene->brightness));
+    // fixed refresh_hz deadlines, timed from the first refreshes of the scan out loop
+    refresh_pacer_init(&scene->pacer, scene->refresh_hz);
+
+    const hub_backend *backend = hub_backend_select(scene);
+    void *state = backend->init(scene);
+    backend->scan(scene, state);
+    if (scene->show_fps && backend->stats != NULL) {
+        backend->stats(stdout, scene, state);
+    }
+    backend->close(scene, state);
+    gpio_delays_unwatch(&scene->delays);
+}
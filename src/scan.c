@@ -0,0 +1,115 @@
+/**
+ * scan patterns for multiplexed (outdoor 1/4, 1/8 ...) panels.
+ *
+ * these panels select fewer rows than half their height, so each address drives several rows
+ * and the shift register runs through pixels of all of them. bcm_geometry_init works out the
+ * scan layout once: the address lines of every row and a gather table from scan layout to
+ * image pixels. the bcm_mapper gathers each frame into scan layout with one table lookup per
+ * pixel, so the encoders and render_forever never see the multiplexing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "scan.h"
+
+
+static const scan_pattern scan_patterns[] = {
+    // whole panel rows, top row first
+    { .name = "straight",  .stripe = 0, .reverse = false, .address = SCAN_ADDRESS_BINARY },
+    // whole panel rows, bottom row first
+    { .name = "stripe",    .stripe = 0, .reverse = true,  .address = SCAN_ADDRESS_BINARY },
+    // 8 pixels of the top row, 8 of the bottom row, then the next 8 of the top row
+    { .name = "zstripe8",  .stripe = 8, .reverse = false, .address = SCAN_ADDRESS_BINARY },
+    { .name = "zstripe8r", .stripe = 8, .reverse = true,  .address = SCAN_ADDRESS_BINARY },
+    { .name = "zstripe4",  .stripe = 4, .reverse = false, .address = SCAN_ADDRESS_BINARY },
+    // whole panel rows, one address line per row
+    { .name = "direct",    .stripe = 0, .reverse = false, .address = SCAN_ADDRESS_DIRECT },
+};
+
+const scan_pattern *scan_pattern_find(const char *name) {
+    for (size_t i=0; i < sizeof(scan_patterns) / sizeof(scan_patterns[0]); i++) {
+        if (strcasecmp(name, scan_patterns[i].name) == 0) {
+            return &scan_patterns[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t scan_row_address(const scan_pattern *pattern, const uint8_t row) {
+    static const uint8_t lines[5] = { ADDRESS_A, ADDRESS_B, ADDRESS_C, ADDRESS_D, ADDRESS_E };
+    uint32_t bitmask = 0;
+
+    if (pattern != NULL && pattern->address == SCAN_ADDRESS_DIRECT) {
+        return (row < 5) ? 1U << lines[row] : 0;
+    }
+    for (uint8_t i=0; i < 5; i++) {
+        if (row & (1 << i)) {
+            bitmask |= 1U << lines[i];
+        }
+    }
+    return bitmask;
+}
+
+uint32_t *scan_gather_create(const scene_info *scene) {
+    const bcm_geometry *geometry = &scene->geometry;
+    const uint16_t panel_rows  = scene->panel_height / 2;
+    const uint16_t scan_rows   = geometry->half_height;
+    const uint16_t k           = panel_rows / scan_rows;
+    if (k <= 1) {
+        return NULL;
+    }
+
+    const scan_pattern *pattern = scene->scan_pattern;
+    const uint16_t panel_width  = scene->panel_width;
+    const uint16_t stripe       = (pattern != NULL && pattern->stripe > 0) ? pattern->stripe : panel_width;
+    const bool     reverse      = (pattern != NULL) && pattern->reverse;
+    const uint8_t  ports        = MIN(scene->num_ports, 3);
+    const uint32_t shift_width  = geometry->width;
+
+    uint32_t *gather = (uint32_t*)malloc((size_t)shift_width * scan_rows * 2 * ports * sizeof(uint32_t));
+    if (gather == NULL) {
+        die("unable to allocate scan gather table\n");
+    }
+
+    uint32_t *out = gather;
+    for (uint8_t port=0; port < ports; port++) {
+        for (uint8_t half=0; half < 2; half++) {
+            for (uint16_t y=0; y < scan_rows; y++) {
+                for (uint32_t sx=0; sx < shift_width; sx++) {
+                    // each chained panel shifts k of its rows, panel_width * k pixels
+                    const uint32_t panel = sx / (panel_width * k);
+                    const uint32_t p     = sx % (panel_width * k);
+                    const uint32_t chunk = p / stripe;
+                    const uint16_t row   = (reverse) ? (k - 1) - (chunk % k) : chunk % k;
+                    const uint32_t x     = (panel * panel_width) + ((chunk / k) * stripe) + (p % stripe);
+                    const uint32_t image_y = (port * scene->panel_height) + (half * panel_rows) + (row * scan_rows) + y;
+                    *out++ = (image_y * scene->width) + x;
+                }
+            }
+        }
+    }
+    return gather;
+}
+
+__attribute__((hot))
+void scan_gather_image(const scene_info *scene, const uint8_t *restrict image, uint8_t *restrict out) {
+    const uint32_t *restrict gather = scene->scan_gather;
+    const uint32_t pixels = (uint32_t)scene->geometry.width * scene->geometry.half_height * 2 * MIN(scene->num_ports, 3);
+
+    if (scene->stride == 4) {
+        for (uint32_t i=0; i < pixels; i++) {
+            memcpy(out + (i * 4), image + (gather[i] * 4), 4);
+        }
+    } else {
+        for (uint32_t i=0; i < pixels; i++) {
+            memcpy(out + (i * 3), image + (gather[i] * 3), 3);
+        }
+    }
+}
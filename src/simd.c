@@ -0,0 +1,311 @@
+/**
+ * SIMD bcm encoders.
+ *
+ * the scalar encoders in pixels.c build one 32 bit GPIO word per bit plane for a single
+ * pixel position (6 pixels over 3 ports) with 18 table lookups, masks and shifts per plane.
+ * here the table lookups for a group of 16 pixel positions are done once, then every bit plane
+ * is a bit matrix transpose of those 18 words per pixel: bit j of input k moves to pin k of
+ * the word for plane j. that is done 4 (SSE2, NEON) or 8 (AVX2) pixels at a time and written
+ * straight to the plane major bcm buffer.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sys/param.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "rpihub75.h"
+#include "simd.h"
+
+
+void bcm_pin_table_init(bcm_pin_table *table, const scene_info *scene) {
+    // pins for each port, top and bottom pixel, red, green, blue
+    static const uint8_t port_pins[3][2][3] = {
+        {{ADDRESS_P0_R1, ADDRESS_P0_G1, ADDRESS_P0_B1}, {ADDRESS_P0_R2, ADDRESS_P0_G2, ADDRESS_P0_B2}},
+        {{ADDRESS_P1_R1, ADDRESS_P1_G1, ADDRESS_P1_B1}, {ADDRESS_P1_R2, ADDRESS_P1_G2, ADDRESS_P1_B2}},
+        {{ADDRESS_P2_R1, ADDRESS_P2_G1, ADDRESS_P2_B1}, {ADDRESS_P2_R2, ADDRESS_P2_G2, ADDRESS_P2_B2}}
+    };
+    // which color pin image byte 0, 1, 2 drives for each pixel order
+    uint8_t color_of_byte[3] = {0, 1, 2};
+    switch (scene->pixel_order) {
+    case PIXEL_ORDER_RGB:
+        break;
+    case PIXEL_ORDER_RBG:
+        color_of_byte[1] = 2;
+        color_of_byte[2] = 1;
+        break;
+    case PIXEL_ORDER_BGR:
+        color_of_byte[0] = 2;
+        color_of_byte[2] = 0;
+        break;
+    }
+
+    // ports are stacked vertically in the image, each half panel below the last
+    const uint32_t panel_stride = scene->geometry.width * scene->geometry.half_height * scene->stride;
+    table->count = 0;
+    for (uint8_t port=0; port < MIN(scene->num_ports, 3); port++) {
+        for (uint8_t half=0; half < 2; half++) {
+            for (uint8_t byte=0; byte < 3; byte++) {
+                table->offset[table->count] = ((port * 2 + half) * panel_stride) + byte;
+                table->pin[table->count]    = port_pins[port][half][color_of_byte[byte]];
+                table->lut[table->count]    = byte;
+                table->count++;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief look up the tone mapped bcm word of every input for BCM_SIMD_GROUP pixels.
+ * 64 bit tables are split into lo (planes 0-31) and hi (planes 32-63) words
+ */
+__attribute__((always_inline))
+static inline void gather_group(
+    const bcm_pin_table *table,
+    const void *bits,
+    const uint8_t *__restrict__ image,
+    uint32_t lo[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    uint32_t hi[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    const bool wide,
+    const uint8_t count,
+    const uint8_t stride) {
+
+    if (wide) {
+        const uint64_t *bits64 = (const uint64_t*)bits;
+        for (uint8_t k=0; k < count; k++) {
+            const uint64_t *lut = bits64 + (table->lut[k] * 256);
+            const uint8_t *src  = image + table->offset[k];
+            for (uint8_t i=0; i < BCM_SIMD_GROUP; i++) {
+                const uint64_t word = lut[src[i * stride]];
+                lo[k][i] = (uint32_t)word;
+                hi[k][i] = (uint32_t)(word >> 32);
+            }
+        }
+    } else {
+        const uint32_t *bits32 = (const uint32_t*)bits;
+        for (uint8_t k=0; k < count; k++) {
+            const uint32_t *lut = bits32 + (table->lut[k] * 256);
+            const uint8_t *src  = image + table->offset[k];
+            for (uint8_t i=0; i < BCM_SIMD_GROUP; i++) {
+                lo[k][i] = lut[src[i * stride]];
+            }
+        }
+    }
+}
+
+/**
+ * @brief transpose bit (plane - shift_base) of the first count input words to the input's pin for
+ * planes [first_plane, last_plane) and store BCM_SIMD_GROUP words to each plane
+ */
+typedef void (*plane_kernel_fn)(
+    const uint32_t words[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    const bcm_pin_table *table,
+    const uint8_t count,
+    const uint8_t first_plane,
+    const uint8_t last_plane,
+    const uint8_t shift_base,
+    uint32_t *__restrict__ bcm_signal,
+    const uint32_t plane_words);
+
+/**
+ * @brief shared row loop. every argument after planes is a compile time constant in the
+ * SIMD_ENCODER() specializations below, so the kernel is inlined with a fixed input count
+ * and the gather loads use a fixed stride.
+ */
+__attribute__((always_inline))
+static inline void encode_row(
+    const scene_info *scene,
+    const bcm_pin_table *table,
+    const void *bits,
+    uint32_t *__restrict__ bcm_signal,
+    const uint8_t *__restrict__ image,
+    bcm_encode_scratch *__restrict__ scratch,
+    const plane_kernel_fn planes,
+    const bool wide,
+    const uint8_t ports,
+    const uint8_t stride) {
+
+    const uint8_t  count       = ports * 6;
+    const uint8_t  bit_depth   = scene->bit_depth;
+    const uint32_t plane_words = scene->geometry.plane_words;
+    const uint32_t group_bytes = BCM_SIMD_GROUP * stride;
+    ASSERT(scene->geometry.width % BCM_SIMD_GROUP == 0);
+    ASSERT(table->count == count);
+
+    for (uint16_t x=0; x < scene->geometry.width; x += BCM_SIMD_GROUP) {
+        gather_group(table, bits, image, scratch->lo, scratch->hi, wide, count, stride);
+        planes(scratch->lo, table, count, 0, MIN(bit_depth, 32), 0, bcm_signal + x, plane_words);
+        if (wide) {
+            planes(scratch->hi, table, count, 32, bit_depth, 32, bcm_signal + x, plane_words);
+        }
+        image += group_bytes;
+    }
+}
+
+// one specialization of each ISA kernel for every bit depth class (32: uint32_t bits, 64: uint64_t bits),
+// port count and stride. the pixel order only changes the pins, which are loaded once per call
+#define SIMD_ENCODER(isa, depth, ports, stride) \
+    __attribute__((hot)) SIMD_TARGET_##isa \
+    static void encode_row_##isa##_##depth##_p##ports##_s##stride(const scene_info *scene, const bcm_pin_table *table, \
+        const void *bits, uint32_t *bcm_signal, const uint8_t *image, bcm_encode_scratch *scratch) { \
+        encode_row(scene, table, bits, bcm_signal, image, scratch, planes_##isa, (depth) == 64, ports, stride); \
+    }
+
+#define SIMD_ENCODER_STRIDES(isa, depth, ports) SIMD_ENCODER(isa, depth, ports, 3) SIMD_ENCODER(isa, depth, ports, 4)
+#define SIMD_ENCODER_PORTS(isa, depth) \
+    SIMD_ENCODER_STRIDES(isa, depth, 1) SIMD_ENCODER_STRIDES(isa, depth, 2) SIMD_ENCODER_STRIDES(isa, depth, 3)
+#define SIMD_ENCODERS(isa) SIMD_ENCODER_PORTS(isa, 32) SIMD_ENCODER_PORTS(isa, 64)
+
+#define SIMD_NAME(isa, depth, ports, stride) encode_row_##isa##_##depth##_p##ports##_s##stride
+#define SIMD_ENTRY_PORTS(isa, depth, ports) {SIMD_NAME(isa, depth, ports, 3), SIMD_NAME(isa, depth, ports, 4)}
+#define SIMD_ENTRY_DEPTH(isa, depth) { \
+    SIMD_ENTRY_PORTS(isa, depth, 1), SIMD_ENTRY_PORTS(isa, depth, 2), SIMD_ENTRY_PORTS(isa, depth, 3) }
+
+/** @brief encoders of one ISA indexed by [bit depth > 32][ports - 1][stride == 4] */
+#define SIMD_TABLE(isa) \
+    static const bcm_row_encoder_fn isa##_encoders[2][3][2] = { SIMD_ENTRY_DEPTH(isa, 32), SIMD_ENTRY_DEPTH(isa, 64) };
+
+
+#if defined(__ARM_NEON)
+
+#define SIMD_TARGET_neon
+
+__attribute__((hot, always_inline))
+static inline void planes_neon(
+    const uint32_t words[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    const bcm_pin_table *table,
+    const uint8_t count,
+    const uint8_t first_plane,
+    const uint8_t last_plane,
+    const uint8_t shift_base,
+    uint32_t *__restrict__ bcm_signal,
+    const uint32_t plane_words) {
+
+    // vshlq shifts right for negative counts, so bit j lands on the pin with 1 shift and 1 mask
+    uint32x4_t pin_mask[BCM_MAX_INPUTS];
+    for (uint8_t k=0; k < count; k++) {
+        pin_mask[k] = vdupq_n_u32(1U << table->pin[k]);
+    }
+
+    for (uint8_t j=first_plane; j < last_plane; j++) {
+        uint32_t *out = bcm_signal + (j * plane_words);
+        const int32_t bit = j - shift_base;
+        for (uint8_t v=0; v < BCM_SIMD_GROUP; v += 4) {
+            uint32x4_t acc = vdupq_n_u32(0);
+            for (uint8_t k=0; k < count; k++) {
+                const uint32x4_t w = vld1q_u32(&words[k][v]);
+                acc = vorrq_u32(acc, vandq_u32(vshlq_u32(w, vdupq_n_s32(table->pin[k] - bit)), pin_mask[k]));
+            }
+            vst1q_u32(out + v, acc);
+        }
+    }
+}
+
+SIMD_ENCODERS(neon)
+SIMD_TABLE(neon)
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+#define SIMD_TARGET_sse2 __attribute__((target("sse2")))
+#define SIMD_TARGET_avx2 __attribute__((target("avx2")))
+
+__attribute__((hot, always_inline, target("sse2")))
+static inline void planes_sse2(
+    const uint32_t words[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    const bcm_pin_table *table,
+    const uint8_t count,
+    const uint8_t first_plane,
+    const uint8_t last_plane,
+    const uint8_t shift_base,
+    uint32_t *__restrict__ bcm_signal,
+    const uint32_t plane_words) {
+
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i pin_count[BCM_MAX_INPUTS];
+    for (uint8_t k=0; k < count; k++) {
+        pin_count[k] = _mm_cvtsi32_si128(table->pin[k]);
+    }
+
+    for (uint8_t j=first_plane; j < last_plane; j++) {
+        uint32_t *out = bcm_signal + (j * plane_words);
+        const __m128i bit = _mm_cvtsi32_si128(j - shift_base);
+        for (uint8_t v=0; v < BCM_SIMD_GROUP; v += 4) {
+            __m128i acc = _mm_setzero_si128();
+            for (uint8_t k=0; k < count; k++) {
+                __m128i w = _mm_load_si128((const __m128i*)&words[k][v]);
+                w   = _mm_and_si128(_mm_srl_epi32(w, bit), one);
+                acc = _mm_or_si128(acc, _mm_sll_epi32(w, pin_count[k]));
+            }
+            _mm_storeu_si128((__m128i*)(out + v), acc);
+        }
+    }
+}
+
+__attribute__((hot, always_inline, target("avx2")))
+static inline void planes_avx2(
+    const uint32_t words[BCM_MAX_INPUTS][BCM_SIMD_GROUP],
+    const bcm_pin_table *table,
+    const uint8_t count,
+    const uint8_t first_plane,
+    const uint8_t last_plane,
+    const uint8_t shift_base,
+    uint32_t *__restrict__ bcm_signal,
+    const uint32_t plane_words) {
+
+    const __m256i one = _mm256_set1_epi32(1);
+    __m128i pin_count[BCM_MAX_INPUTS];
+    for (uint8_t k=0; k < count; k++) {
+        pin_count[k] = _mm_cvtsi32_si128(table->pin[k]);
+    }
+
+    for (uint8_t j=first_plane; j < last_plane; j++) {
+        uint32_t *out = bcm_signal + (j * plane_words);
+        const __m128i bit = _mm_cvtsi32_si128(j - shift_base);
+        for (uint8_t v=0; v < BCM_SIMD_GROUP; v += 8) {
+            __m256i acc = _mm256_setzero_si256();
+            for (uint8_t k=0; k < count; k++) {
+                __m256i w = _mm256_load_si256((const __m256i*)&words[k][v]);
+                w   = _mm256_and_si256(_mm256_srl_epi32(w, bit), one);
+                acc = _mm256_or_si256(acc, _mm256_sll_epi32(w, pin_count[k]));
+            }
+            _mm256_storeu_si256((__m256i*)(out + v), acc);
+        }
+    }
+}
+
+SIMD_ENCODERS(sse2)
+SIMD_ENCODERS(avx2)
+SIMD_TABLE(sse2)
+SIMD_TABLE(avx2)
+
+#endif
+
+
+__attribute__((cold))
+bcm_row_encoder_fn bcm_simd_encoder(const scene_info *scene) {
+    const uint8_t wide  = scene->bit_depth > 32;
+    const uint8_t ports = MIN(MAX(scene->num_ports, 1), 3) - 1;
+    const uint8_t rgba  = scene->stride == 4;
+#if defined(__ARM_NEON)
+    // NEON is always there on aarch64 and on every Pi with an armv7 kernel
+    return neon_encoders[wide][ports][rgba];
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2_encoders[wide][ports][rgba];
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return sse2_encoders[wide][ports][rgba];
+    }
+    return NULL;
+#else
+    (void)wide; (void)ports; (void)rgba;
+    return NULL;
+#endif
+}
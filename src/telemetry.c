@@ -0,0 +1,265 @@
+/**
+ * scan out timing telemetry.
+ *
+ * render_forever timestamps every row, bit plane and refresh with hub_cycles() (one counter read,
+ * no syscall) and adds the durations to histograms in a hub_stats page. with scene->telemetry the
+ * page is shared memory, so another process can watch min / p50 / p99 / max for jitter from
+ * interrupts or thermal throttling without touching the scan out thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "telemetry.h"
+
+
+__attribute__((cold))
+static uint64_t tick_frequency(void) {
+#if defined(__aarch64__)
+    uint64_t hz;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(hz));
+    return hz;
+#elif defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7
+    uint32_t hz;
+    asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(hz));
+    return hz;
+#elif defined(__x86_64__) || defined(__i386__)
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const uint64_t start_ticks = hub_cycles();
+    const struct timespec delay = {.tv_sec = 0, .tv_nsec = 20000000};
+    nanosleep(&delay, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const uint64_t ticks = hub_cycles() - start_ticks;
+    const uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    return (ticks * 1000000000ULL) / ns;
+#else
+    return 1000000000ULL;
+#endif
+}
+
+uint64_t hub_tick_hz(void) {
+    static uint64_t tick_hz = 0;
+    if (UNLIKELY(tick_hz == 0)) {
+        tick_hz = tick_frequency();
+    }
+    return tick_hz;
+}
+
+static void histogram_clear(hub_histogram *h) {
+    for (int i=0; i < HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->min, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+}
+
+static void stats_clear(hub_stats *stats) {
+    histogram_clear(&stats->frame);
+    histogram_clear(&stats->row);
+    histogram_clear(&stats->pad);
+    for (int i=0; i < 64; i++) {
+        histogram_clear(&stats->plane[i]);
+    }
+}
+
+// the page telemetry_create() mapped at HUB_STATS_NAME, telemetry_destroy() unlinks it
+static hub_stats *shared_stats = NULL;
+
+/**
+ * @brief map HUB_STATS_NAME, NULL (with a warning) if shared memory is not available
+ */
+__attribute__((cold))
+static hub_stats *stats_map_shared(const char *name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "unable to create shared memory %s (%s), telemetry is process local\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(hub_stats)) != 0) {
+        fprintf(stderr, "unable to size shared memory %s (%s), telemetry is process local\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    hub_stats *stats = (hub_stats*)mmap(NULL, sizeof(hub_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (stats == MAP_FAILED) ? NULL : stats;
+}
+
+hub_stats *telemetry_create(const scene_info *scene) {
+    if (!scene->telemetry && !scene->show_fps) {
+        return NULL;
+    }
+
+    hub_stats *stats = (scene->telemetry) ? stats_map_shared(HUB_STATS_NAME) : NULL;
+    shared_stats = stats;
+    if (stats == NULL) {
+        stats = (hub_stats*)calloc(1, sizeof(hub_stats));
+        if (stats == NULL) {
+            die("unable to allocate %zu bytes for scan out telemetry\n", sizeof(hub_stats));
+        }
+    }
+
+    // a page left by an earlier run is not valid until set up again
+    stats->magic = 0;
+    stats_clear(stats);
+    stats->tick_hz     = hub_tick_hz();
+    stats->bit_depth   = scene->bit_depth;
+    stats->half_height = scene->geometry.half_height;
+    stats->report_at   = hub_cycles() + (stats->tick_hz * TELEMETRY_REPORT_S);
+    atomic_store_explicit(&stats->seq, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->refresh_hz, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->render_scale, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->reset, false, memory_order_relaxed);
+    stats->version = HUB_STATS_VERSION;
+    // magic last, a reader that sees it sees a fully set up page
+    atomic_thread_fence(memory_order_release);
+    stats->magic   = HUB_STATS_MAGIC;
+    return stats;
+}
+
+/**
+ * @brief print the panel refresh rate and frame handoff counters
+ */
+static void print_refresh_rate(const scene_info *scene, const hub_stats *stats) {
+    const double us = 1000000.0 / stats->tick_hz;
+    printf("Panel Refresh Rate: %luHz, dropped frames: %lu, unchanged frames: %lu, row p99: %.2fus max: %.2fus\n",
+        (unsigned long)atomic_load_explicit(&stats->refresh_hz, memory_order_relaxed),
+        (unsigned long)atomic_load_explicit(&scene->frames_dropped, memory_order_relaxed),
+        (unsigned long)atomic_load_explicit(&scene->frames_unchanged, memory_order_relaxed),
+        histogram_percentile(&stats->row, 99.0) * us,
+        atomic_load_explicit(&stats->row.max, memory_order_relaxed) * us);
+    if (scene->pacer.period > 0 && scene->pacer.warmup == 0) {
+        printf("Fixed refresh: %luHz, headroom min: %.2fus p50: %.2fus, missed deadlines: %lu\n",
+            (unsigned long)(stats->tick_hz / scene->pacer.period),
+            atomic_load_explicit(&scene->pacer.headroom_min, memory_order_relaxed) * us,
+            histogram_percentile(&stats->pad, 50.0) * us,
+            (unsigned long)atomic_load_explicit(&scene->pacer.missed, memory_order_relaxed));
+    }
+}
+
+__attribute__((cold))
+void telemetry_destroy(hub_stats *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    if (stats == shared_stats) {
+        stats->magic = 0;
+        munmap(stats, sizeof(hub_stats));
+        shm_unlink(HUB_STATS_NAME);
+        shared_stats = NULL;
+    } else {
+        free(stats);
+    }
+}
+
+__attribute__((hot))
+void telemetry_frame(const scene_info *scene, hub_stats *stats, uint64_t *frame_start, const uint32_t planes) {
+    telemetry_mark(&stats->frame, frame_start);
+    atomic_fetch_add_explicit(&stats->seq, 1, memory_order_release);
+    stats->report_planes += planes;
+
+    if (UNLIKELY(atomic_load_explicit(&stats->reset, memory_order_relaxed))) {
+        stats_clear(stats);
+        atomic_store_explicit(&stats->reset, false, memory_order_relaxed);
+    }
+
+    if (UNLIKELY(*frame_start >= stats->report_at)) {
+        const uint64_t elapsed = *frame_start - (stats->report_at - (stats->tick_hz * TELEMETRY_REPORT_S));
+        atomic_store_explicit(&stats->refresh_hz, (uint32_t)((stats->report_planes * stats->tick_hz) / elapsed), memory_order_relaxed);
+        atomic_store_explicit(&stats->render_scale, atomic_load_explicit(&scene->render_scale, memory_order_relaxed), memory_order_relaxed);
+        if (scene->show_fps) {
+            print_refresh_rate(scene, stats);
+        }
+        stats->report_planes = 0;
+        stats->report_at     = *frame_start + (stats->tick_hz * TELEMETRY_REPORT_S);
+    }
+}
+
+hub_stats *hub_stats_open(const char *name) {
+    // read only if we can not write it (not the owner), the reset flag is then unavailable
+    int prot = PROT_READ | PROT_WRITE;
+    int fd = shm_open((name == NULL) ? HUB_STATS_NAME : name, O_RDWR, 0);
+    if (fd < 0) {
+        prot = PROT_READ;
+        fd   = shm_open((name == NULL) ? HUB_STATS_NAME : name, O_RDONLY, 0);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    hub_stats *stats = (hub_stats*)mmap(NULL, sizeof(hub_stats), prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        return NULL;
+    }
+    if (stats->magic != HUB_STATS_MAGIC || stats->version != HUB_STATS_VERSION) {
+        munmap(stats, sizeof(hub_stats));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return stats;
+}
+
+uint64_t histogram_percentile(const hub_histogram *h, const double percentile) {
+    const uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t target = (uint64_t)((count * percentile) / 100.0);
+    uint64_t seen = 0;
+    uint32_t bucket = 0;
+    for (; bucket < HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += atomic_load_explicit(&h->buckets[bucket], memory_order_relaxed);
+        if (seen > target) {
+            break;
+        }
+    }
+
+    // invert histogram_bucket(): lower bound plus half the bucket width
+    if (bucket < (1U << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    const uint32_t octave = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    const uint64_t sub    = bucket & ((1U << HISTOGRAM_SUB_BITS) - 1);
+    const uint64_t width  = 1ULL << (octave - HISTOGRAM_SUB_BITS);
+    return (((1ULL << HISTOGRAM_SUB_BITS) + sub) * width) + (width / 2);
+}
+
+static void print_histogram(FILE *out, const char *name, const hub_histogram *h, const double us) {
+    const uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    if (count == 0) {
+        return;
+    }
+    fprintf(out, "%-10s %12lu %10.2f %10.2f %10.2f %10.2f\n", name, (unsigned long)count,
+        atomic_load_explicit(&h->min, memory_order_relaxed) * us,
+        histogram_percentile(h, 50.0) * us,
+        histogram_percentile(h, 99.0) * us,
+        atomic_load_explicit(&h->max, memory_order_relaxed) * us);
+}
+
+void hub_stats_print(FILE *out, const hub_stats *stats) {
+    const double us = 1000000.0 / stats->tick_hz;
+    fprintf(out, "refresh: %luHz, refreshes: %lu, counter: %luHz, render scale: %lu%%\n",
+        (unsigned long)atomic_load_explicit(&stats->refresh_hz, memory_order_relaxed),
+        (unsigned long)atomic_load_explicit(&stats->seq, memory_order_relaxed), (unsigned long)stats->tick_hz,
+        (unsigned long)atomic_load_explicit(&stats->render_scale, memory_order_relaxed));
+    fprintf(out, "%-10s %12s %10s %10s %10s %10s\n", "us", "count", "min", "p50", "p99", "max");
+    print_histogram(out, "frame", &stats->frame, us);
+    print_histogram(out, "row", &stats->row, us);
+    print_histogram(out, "pad", &stats->pad, us);
+    char name[16];
+    for (int i=0; i < MIN(stats->bit_depth, 64); i++) {
+        snprintf(name, sizeof(name), "plane %d", i);
+        print_histogram(out, name, &stats->plane[i], us);
+    }
+}
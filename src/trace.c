@@ -0,0 +1,123 @@
+/**
+ * GPIO register trace.
+ *
+ * with scene->gpio_trace set render_forever runs the same scan out loops, but every register
+ * store is recorded with a hub_cycles() timestamp instead of going to /dev/gpiomem. this runs on
+ * any linux machine, and the trace can be replayed with the HUB75 decoder in decode.h to check
+ * what the panel would have shown and how long it took.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/param.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "trace.h"
+
+
+/**
+ * @brief start of a trace file, followed by the records
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t tick_hz;
+} trace_file_header;
+
+
+hub_trace *hub_trace_create(const uint32_t capacity, const char *filename) {
+    hub_trace *trace = (hub_trace*)calloc(1, sizeof(hub_trace));
+    if (trace == NULL) {
+        die("unable to allocate GPIO trace\n");
+    }
+    trace->capacity = MAX(capacity, 1);
+    trace->records  = (gpio_trace_record*)malloc(trace->capacity * sizeof(gpio_trace_record));
+    if (trace->records == NULL) {
+        die("unable to allocate %u GPIO trace records\n", trace->capacity);
+    }
+    trace->tick_hz = hub_tick_hz();
+
+    if (filename != NULL) {
+        trace->file = fopen(filename, "wb");
+        if (trace->file == NULL) {
+            die("unable to create GPIO trace %s: %s\n", filename, strerror(errno));
+        }
+        const trace_file_header header = { .magic = HUB_TRACE_MAGIC, .version = HUB_TRACE_VERSION, .tick_hz = trace->tick_hz };
+        if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+            die("unable to write GPIO trace %s: %s\n", filename, strerror(errno));
+        }
+    }
+    return trace;
+}
+
+void hub_trace_flush(hub_trace *trace) {
+    if (trace->file == NULL || trace->head == 0) {
+        return;
+    }
+    if (fwrite(trace->records, sizeof(gpio_trace_record), trace->head, trace->file) != trace->head) {
+        die("unable to write GPIO trace: %s\n", strerror(errno));
+    }
+    trace->head = 0;
+}
+
+__attribute__((cold))
+void hub_trace_wrap(hub_trace *trace) {
+    // without a file the ring keeps the newest records, hub_decode_trace starts at head
+    hub_trace_flush(trace);
+    trace->head = 0;
+}
+
+bool hub_trace_refresh(hub_trace *trace) {
+    trace->refreshes++;
+    return trace->max_refreshes > 0 && trace->refreshes >= trace->max_refreshes;
+}
+
+hub_trace *hub_trace_load(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    trace_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != HUB_TRACE_MAGIC || header.version != HUB_TRACE_VERSION) {
+        fclose(file);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    const long records = (ftell(file) - (long)sizeof(header)) / (long)sizeof(gpio_trace_record);
+    fseek(file, sizeof(header), SEEK_SET);
+
+    hub_trace *trace = (hub_trace*)calloc(1, sizeof(hub_trace));
+    if (trace == NULL || records < 0 || records > UINT32_MAX) {
+        free(trace);
+        fclose(file);
+        return NULL;
+    }
+    trace->capacity  = MAX(records, 1);
+    trace->records   = (gpio_trace_record*)malloc((size_t)trace->capacity * sizeof(gpio_trace_record));
+    if (trace->records == NULL) {
+        free(trace);
+        fclose(file);
+        return NULL;
+    }
+    trace->tick_hz   = header.tick_hz;
+    trace->count     = fread(trace->records, sizeof(gpio_trace_record), records, file);
+    trace->head      = trace->count % trace->capacity;
+    fclose(file);
+    return trace;
+}
+
+void hub_trace_free(hub_trace *trace) {
+    if (trace == NULL) {
+        return;
+    }
+    if (trace->file != NULL) {
+        hub_trace_flush(trace);
+        fclose(trace->file);
+    }
+    free(trace->records);
+    free(trace);
+}
@@ -16,6 +16,11 @@
 #include "util.h"
 #include "rpihub75.h"
 #include "pixels.h"
+#include "pool.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "scan.h"
+#include "backend.h"
 
 
 extern char *optarg;
@@ -188,54 +193,22 @@ int rnd(unsigned char *buffer, const size_t size) {
 }
 
 /**
- * @brief  calculate a jitter mask for the OE pin that should randomly toggle the OE pin on/off acording to brightness
- * TODO: look for rows of > 3 bits that are all the same and spread these bits out. this will reduce flicker on the display
+ * @brief  calculate an OE mask that turns the display on for brightness / 255 of the clocks.
+ * the same low discrepancy sequence the PWM scan out steps through, see OE_SEQUENCE_STEP
  * 
- * @param jitter_size  prime number > 1024 < 4096
+ * @param jitter_size  number of clocks
  * @param brightness   larger values produce brighter output, max 255
  * @return uint32_t*   a pointer to the jitter mask. caller must release memory
  */
 uint32_t *create_jitter_mask(const uint16_t jitter_size, const uint8_t brightness) {
-    srand(time(NULL));
-    uint32_t *jitter  = (uint32_t*)malloc(jitter_size*sizeof(uint32_t));
-    uint8_t *raw_data = (uint8_t*) malloc(jitter_size);
+    uint32_t *jitter   = (uint32_t*)calloc(jitter_size, sizeof(uint32_t));
+    const uint32_t on  = oe_threshold(brightness);
+    uint32_t phase     = 0;
 
-    // read random data from urandom into the raw_data buffer
-    rnd(raw_data, jitter_size);
-
-    // map raw data to the global OE jitter mask (toggle the OE pin on/off for JITTERS_SIZE frames)
     for (int i=0; i<jitter_size; i++) {
-        if (raw_data[i] > brightness) {
-            jitter[i] = PIN_OE;
-        }
-    }
-
-    // look for runs of 4 or more 1 or 0. where we find a run, regenerate the data
-    // make 3 passes at long run reduction, #defines in rpihub75.h  ....
-    for (int j = 0; j < JITTER_PASSES; j++) {
-        // Detect and redistribute runs of >4 identical bits
-        for (int i = 0; i < jitter_size - JITTER_MAX_RUN_LEN; i++) {
-            int run_length = 1;
-
-            // Check if we have a run of similar bits (either all set or all clear)
-            while (i + run_length < jitter_size && jitter[i] == jitter[i + run_length]) {
-                run_length++;
-            }
-
-            // If the run length is more than 3, recalculate the bits
-            if (run_length >= JITTER_MAX_RUN_LEN) {
-                // recreate these bits, enchancement: pull bits from /dev/urandom 
-                for (int j = i; j < i + run_length; j++) {
-                    jitter[j] = ((rand() % 255) > brightness) ? PIN_OE : 0;  // Randomly set or clear the OE pin
-                }
-            }
-
-            // Skip over the run we just processed
-            i += run_length - 1;
-        }
+        jitter[i] = (phase >= on) ? PIN_OE : 0;
+        phase    += OE_SEQUENCE_STEP;
     }
-
-    free(raw_data);
     return jitter;
 }
 
@@ -448,7 +421,7 @@ void usage(int argc, char **argv) {
         "     -c <num chains>   number of panels chained  (1-16)\n"
         "     -g <gamma>        gamma correction          (1.0-2.8)\n"
         "     -d <bit depth>    bit depth                 (2-64)\n"
-        "     -b <brightness>   overall brightness level  (0-254)\n"
+        "     -b <brightness>   overall brightness level  (0-255)\n"
         "     -l <dither>       dithering intensity level (0-10)\n"
         "     -m <frames>       motion blur frames        (0-32)\n"
         "     -i <mapper>       image mapper (mirror, flip, mirror_flip)\n"
@@ -457,7 +430,28 @@ void usage(int argc, char **argv) {
         "     -z                run LED calibration script\n"
         "     -n                display data from UDP server on port %d (untested)\n"
         "     -o                display current FPS and Panel refresh Hz\n"
-        "     -?                this help\n", argv[0], SERVER_PORT);
+        "     -T                publish scan out timing histograms to shared memory %s\n"
+        "     -P                pre-bake address and OE lines into the GPIO stream (Pi5)\n"
+        "     -B                binary weighted BCM, -d is the number of bit planes (1-16, Pi5)\n"
+        "     -L                binary BCM: show each plane while the next one is shifted in\n"
+        "     -v                sync frame updates to the panel refresh\n"
+        "     -U                encode every row of every frame, even if the image did not change\n"
+        "     -e <threads>      bcm encode threads, 0 for one per cpu   (0-%d)\n"
+        "     -k <cpu>          scan out cpu, isolate it with isolcpus= (default %d)\n"
+        "     -r <priority>     scan out SCHED_FIFO priority, 0 for none (0-99, default %d)\n"
+        "                       the scan out never yields, use only with an isolated -k cpu\n"
+        "     -M                lock memory (mlockall) before scan out\n"
+        "     -q                move interrupts off the scan out cpu\n"
+        "     -W <file[:n]>     record GPIO stores to file for n refreshes instead of driving the pins\n"
+        "                       (default %d, 0 for no limit). no file keeps the last stores in memory\n"
+        "     -S <pattern[:n]>  multiplexed panel with n address rows, 8 for 1/8 scan\n"
+        "                       (straight, stripe, zstripe8, zstripe8r, zstripe4, direct)\n"
+        "     -G <backend>      scan out to pi5, pi4, memory (benchmark) or preview (%s)\n"
+        "     -R <hz>           fixed panel refresh rate, pad every refresh to 1/hz s (for cameras)\n"
+        "     -Z                read shader frames from GPU memory (GBM), no glReadPixels copy\n"
+        "     -E                encode shader frames to bit planes on the GPU (GLES 3.1 compute)\n"
+        "     -A                adapt the shader render resolution (0.25-2x) to hold -f\n"
+        "     -?                this help\n", argv[0], SERVER_PORT, HUB_STATS_NAME, MAX_ENCODE_THREADS, SCANOUT_CPU, SCANOUT_PRIORITY, TRACE_REFRESHES, HUB_PREVIEW_NAME);
 }
 
 
@@ -515,7 +509,6 @@ scene_info *default_scene(int argc, char **argv) {
     scene->panel_width = PANEL_WIDTH;
     scene->num_chains = 4;
     scene->num_ports = 1;
-    scene->buffer_ptr = 0;
     scene->stride = 3;
     scene->gamma = GAMMA;
     scene->red_gamma = RED_GAMMA_SCALE;
@@ -534,10 +527,19 @@ scene_info *default_scene(int argc, char **argv) {
     scene->motion_blur_frames = 0;
     scene->do_render = TRUE;
     scene->dither = 0.0f;
+    scene->bcm_mode = BCM_MODE_PWM;
+    scene->bcm_lsb_ns = BCM_LSB_NS;
 
     // default to 60 fps
     scene->fps = 60;
     scene->show_fps = FALSE;
+    scene->vsync = FALSE;
+    scene->encode_threads = 0;
+    scene->skip_unchanged = TRUE;
+    scene->scanout_cpu = SCANOUT_CPU;
+    scene->scanout_priority = SCANOUT_PRIORITY;
+    scene->lock_memory = FALSE;
+    scene->move_irqs = FALSE;
 
     // print usage if no arguments
     if (argc < 2) { 
@@ -546,7 +548,7 @@ scene_info *default_scene(int argc, char **argv) {
 
     // Parse command-line options
     int opt;
-    while ((opt = getopt(argc, argv, "O:x:y:w:h:s:f:p:c:g:d:m:b:t:l:i:jzo?")) != -1) {
+    while ((opt = getopt(argc, argv, "O:x:y:w:h:s:f:p:c:g:d:m:b:t:l:i:e:k:r:W:S:G:R:jzoPBLvqMTZEAU?")) != -1) {
         switch (opt) {
         case 's':
             scene->shader_file = optarg;
@@ -583,7 +585,11 @@ scene_info *default_scene(int argc, char **argv) {
             scene->bit_depth = atoi(optarg);
             break;
         case 'b':
-            scene->brightness = atoi(optarg);
+            int brightness = atoi(optarg);
+            if (brightness < 0 || brightness > 255) {
+                die("brightness must be 0 - 255\n");
+            }
+            scene->brightness = (uint8_t)brightness;
             break;
         case 'm':
             scene->motion_blur_frames = atoi(optarg);
@@ -600,6 +606,100 @@ scene_info *default_scene(int argc, char **argv) {
         case 'o':
             scene->show_fps = TRUE;
             break;
+        case 'T':
+            scene->telemetry = TRUE;
+            break;
+        case 'P':
+            scene->prebaked_stream = TRUE;
+            break;
+        case 'B':
+            scene->bcm_mode = BCM_MODE_BINARY;
+            break;
+        case 'L':
+            scene->overlap_shift = TRUE;
+            break;
+        case 'v':
+            scene->vsync = TRUE;
+            break;
+        case 'e':
+            int threads = atoi(optarg);
+            if (threads < 0 || threads > MAX_ENCODE_THREADS) {
+                die("encode threads must be 0 - %d\n", MAX_ENCODE_THREADS);
+            }
+            scene->encode_threads = (uint8_t)threads;
+            break;
+        case 'k':
+            // check_scene checks the cpu is online, it only sees the narrowed value
+            int cpu = atoi(optarg);
+            if (cpu < 0 || cpu > UINT8_MAX) {
+                die("scan out cpu must be 0 - %d\n", UINT8_MAX);
+            }
+            scene->scanout_cpu = (uint8_t)cpu;
+            break;
+        case 'r':
+            scene->scanout_priority = MIN(atoi(optarg), 99);
+            break;
+        case 'q':
+            scene->move_irqs = TRUE;
+            break;
+        case 'M':
+            scene->lock_memory = TRUE;
+            break;
+        case 'W':
+        {
+            // split by hand, strtok skips the empty file name of -W :n
+            const char *count = strchr(optarg, ':');
+            int refreshes = (count != NULL) ? atoi(count + 1) : -1;
+            if (count != NULL && refreshes < 0) {
+                die("trace refreshes must be 0 or more\n");
+            }
+            char file[256];
+            snprintf(file, sizeof(file), "%.*s", (count != NULL) ? (int)(count - optarg) : (int)strlen(optarg), optarg);
+            // no file keeps the last TRACE_RECORDS stores in memory, a file grows with every refresh
+            const char *filename = (file[0] != '\0') ? file : NULL;
+            if (refreshes < 0) {
+                refreshes = (filename != NULL) ? TRACE_REFRESHES : 0;
+            }
+            scene->gpio_trace = hub_trace_create(TRACE_RECORDS, filename);
+            scene->gpio_trace->max_refreshes = (uint32_t)refreshes;
+            break;
+        }
+        case 'S':
+            scene->scan_pattern = scan_pattern_find(get_nth_token(optarg, ':', 0));
+            if (scene->scan_pattern == NULL) {
+                die("unknown scan pattern %s\n", optarg);
+            }
+            int scan_rows = atoi(get_nth_token(optarg, ':', 1));
+            if (scan_rows < 0 || scan_rows > 32) {
+                die("scan rows must be 0 - 32\n");
+            }
+            scene->scan_rows = (uint8_t)scan_rows;
+            break;
+        case 'Z':
+            scene->gpu_zero_copy = TRUE;
+            break;
+        case 'E':
+            scene->gpu_encode = TRUE;
+            break;
+        case 'A':
+            scene->gpu_adaptive_scale = TRUE;
+            break;
+        case 'U':
+            scene->skip_unchanged = FALSE;
+            break;
+        case 'R':
+            int refresh_hz = atoi(optarg);
+            if (refresh_hz < 0 || refresh_hz > UINT16_MAX) {
+                die("refresh rate must be 0 - %d Hz\n", UINT16_MAX);
+            }
+            scene->refresh_hz = (uint16_t)refresh_hz;
+            break;
+        case 'G':
+            scene->backend = hub_backend_find(optarg);
+            if (scene->backend == NULL) {
+                die("unknown backend %s, must be one of (pi5, pi4, memory, trace, preview)\n", optarg);
+            }
+            break;
         case 't':
             char *lvl = get_nth_token(optarg, ':', 1);
             // printf("lvl: %s\n", lvl);
@@ -671,11 +771,40 @@ scene_info *default_scene(int argc, char **argv) {
         }
     }
 
-    // create 
-    size_t buffer_size = (scene->width + 1) * (scene->height + 1) * 3 * scene->bit_depth;
-    // force the buffers to be 16 byte aligned to improve auto vectorization
-    scene->bcm_signalA = aligned_alloc(16, buffer_size * 4);
-    scene->bcm_signalB = aligned_alloc(16, buffer_size * 4);
+    // Pi3/4 scan out stores precomputed SET / CLR pairs, see bcm_geometry
+    const int pi_model = (scene->backend != NULL && scene->backend->pi_model != 0) ? scene->backend->pi_model : hub_pi_model();
+    scene->set_clr_pairs = (pi_model == 3 || pi_model == 4);
+
+    // create exactly sized plane major bcm buffers, see bcm_geometry
+    bcm_geometry_init(scene);
+    const size_t frame_size  = scene->geometry.frame_words * sizeof(uint32_t);
+    // aligned_alloc takes a multiple of the alignment, the padding past the last plane is never read
+    const size_t buffer_size = (frame_size + 63) & ~(size_t)63;
+    // force the buffers to be cache line aligned, width is a multiple of 16 so every row run is too
+    for (int i=0; i<3; i++) {
+        scene->bcm_signal[i] = aligned_alloc(64, buffer_size);
+        if (scene->bcm_signal[i] == NULL) {
+            die("unable to allocate %zu bytes of bcm buffer\n", buffer_size);
+        }
+        memset(scene->bcm_signal[i], 0, buffer_size);
+    }
+    // producer writes 0, 1 is the (empty) ready frame, 2 is on the wire
+    scene->bcm_back = 0;
+    scene->bcm_last = 1;
+    atomic_init(&scene->bcm_ready, 1);
+    atomic_init(&scene->bcm_front, 2);
+
+    // row hashes start unknown, so the first frame is fully encoded
+    for (int i=0; i<3; i++) {
+        scene->row_hash[i] = calloc(scene->geometry.half_height, sizeof(uint64_t));
+        if (scene->row_hash[i] == NULL) {
+            die("unable to allocate row hashes\n");
+        }
+    }
+    scene->image_hash = calloc(scene->geometry.half_height, sizeof(uint64_t));
+    if (scene->image_hash == NULL) {
+        die("unable to allocate image row hashes\n");
+    }
     scene->image = aligned_alloc(16, scene->width * scene->height * 4); // make sure we always have enough for RGBA
 
     return scene;
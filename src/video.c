@@ -157,7 +157,7 @@ bool hub_render_video(scene_info *scene, const char *filename) {
 
                 map_byte_image_to_bcm(scene, frame_rgb->data[0]);
 
-		calculate_fps(fps, scene->show_fps);
+		hub_frame_sync(scene, fps);
             }
         }
         av_packet_unref(&packet);
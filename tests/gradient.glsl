@@ -0,0 +1,5 @@
+// a still image with every channel value in it, for the GPU tests
+void mainImage(out vec4 fragColor, in vec2 fragCoord) {
+    vec2 p = fragCoord / iResolution.xy;
+    fragColor = vec4(p.x, p.y, fract((fragCoord.x * 3.0 + fragCoord.y * 5.0) / 97.0), 1.0);
+}
@@ -0,0 +1,101 @@
+/**
+ * compare the SIMD row encoders (NEON, AVX2 or SSE2, whichever bcm_simd_encoder() picks on
+ * this cpu) with the scalar encoders for every bit depth class, pixel order, port count and
+ * stride. the output must be bit identical.
+ *
+ * to check NEON from an x86 box, cross compile and run under qemu:
+ *   make test CC=aarch64-linux-gnu-gcc TEST_RUN="qemu-aarch64 -L /usr/aarch64-linux-gnu"
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "pixels.h"
+#include "simd.h"
+
+
+/**
+ * @brief encode every row of scene->image with encoder into a frame sized buffer
+ */
+static uint32_t *encode_frame(const scene_info *scene, func_bcm_encoder_t encoder, const void *bits) {
+    const bcm_geometry *geometry = &scene->geometry;
+    uint32_t *out = (uint32_t*)calloc(geometry->frame_words, sizeof(uint32_t));
+    bcm_encode_scratch *scratch = (bcm_encode_scratch*)aligned_alloc(64, sizeof(bcm_encode_scratch));
+    bcm_pin_table table;
+    bcm_pin_table_init(&table, scene);
+
+    for (uint16_t y=0; y < geometry->half_height; y++) {
+        encoder(scene, &table, bits, out + (y * geometry->row_words) + geometry->pixel_offset,
+            scene->image + (y * geometry->width * scene->stride), scratch);
+    }
+    free(scratch);
+    return out;
+}
+
+/**
+ * @brief encode a random image with both encoders and count the words that differ
+ */
+static size_t compare(const int ports, const int bit_depth, const char *order, const uint8_t stride) {
+    char height[8], depth[8], num_ports[8];
+    snprintf(height, sizeof(height), "%d", 32 * ports);
+    snprintf(depth, sizeof(depth), "%d", bit_depth);
+    snprintf(num_ports, sizeof(num_ports), "%d", ports);
+    char *argv[] = {"test_encoder", "-x", "128", "-y", height, "-w", "64", "-h", "32", "-c", "2",
+        "-p", num_ports, "-d", depth, "-O", (char*)order, "-G", "pi5", "-k", "0", NULL};
+    optind = 1;
+    scene_info *scene = default_scene(sizeof(argv) / sizeof(argv[0]) - 1, argv);
+    scene->stride = stride;
+    check_scene(scene);
+
+    srand(bit_depth * 7 + ports);
+    for (int i=0; i < scene->width * scene->height * scene->stride; i++) {
+        scene->image[i] = rand() & 0xFF;
+    }
+
+    func_bcm_encoder_t simd = bcm_simd_encoder(scene);
+    if (simd == NULL) {
+        printf("SKIP no SIMD encoder on this cpu\n");
+        exit(0);
+    }
+
+    float quant_errors[768];
+    void *bits = tone_map_rgb_bits(scene, scene->bit_depth, quant_errors);
+    uint32_t *expected = encode_frame(scene, bcm_scalar_encoder(scene), bits);
+    uint32_t *actual   = encode_frame(scene, simd, bits);
+
+    size_t bad = 0;
+    for (uint32_t i=0; i < scene->geometry.frame_words; i++) {
+        bad += expected[i] != actual[i];
+    }
+    printf("%s ports: %d, bit depth: %2d, order: %s, stride: %d, mismatched words: %zu\n",
+        (bad == 0) ? "ok  " : "FAIL", ports, bit_depth, order, stride, bad);
+
+    free(expected);
+    free(actual);
+    free(bits);
+    return bad;
+}
+
+int main(void) {
+    static const int depths[] = {8, 12, 16, 24, 32, 40, 48, 64};
+    static const char *orders[] = {"RGB", "RBG", "BGR"};
+    size_t failed = 0;
+
+    for (int ports=1; ports <= 3; ports++) {
+        for (size_t d=0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+            for (int o=0; o < 3; o++) {
+                for (uint8_t stride=3; stride <= 4; stride++) {
+                    failed += compare(ports, depths[d], orders[o], stride) != 0;
+                }
+            }
+        }
+    }
+
+    if (failed > 0) {
+        printf("%zu configurations differ from the scalar encoder\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+/**
+ * compare the GPU encode shader (-E) with the scalar CPU encoder. tests/gradient.glsl is rendered
+ * twice for every layout: once read back and captured, then encoded with bcm_scalar_encoder(),
+ * and once encoded to bit planes by the compute shader. the published frames must be bit identical.
+ *
+ * runs on surfaceless EGL with Mesa's software rasterizer (llvmpipe), no GPU needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "pixels.h"
+#include "simd.h"
+#include "gpu.h"
+
+
+/**
+ * @brief one panel layout and bcm mode
+ */
+typedef struct {
+    const char *name;
+    const char *options[12];
+} encode_layout;
+
+static const encode_layout layouts[] = {
+    { "64x32 8 bit",         { "-d", "8", NULL } },
+    { "64x32 16 bit BGR",    { "-d", "16", "-O", "BGR", NULL } },
+    { "64x32 40 bit",        { "-d", "40", NULL } },
+    { "128x64 2 ports RBG",  { "-x", "128", "-y", "64", "-c", "2", "-p", "2", "-O", "RBG", NULL } },
+    { "64x96 3 ports 12 bit", { "-y", "96", "-p", "3", "-d", "12", NULL } },
+    { "64x32 binary 10 bit",  { "-B", "-d", "10", NULL } },
+    // -b only goes into the tone map table with binary bcm, or with -j (no OE jitter)
+    { "binary brightness 90", { "-B", "-d", "10", "-b", "90", NULL } },
+    { "64x32 brightness 90",  { "-d", "8", "-b", "90", "-j", NULL } },
+};
+
+static uint8_t *captured = NULL;
+static int      captures = 0;
+
+/**
+ * @brief keep the second frame render_shader reads back, the first may still compile shaders
+ */
+static void capture_frame(scene_info *scene, uint8_t *image) {
+    memcpy(captured, image, (size_t)scene->width * scene->height * scene->stride);
+    if (++captures >= 2) {
+        scene->do_render = false;
+    }
+}
+
+static scene_info *layout_scene(const encode_layout *layout, const bool gpu_encode) {
+    char *argv[32] = {"test_gpu_encode", "-x", "64", "-y", "32", "-w", "64", "-h", "32", "-c", "1",
+        "-k", "0", "-s", "tests/gradient.glsl"};
+    int argc = 15;
+    for (int i=0; layout->options[i] != NULL; i++) {
+        argv[argc++] = (char*)layout->options[i];
+    }
+    if (gpu_encode) {
+        argv[argc++] = "-E";
+    }
+    argv[argc] = NULL;
+    optind = 1;
+    scene_info *scene = default_scene(argc, argv);
+    // render_shader frames are RGBA. default_scene picks SET / CLR pairs on a Pi3/4, the shader can't encode those
+    scene->stride = 4;
+    scene->set_clr_pairs = false;
+    check_scene(scene);
+    return scene;
+}
+
+/**
+ * @brief the frame render_shader publishes with the compute shader encoding it
+ */
+static const uint32_t *gpu_encoded(scene_info *scene) {
+    pthread_t render;
+    pthread_create(&render, NULL, render_shader, scene);
+    // nothing scans out, every frame after the first is counted as dropped
+    while (atomic_load(&scene->frames_dropped) < 2) {
+        usleep(1000);
+    }
+    scene->do_render = false;
+    pthread_join(render, NULL);
+    return scene->bcm_signal[atomic_load(&scene->bcm_ready) & BCM_FRAME_INDEX];
+}
+
+/**
+ * @brief a frame render_shader reads back, encoded row by row with the scalar encoder
+ */
+static uint32_t *cpu_encoded(scene_info *scene) {
+    captured = (uint8_t*)malloc((size_t)scene->width * scene->height * scene->stride);
+    captures = 0;
+    scene->bcm_mapper = capture_frame;
+    render_shader(scene);
+
+    const bcm_geometry *geometry = &scene->geometry;
+    uint32_t *out = (uint32_t*)calloc(geometry->frame_words, sizeof(uint32_t));
+    bcm_encode_scratch *scratch = (bcm_encode_scratch*)aligned_alloc(64, sizeof(bcm_encode_scratch));
+    func_bcm_encoder_t encoder = bcm_scalar_encoder(scene);
+    const void *bits = bcm_tone_lut(scene, NULL);
+    bcm_pin_table table;
+    bcm_pin_table_init(&table, scene);
+    for (uint16_t y=0; y < geometry->half_height; y++) {
+        encoder(scene, &table, bits, out + (y * geometry->row_words) + geometry->pixel_offset,
+            captured + (y * geometry->width * scene->stride), scratch);
+    }
+    free(scratch);
+    free(captured);
+    return out;
+}
+
+int main(void) {
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+    int failed = 0;
+    for (size_t i=0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        uint32_t *expected = cpu_encoded(layout_scene(&layouts[i], false));
+        scene_info *scene  = layout_scene(&layouts[i], true);
+        const uint32_t *actual = gpu_encoded(scene);
+
+        size_t bad = 0;
+        for (uint32_t w=0; w < scene->geometry.frame_words; w++) {
+            bad += expected[w] != actual[w];
+        }
+        // map_byte_image_to_bcm creates the encode pool, the frames went through the CPU if it exists
+        const bool on_gpu = scene->encode_pool == NULL;
+        printf("%s %-20s mismatched words: %zu of %u%s\n", (bad == 0 && on_gpu) ? "ok  " : "FAIL", layouts[i].name,
+            bad, scene->geometry.frame_words, on_gpu ? "" : ", encoded on the CPU");
+        failed += bad != 0 || !on_gpu;
+        free(expected);
+    }
+    return failed != 0;
+}
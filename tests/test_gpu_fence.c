@@ -0,0 +1,80 @@
+/**
+ * stop render_shader while it waits on a frame fence. after a few frames glClientWaitSync is
+ * made to time out like a stalled GPU, then do_render is cleared. the frame it waited for must
+ * not be mapped or encoded, and render_shader must return within a fence timeout.
+ *
+ * glClientWaitSync is interposed because llvmpipe finishes a frame inside glReadPixels, its
+ * fences have always signaled by the time they are waited on. everything else runs on surfaceless
+ * EGL with Mesa's software rasterizer, no GPU needed
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <GLES3/gl31.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "telemetry.h"
+#include "gpu.h"
+
+
+static atomic_bool stalled;
+static atomic_int  frames_encoded;
+static atomic_int  frames_after_stop;
+
+/**
+ * @brief the driver's glClientWaitSync, or a timeout without waking up once stalled is set
+ */
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    static GLenum (*client_wait_sync)(GLsync, GLbitfield, GLuint64) = NULL;
+    if (client_wait_sync == NULL) {
+        client_wait_sync = (GLenum (*)(GLsync, GLbitfield, GLuint64))dlsym(RTLD_NEXT, "glClientWaitSync");
+    }
+    if (!atomic_load(&stalled)) {
+        return client_wait_sync(sync, flags, timeout);
+    }
+    usleep(timeout / 1000);
+    return GL_TIMEOUT_EXPIRED;
+}
+
+/**
+ * @brief count the frames render_shader hands over, and the ones after do_render was cleared
+ */
+static void count_frames(scene_info *scene, uint8_t *image) {
+    (void)image;
+    atomic_fetch_add(&frames_encoded, 1);
+    if (!scene->do_render) {
+        atomic_fetch_add(&frames_after_stop, 1);
+    }
+}
+
+int main(void) {
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+    char *argv[] = {"test_gpu_fence", "-x", "64", "-y", "32", "-w", "64", "-h", "32", "-c", "1",
+        "-k", "0", "-s", "tests/gradient.glsl", NULL};
+    scene_info *scene = default_scene(sizeof(argv) / sizeof(argv[0]) - 1, argv);
+    scene->bcm_mapper = count_frames;
+
+    pthread_t render;
+    pthread_create(&render, NULL, render_shader, scene);
+    while (atomic_load(&frames_encoded) < 3) {
+        usleep(1000);
+    }
+    // several fence timeouts pass before do_render is cleared
+    atomic_store(&stalled, true);
+    usleep((GPU_FENCE_TIMEOUT_NS / 1000) * 3);
+    scene->do_render = false;
+    const uint64_t stop = hub_cycles();
+    pthread_join(render, NULL);
+    const double ms = (hub_cycles() - stop) * 1000.0 / hub_tick_hz();
+
+    const int late = atomic_load(&frames_after_stop);
+    const bool ok  = late == 0 && ms < (GPU_FENCE_TIMEOUT_NS / 1000000.0) * 2;
+    printf("%s frames encoded: %d, after do_render was cleared: %d, stopped in %.0fms\n",
+        ok ? "ok  " : "FAIL", atomic_load(&frames_encoded), late, ms);
+    return !ok;
+}
@@ -0,0 +1,55 @@
+/**
+ * the render scale must grow when the GPU has time to spare, with the GPU time estimated from the
+ * frame fences (built with GPU_TIMER_QUERY 0). tests/gradient.glsl is rendered at 64x32 with -A at
+ * 100fps, a few hundred microseconds of a 10ms frame, so every window of GPU_SCALE_FRAMES frames
+ * after the warm up should add GPU_SCALE_STEP percent.
+ *
+ * llvmpipe draws the frame inside glReadPixels, so this only shows that the loop's own map, encode
+ * and frame sync time is left out. runs on surfaceless EGL, no GPU needed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "gpu.h"
+
+
+// warm up, then three scale windows
+#define SCALE_FRAMES (GPU_SCALE_FRAMES * 4)
+
+static atomic_int frames_mapped;
+
+/**
+ * @brief count the frames, there is nothing to scan them out to
+ */
+static void count_frames(scene_info *scene, uint8_t *image) {
+    (void)scene;
+    (void)image;
+    atomic_fetch_add(&frames_mapped, 1);
+}
+
+int main(void) {
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+    char *argv[] = {"test_gpu_scale", "-x", "64", "-y", "32", "-w", "64", "-h", "32", "-c", "1",
+        "-k", "0", "-f", "100", "-A", "-s", "tests/gradient.glsl", NULL};
+    scene_info *scene = default_scene(sizeof(argv) / sizeof(argv[0]) - 1, argv);
+    scene->bcm_mapper = count_frames;
+
+    pthread_t render;
+    pthread_create(&render, NULL, render_shader, scene);
+    while (atomic_load(&frames_mapped) < SCALE_FRAMES) {
+        usleep(1000);
+    }
+    // render_shader clears the scale when it returns
+    const uint32_t scale = atomic_load(&scene->render_scale);
+    scene->do_render = false;
+    pthread_join(render, NULL);
+
+    const bool ok = scale > 100;
+    printf("%s render scale after %d frames: %u%%\n", ok ? "ok  " : "FAIL", SCALE_FRAMES, scale);
+    return !ok;
+}
@@ -0,0 +1,130 @@
+/**
+ * golden trace test of the scan out loops. a fixed bcm frame is scanned out for two refreshes
+ * into a ring trace (-W :2), and the trace is checked two ways:
+ *
+ * - the HUB75 decoder (decode.h) must latch exactly the frame's color pins for every plane and
+ *   row, with every row shifted the full width
+ * - the register stores must match the golden store count and FNV-1a hash of (register, value)
+ *   recorded for each layout. any change to the stores a loop makes shows up here, update the
+ *   golden values only after checking the new trace on a panel or with the decoder
+ *
+ * the Pi5 loops are traced on every machine (set_clr_pairs off). the golden hashes assume the
+ * default HZELLER_HAT pin map.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "trace.h"
+#include "decode.h"
+
+
+/**
+ * @brief one scan out layout and its golden trace
+ */
+typedef struct {
+    const char *name;
+    const char *options[6];
+    uint64_t    stores;
+    uint64_t    hash;
+} golden_trace;
+
+static const golden_trace goldens[] = {
+    { "pwm 64x32",        { NULL },                         33280, 0x2bd620170a09a85dULL },
+    { "pwm 2 ports",      { "-p", "2", "-y", "64", NULL },  33280, 0xd15224216f707fddULL },
+    { "pwm 1/8 scan",     { "-S", "zstripe8:8", NULL },     33024, 0x7e5da4ed29d95735ULL },
+    { "pwm 12 bit",       { "-d", "12", NULL },             49920, 0x16387e9e83a5fab5ULL },
+    { "binary bcm",       { "-B", "-d", "6", NULL },        25536, 0xdf605b1e5e2b9eddULL },
+};
+
+
+/**
+ * @brief FNV-1a of the register and value of every store, oldest first. timestamps are left out
+ */
+static uint64_t trace_hash(const hub_trace *trace) {
+    const uint64_t recorded = (trace->count < trace->capacity) ? trace->count : trace->capacity;
+    const uint32_t start    = (trace->count < trace->capacity) ? 0 : trace->head;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint64_t i=0; i < recorded; i++) {
+        const gpio_trace_record *record = &trace->records[(start + i) % trace->capacity];
+        const uint32_t words[2] = { record->reg, record->value };
+        const uint8_t *bytes = (const uint8_t*)words;
+        for (size_t b=0; b < sizeof(words); b++) {
+            hash = (hash ^ bytes[b]) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief trace two refreshes of a fixed frame and check it against the decoder and the golden values
+ */
+static int check(const golden_trace *golden) {
+    char *argv[24] = {"test_trace", "-x", "64", "-y", "32", "-w", "64", "-h", "32", "-c", "1",
+        "-d", "8", "-k", "0", "-W", ":2"};
+    int argc = 17;
+    for (int i=0; golden->options[i] != NULL; i++) {
+        argv[argc++] = (char*)golden->options[i];
+    }
+    argv[argc] = NULL;
+    optind = 1;
+    scene_info *scene = default_scene(argc, argv);
+    // the Pi5 loops on every host, default_scene picks SET / CLR pairs on a Pi3/4
+    scene->set_clr_pairs = false;
+    bcm_geometry_init(scene);
+    check_scene(scene);
+
+    // a random frame of color pins. address, OE, clock and latch are added by the scan out
+    const bcm_geometry *geometry = &scene->geometry;
+    hub_decode *decode = hub_decode_create(scene);
+    uint32_t *frame = bcm_back_buffer(scene);
+    uint32_t state = 0x9E3779B9;
+    for (uint32_t i=0; i < geometry->frame_words; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        frame[i] = state & decode->color_pins;
+    }
+    bcm_publish(scene);
+
+    render_forever(scene);
+    hub_trace *trace = scene->gpio_trace;
+    hub_decode_trace(decode, trace);
+    hub_decode_finish(decode);
+
+    // every plane and row the decoder latched must be the frame's
+    size_t bad_pixels = 0;
+    for (int plane=0; plane < scene->bit_depth; plane++) {
+        for (int y=0; y < geometry->half_height; y++) {
+            const uint32_t *row = frame + (plane * geometry->plane_words) + (y * geometry->row_words);
+            for (int x=0; x < geometry->width; x++) {
+                bad_pixels += decode->planes[((plane * geometry->half_height) + y) * geometry->width + x] != row[x];
+            }
+        }
+    }
+
+    const uint64_t hash = trace_hash(trace);
+    const bool matched = golden->stores == trace->count && golden->hash == hash;
+    const bool ok = bad_pixels == 0 && decode->bad_rows == 0 && decode->stores == trace->count && trace->refreshes == 2;
+    printf("%s %-16s stores: %lu, latches: %lu, bad rows: %lu, bad pixels: %zu, hash: %016lx%s\n",
+        (ok && matched) ? "ok  " : "FAIL", golden->name, (unsigned long)trace->count, (unsigned long)decode->latches,
+        (unsigned long)decode->bad_rows, bad_pixels, (unsigned long)hash, matched ? "" : " (golden differs)");
+
+    hub_decode_free(decode);
+    hub_trace_free(trace);
+    return ok && matched;
+}
+
+int main(void) {
+    int failed = 0;
+    for (size_t i=0; i < sizeof(goldens) / sizeof(goldens[0]); i++) {
+        failed += !check(&goldens[i]);
+    }
+    if (failed > 0) {
+        printf("%d of %zu traces differ\n", failed, sizeof(goldens) / sizeof(goldens[0]));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * replay a GPIO trace (-W trace.bin:n) through the HUB75 decoder and print what it saw. takes the
+ * same scene options the trace was recorded with, so the decoder knows the panel layout.
+ * To compile:
+ * make tools
+ * ./build/tools/hub_decode -x 128 -y 64 -w 64 -h 64 -c 2 trace.bin
+ * ./build/tools/hub_decode -x 128 -y 64 -w 64 -h 64 -c 2 trace.bin lit.ppm     # and save the lit time of every LED
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rpihub75.h"
+#include "util.h"
+#include "trace.h"
+#include "decode.h"
+
+
+int main(int argc, char **argv) {
+    scene_info *scene = default_scene(argc, argv);
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [scene options] <trace.bin> [lit.ppm]\n", argv[0]);
+        return 1;
+    }
+
+    hub_trace *trace = hub_trace_load(argv[optind]);
+    if (trace == NULL) {
+        fprintf(stderr, "unable to read GPIO trace %s\n", argv[optind]);
+        return 1;
+    }
+
+    hub_decode *decode = hub_decode_create(scene);
+    hub_decode_trace(decode, trace);
+    hub_decode_finish(decode);
+    printf("%s: %lu records, %.1fms\n", argv[optind], (unsigned long)trace->count,
+        (decode->ticks - decode->first_ticks) * 1000.0 / trace->tick_hz);
+    hub_decode_print(stdout, decode, trace->tick_hz);
+
+    // the lit fraction of every LED, scaled so the brightest is 255
+    if (optind + 1 < argc) {
+        const int    height = scene->num_ports * scene->panel_height;
+        const size_t values = (size_t)height * scene->width * 3;
+        double max = 0.0;
+        for (size_t i=0; i < values; i++) {
+            max = (decode->intensity[i] > max) ? decode->intensity[i] : max;
+        }
+        FILE *out = fopen(argv[optind + 1], "wb");
+        if (out == NULL) {
+            perror(argv[optind + 1]);
+            return 1;
+        }
+        fprintf(out, "P6\n%d %d\n255\n", scene->width, height);
+        for (size_t i=0; i < values; i++) {
+            fputc((max > 0.0) ? (int)(decode->intensity[i] * 255.0 / max + 0.5) : 0, out);
+        }
+        fclose(out);
+    }
+
+    hub_decode_free(decode);
+    hub_trace_free(trace);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * save the image the preview backend (-G preview) publishes as a binary PPM.
+ * To compile:
+ * make tools
+ * ./build/tools/hub_preview frame.ppm
+ * ./build/tools/hub_preview | display     # or write to stdout
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rpihub75.h"
+#include "backend.h"
+
+
+int main(int argc, char **argv) {
+    const char *name = HUB_PREVIEW_NAME;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n <name>] [file.ppm]\n"
+                "     -n <name>         shared memory name (default %s)\n", argv[0], HUB_PREVIEW_NAME);
+            return 1;
+        }
+    }
+
+    const hub_preview *preview = hub_preview_open(name);
+    if (preview == NULL) {
+        fprintf(stderr, "no preview at %s, start render_forever with -G preview\n", name);
+        return 1;
+    }
+
+    const size_t bytes = (size_t)preview->width * preview->height * 3;
+    uint8_t *rgb = (uint8_t*)malloc(bytes);
+    if (rgb == NULL) {
+        fprintf(stderr, "unable to allocate %zu bytes\n", bytes);
+        return 1;
+    }
+    const uint32_t frame = hub_preview_read(preview, rgb);
+
+    FILE *out = (optind < argc) ? fopen(argv[optind], "wb") : stdout;
+    if (out == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fprintf(out, "P6\n%d %d\n255\n", preview->width, preview->height);
+    if (fwrite(rgb, 1, bytes, out) != bytes) {
+        perror("write");
+        return 1;
+    }
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "frame %u, %dx%d\n", frame, preview->width, preview->height);
+    }
+    free(rgb);
+    return 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * print the scan out timing histograms of a running render_forever started with -T.
+ * To compile:
+ * make tools
+ * ./build/tools/hub_stats          # print once
+ * ./build/tools/hub_stats -i 5 -r  # clear, then print every 5 seconds
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "rpihub75.h"
+#include "telemetry.h"
+
+
+int main(int argc, char **argv) {
+    int interval = 0;
+    bool reset   = false;
+    const char *name = HUB_STATS_NAME;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:rn:")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'r':
+            reset = true;
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-i <seconds>] [-r] [-n <name>]\n"
+                "     -i <seconds>      print every n seconds instead of once\n"
+                "     -r                clear the histograms first (needs write access)\n"
+                "     -n <name>         shared memory name (default %s)\n", argv[0], HUB_STATS_NAME);
+            return 1;
+        }
+    }
+
+    hub_stats *stats = hub_stats_open(name);
+    if (stats == NULL) {
+        fprintf(stderr, "no stats at %s, start render_forever with -T\n", name);
+        return 1;
+    }
+    if (reset) {
+        atomic_store(&stats->reset, true);
+    }
+
+    do {
+        if (interval > 0 || reset) {
+            sleep((interval > 0) ? interval : 1);
+        }
+        hub_stats_print(stdout, stats);
+        fflush(stdout);
+    } while (interval > 0);
+
+    return 0;
+}